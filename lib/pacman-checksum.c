@@ -0,0 +1,272 @@
+/* pacman-checksum.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gi18n-lib.h>
+#include "pacman-error.h"
+#include "pacman-list.h"
+#include "pacman-private.h"
+
+/* large reads keep the disk busy while the checksum is computed */
+#define PACMAN_CHECKSUM_BUFFER_SIZE (1 << 20)
+
+gchar *pacman_checksum_file (const gchar *filename, GError **error) {
+	GChecksum *checksum;
+	guchar *buffer;
+	gchar *result = NULL;
+	gint fd;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	fd = open (filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_FILE_NOT_FOUND, _("Could not generate the MD5 sum of '%s': %s"), filename, g_strerror (errno));
+		return NULL;
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	
+	checksum = g_checksum_new (G_CHECKSUM_MD5);
+	buffer = (guchar *) g_malloc (PACMAN_CHECKSUM_BUFFER_SIZE);
+	
+	for (;;) {
+		gssize length = read (fd, buffer, PACMAN_CHECKSUM_BUFFER_SIZE);
+		
+		if (length > 0) {
+			g_checksum_update (checksum, buffer, length);
+		} else if (length == 0) {
+			result = g_strdup (g_checksum_get_string (checksum));
+			break;
+		} else if (errno != EINTR) {
+			g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not generate the MD5 sum of '%s': %s"), filename, g_strerror (errno));
+			break;
+		}
+	}
+	
+	g_free (buffer);
+	g_checksum_free (checksum);
+	close (fd);
+	return result;
+}
+
+typedef struct {
+	gchar *md5sum;
+	goffset size;
+	guint64 modified;
+	ino_t inode;
+	gboolean pending;
+} PacmanChecksumEntry;
+
+/* checksums of files this process has just written, so verifying them later does not read them again */
+static GMutex pacman_checksum_mutex;
+static GCond pacman_checksum_ready;
+static GHashTable *pacman_checksum_cache = NULL;
+static GThreadPool *pacman_checksum_pool = NULL;
+
+static void pacman_checksum_entry_free (gpointer data) {
+	PacmanChecksumEntry *entry = (PacmanChecksumEntry *) data;
+	
+	g_free (entry->md5sum);
+	g_slice_free (PacmanChecksumEntry, entry);
+}
+
+static guint64 pacman_checksum_get_modified (struct stat *info) {
+	/* a file can be rewritten several times in the same second */
+	return (guint64) info->st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000) + (guint64) info->st_mtim.tv_nsec;
+}
+
+static gboolean pacman_checksum_entry_matches (PacmanChecksumEntry *entry, struct stat *info) {
+	return entry->size == (goffset) info->st_size && entry->modified == pacman_checksum_get_modified (info) && entry->inode == info->st_ino;
+}
+
+static PacmanChecksumEntry *pacman_checksum_insert (const gchar *filename, struct stat *info, const gchar *md5sum) {
+	PacmanChecksumEntry *entry = g_slice_new0 (PacmanChecksumEntry);
+	
+	entry->md5sum = g_strdup (md5sum);
+	entry->size = (goffset) info->st_size;
+	entry->modified = pacman_checksum_get_modified (info);
+	entry->inode = info->st_ino;
+	entry->pending = (md5sum == NULL);
+	
+	if (pacman_checksum_cache == NULL) {
+		pacman_checksum_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, pacman_checksum_entry_free);
+	}
+	
+	g_hash_table_insert (pacman_checksum_cache, g_strdup (filename), entry);
+	return entry;
+}
+
+void pacman_checksum_remember (const gchar *filename, const gchar *md5sum) {
+	struct stat info;
+	
+	g_return_if_fail (filename != NULL);
+	g_return_if_fail (md5sum != NULL);
+	
+	if (stat (filename, &info) < 0) {
+		return;
+	}
+	
+	g_mutex_lock (&pacman_checksum_mutex);
+	pacman_checksum_insert (filename, &info, md5sum);
+	g_cond_broadcast (&pacman_checksum_ready);
+	g_mutex_unlock (&pacman_checksum_mutex);
+}
+
+static void pacman_checksum_prefetch_run (gpointer data, gpointer user_data) {
+	gchar *filename = (gchar *) data, *md5sum;
+	PacmanChecksumEntry *entry;
+	
+	/* the file was just written, so it should still be in the page cache */
+	md5sum = pacman_checksum_file (filename, NULL);
+	
+	g_mutex_lock (&pacman_checksum_mutex);
+	entry = (PacmanChecksumEntry *) g_hash_table_lookup (pacman_checksum_cache, filename);
+	if (entry != NULL && entry->pending) {
+		if (md5sum != NULL) {
+			entry->md5sum = md5sum;
+			entry->pending = FALSE;
+			md5sum = NULL;
+		} else {
+			g_hash_table_remove (pacman_checksum_cache, filename);
+		}
+	}
+	g_cond_broadcast (&pacman_checksum_ready);
+	g_mutex_unlock (&pacman_checksum_mutex);
+	
+	g_free (md5sum);
+	g_free (filename);
+}
+
+void pacman_checksum_prefetch (const gchar *filename) {
+	struct stat info;
+	
+	g_return_if_fail (filename != NULL);
+	
+	if (stat (filename, &info) < 0) {
+		return;
+	}
+	
+	g_mutex_lock (&pacman_checksum_mutex);
+	if (pacman_checksum_pool == NULL) {
+		pacman_checksum_pool = g_thread_pool_new (pacman_checksum_prefetch_run, NULL, 1, FALSE, NULL);
+	}
+	
+	pacman_checksum_insert (filename, &info, NULL);
+	g_thread_pool_push (pacman_checksum_pool, g_strdup (filename), NULL);
+	g_mutex_unlock (&pacman_checksum_mutex);
+}
+
+gchar *pacman_checksum_lookup (const gchar *filename) {
+	PacmanChecksumEntry *entry = NULL;
+	gchar *result = NULL;
+	struct stat info;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	if (stat (filename, &info) < 0) {
+		return NULL;
+	}
+	
+	g_mutex_lock (&pacman_checksum_mutex);
+	while (pacman_checksum_cache != NULL) {
+		entry = (PacmanChecksumEntry *) g_hash_table_lookup (pacman_checksum_cache, filename);
+		if (entry == NULL || !entry->pending) {
+			break;
+		}
+		
+		g_cond_wait (&pacman_checksum_ready, &pacman_checksum_mutex);
+	}
+	
+	if (entry != NULL) {
+		if (pacman_checksum_entry_matches (entry, &info)) {
+			result = g_strdup (entry->md5sum);
+		} else {
+			/* the file has been replaced since */
+			g_hash_table_remove (pacman_checksum_cache, filename);
+		}
+	}
+	g_mutex_unlock (&pacman_checksum_mutex);
+	
+	return result;
+}
+
+gchar *pacman_checksum_get (const gchar *filename) {
+	gchar *result;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	result = pacman_checksum_lookup (filename);
+	if (result == NULL) {
+		result = pacman_checksum_file (filename, NULL);
+		if (result != NULL) {
+			pacman_checksum_remember (filename, result);
+		}
+	}
+	
+	return result;
+}
+
+gchar *pacman_checksum_keep (const gchar *filename) {
+	gchar *result;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	/* linked rather than hashed, since it only needs hashing if a new copy is downloaded */
+	result = g_strconcat (filename, ".old", NULL);
+	unlink (result);
+	if (link (filename, result) < 0) {
+		g_free (result);
+		return NULL;
+	}
+	
+	return result;
+}
+
+gboolean pacman_checksum_unchanged (const gchar *kept, const gchar *filename) {
+	struct stat before, after;
+	gchar *old, *new;
+	gboolean result;
+	
+	g_return_val_if_fail (kept != NULL, FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+	
+	/* a file written in place cannot be compared with what was there before */
+	if (stat (kept, &before) < 0 || stat (filename, &after) < 0 || before.st_ino == after.st_ino || before.st_size != after.st_size) {
+		return FALSE;
+	}
+	
+	old = pacman_checksum_file (kept, NULL);
+	new = pacman_checksum_get (filename);
+	result = (old != NULL && new != NULL && g_ascii_strcasecmp (old, new) == 0);
+	
+	g_free (new);
+	g_free (old);
+	return result;
+}
+
+void pacman_checksum_discard (gchar *kept) {
+	if (kept != NULL) {
+		unlink (kept);
+		g_free (kept);
+	}
+}
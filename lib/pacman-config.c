@@ -25,13 +25,16 @@
 #include "pacman-list.h"
 #include "pacman-database.h"
 #include "pacman-manager.h"
+#include "pacman-private.h"
 
 typedef struct {
 	gboolean i_love_candy;
 	gboolean show_size;
 	gboolean total_download;
 	gboolean use_delta;
+	gboolean use_internal_downloader;
 	gboolean use_syslog;
+	guint parallel_downloads;
 	
 	gchar *architecture;
 	gchar *clean_method;
@@ -114,6 +117,12 @@ static void pacman_config_set_use_delta (PacmanConfig *config, gboolean value) {
 	config->use_delta = value;
 }
 
+static void pacman_config_set_use_internal_downloader (PacmanConfig *config, gboolean value) {
+	g_return_if_fail (config != NULL);
+	
+	config->use_internal_downloader = value;
+}
+
 static void pacman_config_set_use_syslog (PacmanConfig *config, gboolean value) {
 	g_return_if_fail (config != NULL);
 	
@@ -131,6 +140,7 @@ static const PacmanConfigBoolean pacman_config_boolean_options[] = {
 	{ "ShowSize", pacman_config_set_show_size },
 	{ "TotalDownload", pacman_config_set_total_download },
 	{ "UseDelta", pacman_config_set_use_delta },
+	{ "UseInternalDownloader", pacman_config_set_use_internal_downloader },
 	{ "UseSyslog", pacman_config_set_use_syslog },
 	{ NULL, NULL }
 };
@@ -180,6 +190,13 @@ static void pacman_config_set_log_file (PacmanConfig *config, const gchar *filen
 	config->log_file = g_strdup (filename);
 }
 
+static void pacman_config_set_parallel_downloads (PacmanConfig *config, const gchar *number) {
+	g_return_if_fail (config != NULL);
+	g_return_if_fail (number != NULL);
+	
+	config->parallel_downloads = (guint) g_ascii_strtoull (number, NULL, 10);
+}
+
 static void pacman_config_set_root_path (PacmanConfig *config, const gchar *path) {
 	g_return_if_fail (config != NULL);
 	g_return_if_fail (path != NULL);
@@ -208,6 +225,7 @@ static const PacmanConfigString pacman_config_string_options[] = {
 	{ "CleanMethod", pacman_config_set_clean_method },
 	{ "DBPath", pacman_config_set_database_path },
 	{ "LogFile", pacman_config_set_log_file },
+	{ "ParallelDownloads", pacman_config_set_parallel_downloads },
 	{ "RootDir", pacman_config_set_root_path },
 	{ "XferCommand", pacman_config_set_transfer_command },
 	{ NULL, NULL }
@@ -544,7 +562,7 @@ static gboolean pacman_config_configure_databases (PacmanConfig *config, PacmanM
 	
 	for (databases = config->databases; databases != NULL; databases = pacman_list_next (databases)) {
 		PacmanDatabase *database;
-		PacmanList *i;
+		PacmanList *servers, *i;
 		const gchar *name = (const gchar *) pacman_list_get (databases);
 		
 		database = pacman_manager_register_sync_database (manager, name, error);
@@ -552,12 +570,16 @@ static gboolean pacman_config_configure_databases (PacmanConfig *config, PacmanM
 			return FALSE;
 		}
 		
-		for (i = (PacmanList *) g_hash_table_lookup (config->servers, name); i != NULL; i = pacman_list_next (i)) {
+		/* fastest and most reliable mirrors first, going by earlier downloads */
+		servers = pacman_mirror_sort (pacman_list_copy ((PacmanList *) g_hash_table_lookup (config->servers, name)));
+		for (i = servers; i != NULL; i = pacman_list_next (i)) {
 			const gchar *url = (const gchar *) pacman_list_get (i);
 			g_return_val_if_fail (url != NULL, FALSE);
 			
 			pacman_database_add_server (database, url);
 		}
+		
+		pacman_list_free (servers);
 	}
 	
 	return TRUE;
@@ -575,6 +597,7 @@ static gboolean pacman_config_configure_manager (PacmanConfig *config, PacmanMan
 	pacman_manager_set_show_size (manager, config->show_size);
 	pacman_manager_set_total_download (manager, config->total_download);
 	pacman_manager_set_use_delta (manager, config->use_delta);
+	pacman_manager_set_use_internal_downloader (manager, config->use_internal_downloader);
 	pacman_manager_set_use_syslog (manager, config->use_syslog);
 	
 	if (config->architecture != NULL) {
@@ -584,6 +607,9 @@ static gboolean pacman_config_configure_manager (PacmanConfig *config, PacmanMan
 		pacman_manager_set_clean_method (manager, config->clean_method);
 	}
 	pacman_manager_set_transfer_command (manager, config->transfer_command);
+	if (config->parallel_downloads > 0) {
+		pacman_manager_set_parallel_downloads (manager, config->parallel_downloads);
+	}
 	
 	if (config->hold_packages != NULL) {
 		pacman_manager_set_hold_packages (manager, config->hold_packages);
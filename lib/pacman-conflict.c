@@ -17,9 +17,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <glib/gi18n-lib.h>
 #include <alpm.h>
 #include "pacman-list.h"
+#include "pacman-package.h"
+#include "pacman-dependency.h"
+#include "pacman-private.h"
 #include "pacman-conflict.h"
 
 /**
@@ -36,6 +40,34 @@
  * Represents a dependency conflict between two packages.
  */
 
+/* pretty fucked up kludge, keep this in sync with libalpm/conflict.h */
+struct __pmconflict_t {
+	gchar *first;
+	gchar *second;
+	gchar *reason;
+};
+
+PacmanConflict *pacman_conflict_new (const gchar *first, const gchar *second, const gchar *reason) {
+	PacmanConflict *result;
+	
+	g_return_val_if_fail (first != NULL, NULL);
+	g_return_val_if_fail (second != NULL, NULL);
+	g_return_val_if_fail (reason != NULL, NULL);
+	
+	result = malloc (sizeof (PacmanConflict));
+	g_return_val_if_fail (result != NULL, NULL);
+	
+	result->first = strdup (first);
+	result->second = strdup (second);
+	result->reason = strdup (reason);
+	
+	g_warn_if_fail (first != pacman_conflict_get_first_package (result));
+	g_warn_if_fail (second != pacman_conflict_get_second_package (result));
+	g_warn_if_fail (reason != pacman_conflict_get_reason (result));
+	
+	return result;
+}
+
 /**
  * pacman_conflict_free:
  * @conflict: A #PacmanConflict.
@@ -92,6 +124,174 @@ const gchar *pacman_conflict_get_reason (PacmanConflict *conflict) {
 	return alpm_conflict_get_reason (conflict);
 }
 
+/* one entry per package name or provision, indexed by the name it satisfies */
+typedef struct {
+	guint position;
+	PacmanPackage *package;
+	const gchar *version;
+} PacmanConflictCandidate;
+
+typedef struct {
+	GHashTable *candidates;
+	GHashTable *pairs;
+	PacmanList *result;
+} PacmanConflictIndex;
+
+static void pacman_conflict_index_init (PacmanConflictIndex *index) {
+	g_return_if_fail (index != NULL);
+	
+	index->candidates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	index->pairs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	index->result = NULL;
+}
+
+static PacmanList *pacman_conflict_index_clear (PacmanConflictIndex *index) {
+	PacmanList *result;
+	
+	g_return_val_if_fail (index != NULL, NULL);
+	
+	g_hash_table_unref (index->candidates);
+	g_hash_table_unref (index->pairs);
+	
+	result = index->result;
+	index->result = NULL;
+	return result;
+}
+
+static void pacman_conflict_index_insert (PacmanConflictIndex *index, gchar *name, PacmanConflictCandidate *candidate) {
+	GPtrArray *candidates;
+	
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (name != NULL);
+	g_return_if_fail (candidate != NULL);
+	
+	candidates = (GPtrArray *) g_hash_table_lookup (index->candidates, name);
+	if (candidates == NULL) {
+		candidates = g_ptr_array_new_with_free_func (g_free);
+		g_hash_table_insert (index->candidates, name, candidates);
+	} else {
+		g_free (name);
+	}
+	
+	g_ptr_array_add (candidates, candidate);
+}
+
+static void pacman_conflict_index_add_packages (PacmanConflictIndex *index, const PacmanList *packages) {
+	const PacmanList *i, *j;
+	guint position = 0;
+	
+	g_return_if_fail (index != NULL);
+	
+	for (i = packages; i != NULL; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		PacmanConflictCandidate *candidate;
+		const gchar *name = pacman_package_get_name (package);
+		
+		candidate = g_new (PacmanConflictCandidate, 1);
+		candidate->position = position;
+		candidate->package = package;
+		candidate->version = pacman_package_get_version (package);
+		pacman_conflict_index_insert (index, g_strdup (name), candidate);
+		
+		for (j = pacman_package_get_provides (package); j != NULL; j = pacman_list_next (j)) {
+			const gchar *provision = (const gchar *) pacman_list_get (j);
+			const gchar *version = strchr (provision, '=');
+			
+			candidate = g_new (PacmanConflictCandidate, 1);
+			candidate->position = position;
+			candidate->package = package;
+			
+			if (version == NULL) {
+				candidate->version = NULL;
+				pacman_conflict_index_insert (index, g_strdup (provision), candidate);
+			} else {
+				candidate->version = version + 1;
+				pacman_conflict_index_insert (index, g_strndup (provision, version - provision), candidate);
+			}
+		}
+		
+		++position;
+	}
+}
+
+static gint pacman_conflict_candidate_compare (gconstpointer a, gconstpointer b) {
+	const PacmanConflictCandidate *first = *(const PacmanConflictCandidate **) a;
+	const PacmanConflictCandidate *second = *(const PacmanConflictCandidate **) b;
+	
+	return (first->position > second->position) - (first->position < second->position);
+}
+
+static void pacman_conflict_index_add_conflict (PacmanConflictIndex *index, const gchar *first, const gchar *second, const gchar *reason) {
+	gchar *pair;
+	
+	g_return_if_fail (index != NULL);
+	
+	/* libalpm only reports a pair of packages once, regardless of order */
+	if (strcmp (first, second) < 0) {
+		pair = g_strconcat (first, "\n", second, NULL);
+	} else {
+		pair = g_strconcat (second, "\n", first, NULL);
+	}
+	
+	if (g_hash_table_lookup_extended (index->pairs, pair, NULL, NULL)) {
+		g_free (pair);
+	} else {
+		g_hash_table_insert (index->pairs, pair, NULL);
+		index->result = pacman_list_add (index->result, pacman_conflict_new (first, second, reason));
+	}
+}
+
+static void pacman_conflict_index_check (PacmanConflictIndex *index, const PacmanList *packages) {
+	const PacmanList *i, *j;
+	GPtrArray *matches = g_ptr_array_new ();
+	
+	g_return_if_fail (index != NULL);
+	
+	for (i = packages; i != NULL; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		const gchar *name = pacman_package_get_name (package);
+		
+		for (j = pacman_package_get_conflicts (package); j != NULL; j = pacman_list_next (j)) {
+			const gchar *conflict = (const gchar *) pacman_list_get (j);
+			PacmanDependencyPredicate predicate;
+			GPtrArray *candidates;
+			guint k;
+			
+			pacman_dependency_compile_string (conflict, &predicate);
+			candidates = (GPtrArray *) g_hash_table_lookup (index->candidates, predicate.name);
+			
+			if (candidates == NULL) {
+				continue;
+			}
+			
+			g_ptr_array_set_size (matches, 0);
+			for (k = 0; k < candidates->len; ++k) {
+				PacmanConflictCandidate *candidate = (PacmanConflictCandidate *) g_ptr_array_index (candidates, k);
+				if (candidate->package != package && pacman_dependency_predicate_compare (&predicate, candidate->version)) {
+					g_ptr_array_add (matches, candidate);
+				}
+			}
+			
+			/* report in list order, once per package, as a pairwise scan would */
+			g_ptr_array_sort (matches, pacman_conflict_candidate_compare);
+			for (k = 0; k < matches->len; ++k) {
+				PacmanConflictCandidate *candidate = (PacmanConflictCandidate *) g_ptr_array_index (matches, k);
+				const gchar *other = pacman_package_get_name (candidate->package);
+				
+				if (k > 0 && ((PacmanConflictCandidate *) g_ptr_array_index (matches, k - 1))->package == candidate->package) {
+					continue;
+				} else if (strcmp (name, other) == 0) {
+					continue;
+				}
+				
+				pacman_conflict_index_add_conflict (index, name, other, conflict);
+			}
+		}
+	}
+	
+	g_ptr_array_free (matches, TRUE);
+}
+
 /**
  * pacman_conflict_check_packages:
  * @packages: A list of #PacmanPackage.
@@ -101,9 +301,15 @@ const gchar *pacman_conflict_get_reason (PacmanConflict *conflict) {
  * Returns: A list of #PacmanConflict. Free the contents with pacman_conflict_free(), then free the list with pacman_list_free().
  */
 PacmanList *pacman_conflict_check_packages (const PacmanList *packages) {
+	PacmanConflictIndex index;
+	
 	g_return_val_if_fail (packages != NULL, NULL);
 	
-	return alpm_checkconflicts ((PacmanList *) packages);
+	pacman_conflict_index_init (&index);
+	pacman_conflict_index_add_packages (&index, packages);
+	pacman_conflict_index_check (&index, packages);
+	
+	return pacman_conflict_index_clear (&index);
 }
 
 /**
@@ -16,9 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <alpm.h>
 #include "pacman-list.h"
 #include "pacman-database.h"
+#include "pacman-private.h"
 
 /**
  * SECTION:pacman-database
@@ -34,6 +36,12 @@
  * Represents a package database.
  */
 
+/**
+ * PacmanDatabaseSnapshot:
+ *
+ * Keeps the packages of a #PacmanDatabase from being replaced while they are being read.
+ */
+
 /**
  * pacman_database_get_name:
  * @database: A #PacmanDatabase.
@@ -62,6 +70,32 @@ const gchar *pacman_database_get_server (PacmanDatabase *database) {
 	return alpm_db_get_url (database);
 }
 
+/* alpm keeps its list of mirrors to itself, so a copy is kept here */
+G_LOCK_DEFINE_STATIC (pacman_database_servers);
+static GHashTable *pacman_database_servers = NULL;
+
+/**
+ * pacman_database_get_servers:
+ * @database: A sync #PacmanDatabase.
+ *
+ * Gets the list of mirrors that will be used to download files from @database, in the order they will be tried.
+ *
+ * Returns: A list of server URLs. Do not free.
+ */
+const PacmanList *pacman_database_get_servers (PacmanDatabase *database) {
+	const PacmanList *result = NULL;
+	
+	g_return_val_if_fail (database != NULL, NULL);
+	
+	G_LOCK (pacman_database_servers);
+	if (pacman_database_servers != NULL) {
+		result = (const PacmanList *) g_hash_table_lookup (pacman_database_servers, database);
+	}
+	G_UNLOCK (pacman_database_servers);
+	
+	return result;
+}
+
 /**
  * pacman_database_add_server:
  * @database: A sync #PacmanDatabase.
@@ -70,25 +104,369 @@ const gchar *pacman_database_get_server (PacmanDatabase *database) {
  * Adds @url to the list of mirrors that will be used to download files from @database.
  */
 void pacman_database_add_server (PacmanDatabase *database, const gchar *url) {
+	PacmanList *servers;
+	gchar *server;
+	
 	g_return_if_fail (database != NULL);
 	g_return_if_fail (database != alpm_option_get_localdb ());
 	g_return_if_fail (url != NULL);
 	
 	alpm_db_setserver (database, url);
+	
+	/* alpm drops the trailing slash as well */
+	server = g_strdup (url);
+	if (g_str_has_suffix (server, "/")) {
+		server[strlen (server) - 1] = '\0';
+	}
+	
+	G_LOCK (pacman_database_servers);
+	if (pacman_database_servers == NULL) {
+		pacman_database_servers = g_hash_table_new (g_direct_hash, g_direct_equal);
+	}
+	
+	servers = (PacmanList *) g_hash_table_lookup (pacman_database_servers, database);
+	g_hash_table_insert (pacman_database_servers, database, pacman_list_add (servers, server));
+	G_UNLOCK (pacman_database_servers);
+}
+
+static gboolean pacman_database_servers_free (gpointer database, gpointer servers, gpointer user_data) {
+	if (user_data == NULL || user_data == database) {
+		pacman_list_free_full ((PacmanList *) servers, g_free);
+		return TRUE;
+	}
+	
+	return FALSE;
+}
+
+void pacman_database_forget_servers (PacmanDatabase *database) {
+	G_LOCK (pacman_database_servers);
+	if (pacman_database_servers != NULL) {
+		g_hash_table_foreach_remove (pacman_database_servers, pacman_database_servers_free, database);
+	}
+	G_UNLOCK (pacman_database_servers);
+}
+
+typedef struct _PacmanDatabaseState PacmanDatabaseState;
+
+struct _PacmanDatabaseState {
+	PacmanDatabase *database;
+	volatile gint generation;
+	volatile gint readers;
+	
+	/* an update is waiting for readers to finish, so no new snapshots are taken */
+	volatile gint pending;
+	
+	/* the package cache is being replaced, so nobody else may read it */
+	volatile gint updating;
+	
+	PacmanDatabaseState *next;
+};
+
+struct _PacmanDatabaseSnapshot {
+	volatile gint ref_count;
+	PacmanDatabase *database;
+	guint generation;
+};
+
+/* alpm frees the old package cache as soon as a new database is unpacked, so that step waits for readers */
+static GMutex pacman_database_mutex;
+static GCond pacman_database_changed;
+static volatile gpointer pacman_database_states = NULL;
+
+/* only one update can run at a time, on the thread that committed it */
+static PacmanDatabaseState *pacman_database_expected = NULL;
+static volatile gpointer pacman_database_updater = NULL;
+
+static PacmanDatabaseState *pacman_database_get_state (PacmanDatabase *database) {
+	PacmanDatabaseState *result;
+	
+	g_return_val_if_fail (database != NULL, NULL);
+	
+	/* nodes are only ever prepended, and are kept until the library is unloaded */
+	for (result = (PacmanDatabaseState *) g_atomic_pointer_get (&pacman_database_states); result != NULL; result = result->next) {
+		if (result->database == database) {
+			return result;
+		}
+	}
+	
+	g_mutex_lock (&pacman_database_mutex);
+	for (result = (PacmanDatabaseState *) pacman_database_states; result != NULL; result = result->next) {
+		if (result->database == database) {
+			break;
+		}
+	}
+	
+	if (result == NULL) {
+		result = g_new0 (PacmanDatabaseState, 1);
+		result->database = database;
+		result->next = (PacmanDatabaseState *) pacman_database_states;
+		g_atomic_pointer_set (&pacman_database_states, result);
+	}
+	g_mutex_unlock (&pacman_database_mutex);
+	
+	return result;
+}
+
+static void pacman_database_release (PacmanDatabaseState *state) {
+	g_return_if_fail (state != NULL);
+	
+	/* only an update waiting for the last reader needs to be woken */
+	if (g_atomic_int_dec_and_test (&state->readers) && g_atomic_int_get (&state->pending)) {
+		g_mutex_lock (&pacman_database_mutex);
+		g_cond_broadcast (&pacman_database_changed);
+		g_mutex_unlock (&pacman_database_mutex);
+	}
+}
+
+static void pacman_database_acquire (PacmanDatabaseState *state, gboolean snapshot) {
+	g_return_if_fail (state != NULL);
+	
+	while (TRUE) {
+		g_atomic_int_inc (&state->readers);
+		
+		/* a pending update is not waited for by plain readers, since this thread may hold a snapshot the update is waiting for */
+		if (!g_atomic_int_get (&state->updating) && !(snapshot && g_atomic_int_get (&state->pending))) {
+			return;
+		} else if (g_atomic_pointer_get (&pacman_database_updater) == g_thread_self ()) {
+			return;
+		}
+		
+		pacman_database_release (state);
+		
+		g_mutex_lock (&pacman_database_mutex);
+		while (g_atomic_int_get (&state->updating) || (snapshot && g_atomic_int_get (&state->pending))) {
+			g_cond_wait (&pacman_database_changed, &pacman_database_mutex);
+		}
+		g_mutex_unlock (&pacman_database_mutex);
+	}
+}
+
+void pacman_database_forget_generations (PacmanDatabase *database) {
+	PacmanDatabaseState *i;
+	
+	/* the same address may be used by a database registered later */
+	for (i = (PacmanDatabaseState *) g_atomic_pointer_get (&pacman_database_states); i != NULL; i = i->next) {
+		if (database == NULL || i->database == database) {
+			g_atomic_int_set (&i->generation, 0);
+		}
+	}
+}
+
+/**
+ * pacman_database_get_generation:
+ * @database: A #PacmanDatabase.
+ *
+ * Gets the number of times the packages in @database have been replaced by pacman_manager_update(). Databases that were already up to date do not count.
+ *
+ * Returns: A generation number.
+ */
+guint pacman_database_get_generation (PacmanDatabase *database) {
+	g_return_val_if_fail (database != NULL, 0);
+	
+	return (guint) g_atomic_int_get (&pacman_database_get_state (database)->generation);
+}
+
+/**
+ * pacman_database_snapshot_new:
+ * @database: A #PacmanDatabase.
+ *
+ * Takes a snapshot of the packages in @database. While any snapshot of @database is held, an update of @database can download the new database but waits before unpacking it, so everything read from the snapshot stays valid. Once an update is waiting, new snapshots wait for it to finish and then see the new packages, so readers cannot hold an update off forever.
+ *
+ * Hold a snapshot for as long as it takes to serve a request, and no longer. A thread that already holds a snapshot of @database must use pacman_database_snapshot_ref() rather than take another, and the thread committing a #PacmanUpdate must not hold one at all.
+ *
+ * Returns: A #PacmanDatabaseSnapshot. Free with pacman_database_snapshot_unref().
+ */
+PacmanDatabaseSnapshot *pacman_database_snapshot_new (PacmanDatabase *database) {
+	PacmanDatabaseSnapshot *result;
+	PacmanDatabaseState *state;
+	
+	g_return_val_if_fail (database != NULL, NULL);
+	
+	result = g_slice_new (PacmanDatabaseSnapshot);
+	result->ref_count = 1;
+	result->database = database;
+	
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, TRUE);
+	result->generation = (guint) g_atomic_int_get (&state->generation);
+	
+	return result;
+}
+
+/**
+ * pacman_database_snapshot_ref:
+ * @snapshot: A #PacmanDatabaseSnapshot.
+ *
+ * Adds a reference to @snapshot, which can be passed to another thread.
+ *
+ * Returns: @snapshot. Free with pacman_database_snapshot_unref().
+ */
+PacmanDatabaseSnapshot *pacman_database_snapshot_ref (PacmanDatabaseSnapshot *snapshot) {
+	g_return_val_if_fail (snapshot != NULL, NULL);
+	
+	g_atomic_int_inc (&snapshot->ref_count);
+	return snapshot;
+}
+
+/**
+ * pacman_database_snapshot_unref:
+ * @snapshot: A #PacmanDatabaseSnapshot.
+ *
+ * Removes a reference from @snapshot. When the last one is gone, the database can be updated again.
+ */
+void pacman_database_snapshot_unref (PacmanDatabaseSnapshot *snapshot) {
+	g_return_if_fail (snapshot != NULL);
+	
+	if (!g_atomic_int_dec_and_test (&snapshot->ref_count)) {
+		return;
+	}
+	
+	pacman_database_release (pacman_database_get_state (snapshot->database));
+	g_slice_free (PacmanDatabaseSnapshot, snapshot);
+}
+
+/**
+ * pacman_database_snapshot_get_database:
+ * @snapshot: A #PacmanDatabaseSnapshot.
+ *
+ * Gets the database that @snapshot was taken of. It can be searched as usual while @snapshot is held.
+ *
+ * Returns: A #PacmanDatabase.
+ */
+PacmanDatabase *pacman_database_snapshot_get_database (PacmanDatabaseSnapshot *snapshot) {
+	g_return_val_if_fail (snapshot != NULL, NULL);
+	
+	return snapshot->database;
+}
+
+/**
+ * pacman_database_snapshot_get_generation:
+ * @snapshot: A #PacmanDatabaseSnapshot.
+ *
+ * Gets the generation of the packages in @snapshot. See pacman_database_get_generation().
+ *
+ * Returns: A generation number.
+ */
+guint pacman_database_snapshot_get_generation (PacmanDatabaseSnapshot *snapshot) {
+	g_return_val_if_fail (snapshot != NULL, 0);
+	
+	return snapshot->generation;
+}
+
+/**
+ * pacman_database_snapshot_get_packages:
+ * @snapshot: A #PacmanDatabaseSnapshot.
+ *
+ * Gets a list of packages contained in the database that @snapshot was taken of.
+ *
+ * Returns: A list of #PacmanPackage, valid until @snapshot is freed. Do not free.
+ */
+const PacmanList *pacman_database_snapshot_get_packages (PacmanDatabaseSnapshot *snapshot) {
+	g_return_val_if_fail (snapshot != NULL, NULL);
+	
+	return pacman_database_get_packages (snapshot->database);
+}
+
+static void pacman_database_load (PacmanDatabase *database) {
+	gint64 start;
+	
+	g_return_if_fail (database != NULL);
+	
+	/* alpm loads the package cache the first time it is needed, so time that */
+	if (!pacman_statistics_database_loaded (database)) {
+		start = g_get_monotonic_time ();
+		alpm_db_get_pkgcache (database);
+		pacman_statistics_record_database_load (database, g_get_monotonic_time () - start);
+	}
+}
+
+void pacman_database_expect_update (PacmanDatabase *database) {
+	g_return_if_fail (pacman_database_updater == NULL);
+	
+	pacman_database_expected = (database != NULL) ? pacman_database_get_state (database) : NULL;
+}
+
+gboolean pacman_database_is_updating (void) {
+	return g_atomic_pointer_get (&pacman_database_updater) == g_thread_self ();
+}
+
+void pacman_database_begin_update (void) {
+	PacmanDatabaseState *state = pacman_database_expected;
+	
+	/* called once the new database has been downloaded, and before alpm frees the old packages */
+	if (state == NULL || pacman_database_updater != NULL) {
+		return;
+	}
+	
+	g_atomic_pointer_set (&pacman_database_updater, g_thread_self ());
+	
+	/* stop new snapshots first, then wait for the ones that are held */
+	g_atomic_int_set (&state->pending, TRUE);
+	while (TRUE) {
+		g_mutex_lock (&pacman_database_mutex);
+		while (g_atomic_int_get (&state->readers) > 0) {
+			g_cond_wait (&pacman_database_changed, &pacman_database_mutex);
+		}
+		g_mutex_unlock (&pacman_database_mutex);
+		
+		/* a plain reader may have slipped in after the count was checked, in which case it finishes first */
+		g_atomic_int_set (&state->updating, TRUE);
+		if (g_atomic_int_get (&state->readers) == 0) {
+			break;
+		}
+		
+		g_mutex_lock (&pacman_database_mutex);
+		g_atomic_int_set (&state->updating, FALSE);
+		g_cond_broadcast (&pacman_database_changed);
+		g_mutex_unlock (&pacman_database_mutex);
+	}
+}
+
+void pacman_database_end_update (gboolean changed) {
+	PacmanDatabaseState *state = pacman_database_expected;
+	
+	pacman_database_expected = NULL;
+	if (state == NULL || pacman_database_updater == NULL) {
+		return;
+	}
+	
+	/* build the new package cache before anyone else can see it */
+	if (changed) {
+		pacman_database_load (state->database);
+		alpm_db_get_grpcache (state->database);
+		g_atomic_int_inc (&state->generation);
+	}
+	
+	g_atomic_pointer_set (&pacman_database_updater, NULL);
+	
+	g_mutex_lock (&pacman_database_mutex);
+	g_atomic_int_set (&state->updating, FALSE);
+	g_atomic_int_set (&state->pending, FALSE);
+	g_cond_broadcast (&pacman_database_changed);
+	g_mutex_unlock (&pacman_database_mutex);
 }
 
 /**
  * pacman_database_get_packages:
  * @database: A #PacmanDatabase.
  *
- * Gets a list of packages contained in @database.
+ * Gets a list of packages contained in @database. If @database may be updated by another thread, hold a #PacmanDatabaseSnapshot while using the result, since it is freed by the update.
  *
  * Returns: A list of #PacmanPackage. Do not free.
  */
 const PacmanList *pacman_database_get_packages (PacmanDatabase *database) {
+	const PacmanList *result;
+	PacmanDatabaseState *state;
+	
 	g_return_val_if_fail (database != NULL, NULL);
 	
-	return alpm_db_get_pkgcache (database);
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, FALSE);
+	pacman_database_load (database);
+	result = alpm_db_get_pkgcache (database);
+	pacman_database_release (state);
+	
+	return result;
 }
 
 /**
@@ -100,9 +478,18 @@ const PacmanList *pacman_database_get_packages (PacmanDatabase *database) {
  * Returns: A list of #PacmanGroup. Do not free.
  */
 const PacmanList *pacman_database_get_groups (PacmanDatabase *database) {
+	const PacmanList *result;
+	PacmanDatabaseState *state;
+	
 	g_return_val_if_fail (database != NULL, NULL);
 	
-	return alpm_db_get_grpcache (database);
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, FALSE);
+	pacman_database_load (database);
+	result = alpm_db_get_grpcache (database);
+	pacman_database_release (state);
+	
+	return result;
 }
 
 /**
@@ -115,10 +502,20 @@ const PacmanList *pacman_database_get_groups (PacmanDatabase *database) {
  * Returns: A #PacmanPackage, or %NULL if none were found. Do not free.
  */
 PacmanPackage *pacman_database_find_package (PacmanDatabase *database, const gchar *name) {
+	PacmanPackage *result;
+	PacmanDatabaseState *state;
+	
 	g_return_val_if_fail (database != NULL, NULL);
 	g_return_val_if_fail (name != NULL, NULL);
 	
-	return alpm_db_get_pkg (database, name);
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, FALSE);
+	pacman_database_load (database);
+	pacman_statistics_count (PACMAN_STATISTIC_LOOKUPS);
+	result = alpm_db_get_pkg (database, name);
+	pacman_database_release (state);
+	
+	return result;
 }
 
 /**
@@ -131,10 +528,45 @@ PacmanPackage *pacman_database_find_package (PacmanDatabase *database, const gch
  * Returns: A #PacmanGroup, or %NULL if none were found. Do not free.
  */
 PacmanGroup *pacman_database_find_group (PacmanDatabase *database, const gchar *name) {
+	PacmanGroup *result;
+	PacmanDatabaseState *state;
+	
 	g_return_val_if_fail (database != NULL, NULL);
 	g_return_val_if_fail (name != NULL, NULL);
 	
-	return alpm_db_readgrp (database, name);
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, FALSE);
+	pacman_database_load (database);
+	pacman_statistics_count (PACMAN_STATISTIC_LOOKUPS);
+	result = alpm_db_readgrp (database, name);
+	pacman_database_release (state);
+	
+	return result;
+}
+
+/**
+ * pacman_database_find_satisfier:
+ * @database: A #PacmanDatabase.
+ * @dependency: A string representing a dependency. See pacman_dependency_to_string().
+ *
+ * Finds the first package in @database that satisfies @dependency, either directly or through one of its provisions. The result is cached until the database changes.
+ *
+ * Returns: A #PacmanPackage, or %NULL if none were found. Do not free.
+ */
+PacmanPackage *pacman_database_find_satisfier (PacmanDatabase *database, const gchar *dependency) {
+	PacmanPackage *result;
+	PacmanDatabaseState *state;
+	
+	g_return_val_if_fail (database != NULL, NULL);
+	g_return_val_if_fail (dependency != NULL, NULL);
+	
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, FALSE);
+	pacman_statistics_count (PACMAN_STATISTIC_LOOKUPS);
+	result = pacman_dependency_find_satisfier (database, dependency);
+	pacman_database_release (state);
+	
+	return result;
 }
 
 /**
@@ -147,12 +579,24 @@ PacmanGroup *pacman_database_find_group (PacmanDatabase *database, const gchar *
  * Returns: A list of #PacmanPackage. Free with pacman_list_free().
  */
 PacmanList *pacman_database_search (PacmanDatabase *database, const PacmanList *needles) {
+	PacmanList *result;
+	PacmanDatabaseState *state;
+	
 	g_return_val_if_fail (database != NULL, NULL);
 	
+	state = pacman_database_get_state (database);
+	pacman_database_acquire (state, FALSE);
+	pacman_database_load (database);
+	pacman_statistics_count (PACMAN_STATISTIC_SEARCHES);
+	PACMAN_PROBE2 (database__search, pacman_database_get_name (database), pacman_list_length (needles));
+	
 	/* TODO: can probably do this faster ourselves */
 	if (needles != NULL) {
-		return alpm_db_search (database, needles);
+		result = alpm_db_search (database, needles);
 	} else {
-		return pacman_list_copy (pacman_database_get_packages (database));
+		result = pacman_list_copy (alpm_db_get_pkgcache (database));
 	}
+	
+	pacman_database_release (state);
+	return result;
 }
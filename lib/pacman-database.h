@@ -30,6 +30,7 @@ G_BEGIN_DECLS
 
 const gchar *pacman_database_get_name (PacmanDatabase *database);
 const gchar *pacman_database_get_server (PacmanDatabase *database);
+const PacmanList *pacman_database_get_servers (PacmanDatabase *database);
 void pacman_database_add_server (PacmanDatabase *database, const gchar *url);
 
 const PacmanList *pacman_database_get_packages (PacmanDatabase *database);
@@ -37,8 +38,18 @@ const PacmanList *pacman_database_get_groups (PacmanDatabase *database);
 
 PacmanPackage *pacman_database_find_package (PacmanDatabase *database, const gchar *name);
 PacmanGroup *pacman_database_find_group (PacmanDatabase *database, const gchar *name);
+PacmanPackage *pacman_database_find_satisfier (PacmanDatabase *database, const gchar *dependency);
 PacmanList *pacman_database_search (PacmanDatabase *database, const PacmanList *needles);
 
+guint pacman_database_get_generation (PacmanDatabase *database);
+PacmanDatabaseSnapshot *pacman_database_snapshot_new (PacmanDatabase *database);
+PacmanDatabaseSnapshot *pacman_database_snapshot_ref (PacmanDatabaseSnapshot *snapshot);
+void pacman_database_snapshot_unref (PacmanDatabaseSnapshot *snapshot);
+
+PacmanDatabase *pacman_database_snapshot_get_database (PacmanDatabaseSnapshot *snapshot);
+guint pacman_database_snapshot_get_generation (PacmanDatabaseSnapshot *snapshot);
+const PacmanList *pacman_database_snapshot_get_packages (PacmanDatabaseSnapshot *snapshot);
+
 G_END_DECLS
 
 #endif
@@ -17,7 +17,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <alpm.h>
+#include "pacman-list.h"
+#include "pacman-package.h"
+#include "pacman-database.h"
+#include "pacman-private.h"
 #include "pacman-dependency.h"
 
 /**
@@ -84,6 +89,301 @@ PacmanDependencyCompare pacman_dependency_get_compare_operation (PacmanDependenc
 	return (PacmanDependencyCompare) alpm_dep_get_mod (dependency);
 }
 
+/* results are cached until a transaction commits or a database is updated, which bumps the generation */
+#define PACMAN_DEPENDENCY_CACHE_SIZE 2048
+
+/* room for nearly every dependency string; longer ones are not cached */
+#define PACMAN_DEPENDENCY_TEXT_SIZE 96
+
+/* each slot is guarded by a sequence number that is odd while it is written, so readers never take a lock */
+typedef struct {
+	volatile gint sequence;
+	guint generation;
+	gconstpointer database;
+	gpointer value;
+	gchar text[PACMAN_DEPENDENCY_TEXT_SIZE];
+} PacmanDependencySlot;
+
+typedef struct {
+	const gchar *dependency;
+	gconstpointer database;
+} PacmanDependencyKey;
+
+static PacmanDependencySlot pacman_dependency_cache[PACMAN_DEPENDENCY_CACHE_SIZE];
+static volatile gint pacman_dependency_generation = 0;
+
+/* stored for dependencies that nothing satisfies */
+static gchar pacman_dependency_unsatisfied;
+
+static PacmanDependencySlot *pacman_dependency_cache_slot (const PacmanDependencyKey *key) {
+	guint hash;
+	
+	g_return_val_if_fail (key != NULL, NULL);
+	
+	hash = g_str_hash (key->dependency) ^ (g_direct_hash (key->database) * 31);
+	return &pacman_dependency_cache[hash & (PACMAN_DEPENDENCY_CACHE_SIZE - 1)];
+}
+
+static gboolean pacman_dependency_cache_matches (const PacmanDependencySlot *slot, const PacmanDependencyKey *key, guint generation) {
+	g_return_val_if_fail (slot != NULL, FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	
+	if (slot->generation != generation || slot->database != key->database) {
+		return FALSE;
+	}
+	
+	/* the last byte of the slot is never written, so a torn read stays terminated */
+	return strcmp (slot->text, key->dependency) == 0;
+}
+
+static gpointer pacman_dependency_cache_lookup (const PacmanDependencyKey *key, guint *generation) {
+	PacmanDependencySlot *slot;
+	gpointer result = NULL;
+	gint sequence;
+	
+	g_return_val_if_fail (key != NULL, NULL);
+	g_return_val_if_fail (generation != NULL, NULL);
+	
+	*generation = (guint) g_atomic_int_get (&pacman_dependency_generation);
+	slot = pacman_dependency_cache_slot (key);
+	
+	sequence = g_atomic_int_get (&slot->sequence);
+	if ((sequence & 1) != 0) {
+		return NULL;
+	}
+	
+	if (pacman_dependency_cache_matches (slot, key, *generation)) {
+		result = slot->value;
+	}
+	
+	/* a writer got in while the slot was being read */
+	if (g_atomic_int_get (&slot->sequence) != sequence) {
+		return NULL;
+	}
+	
+	return result;
+}
+
+static void pacman_dependency_cache_insert (const PacmanDependencyKey *key, guint generation, gpointer value) {
+	PacmanDependencySlot *slot;
+	gsize length;
+	gint sequence;
+	
+	g_return_if_fail (key != NULL);
+	
+	length = strlen (key->dependency);
+	if (length + 1 >= PACMAN_DEPENDENCY_TEXT_SIZE) {
+		return;
+	}
+	
+	/* the databases may have changed while the result was being computed */
+	if ((guint) g_atomic_int_get (&pacman_dependency_generation) != generation) {
+		return;
+	}
+	
+	/* if another thread is writing the same slot, let it win rather than wait */
+	slot = pacman_dependency_cache_slot (key);
+	sequence = g_atomic_int_get (&slot->sequence);
+	if ((sequence & 1) != 0 || !g_atomic_int_compare_and_exchange (&slot->sequence, sequence, sequence + 1)) {
+		return;
+	}
+	
+	slot->generation = generation;
+	slot->database = key->database;
+	slot->value = value;
+	memcpy (slot->text, key->dependency, length + 1);
+	
+	g_atomic_int_set (&slot->sequence, sequence + 2);
+}
+
+void pacman_dependency_invalidate (void) {
+	/* old entries stay in place, but no longer match */
+	g_atomic_int_inc (&pacman_dependency_generation);
+}
+
+static gchar *pacman_dependency_split (const gchar *dependency, PacmanDependencyCompare *compare, const gchar **version) {
+	const gchar *operation;
+	
+	g_return_val_if_fail (dependency != NULL, NULL);
+	g_return_val_if_fail (compare != NULL, NULL);
+	g_return_val_if_fail (version != NULL, NULL);
+	
+	/* same order as libalpm, so that e.g. 'a>=1' is not split at '=' */
+	if ((operation = strstr (dependency, ">=")) != NULL) {
+		*compare = PACMAN_DEPENDENCY_COMPARE_NEWER_OR_EQUAL;
+		*version = operation + 2;
+	} else if ((operation = strstr (dependency, "<=")) != NULL) {
+		*compare = PACMAN_DEPENDENCY_COMPARE_OLDER_OR_EQUAL;
+		*version = operation + 2;
+	} else if ((operation = strchr (dependency, '=')) != NULL) {
+		*compare = PACMAN_DEPENDENCY_COMPARE_EQUAL;
+		*version = operation + 1;
+	} else if ((operation = strchr (dependency, '<')) != NULL) {
+		*compare = PACMAN_DEPENDENCY_COMPARE_OLDER;
+		*version = operation + 1;
+	} else if ((operation = strchr (dependency, '>')) != NULL) {
+		*compare = PACMAN_DEPENDENCY_COMPARE_NEWER;
+		*version = operation + 1;
+	} else {
+		*compare = PACMAN_DEPENDENCY_COMPARE_ANY;
+		*version = NULL;
+		return g_strdup (dependency);
+	}
+	
+	return g_strndup (dependency, operation - dependency);
+}
+
+static gboolean pacman_dependency_compare_version (const gchar *version, PacmanDependencyCompare compare, const gchar *required) {
+	gint result;
+	
+	if (compare == PACMAN_DEPENDENCY_COMPARE_ANY) {
+		return TRUE;
+	} else if (version == NULL) {
+		/* unversioned provisions only satisfy unversioned dependencies */
+		return FALSE;
+	}
+	
+	result = pacman_package_compare_version (version, required);
+	switch (compare) {
+		case PACMAN_DEPENDENCY_COMPARE_EQUAL:
+			return result == 0;
+		case PACMAN_DEPENDENCY_COMPARE_NEWER_OR_EQUAL:
+			return result >= 0;
+		case PACMAN_DEPENDENCY_COMPARE_OLDER_OR_EQUAL:
+			return result <= 0;
+		case PACMAN_DEPENDENCY_COMPARE_NEWER:
+			return result > 0;
+		case PACMAN_DEPENDENCY_COMPARE_OLDER:
+			return result < 0;
+		default:
+			return TRUE;
+	}
+}
+
+gboolean pacman_dependency_predicate_compare (const PacmanDependencyPredicate *predicate, const gchar *version) {
+	g_return_val_if_fail (predicate != NULL, FALSE);
+	
+	if (predicate->compare == PACMAN_DEPENDENCY_COMPARE_ANY) {
+		return TRUE;
+	} else if (version == NULL) {
+		return FALSE;
+	} else if (strcmp (version, predicate->version) == 0) {
+		/* identical versions are common enough to skip alpm_pkg_vercmp() for */
+		switch (predicate->compare) {
+			case PACMAN_DEPENDENCY_COMPARE_NEWER:
+			case PACMAN_DEPENDENCY_COMPARE_OLDER:
+				return FALSE;
+			default:
+				return TRUE;
+		}
+	}
+	
+	return pacman_dependency_compare_version (version, predicate->compare, predicate->version);
+}
+
+static void pacman_dependency_predicate_init (PacmanDependencyPredicate *predicate, const gchar *name, PacmanDependencyCompare compare, const gchar *version) {
+	g_return_if_fail (predicate != NULL);
+	g_return_if_fail (name != NULL);
+	
+	predicate->name = g_intern_string (name);
+	predicate->length = strlen (name);
+	predicate->compare = compare;
+	
+	if (compare == PACMAN_DEPENDENCY_COMPARE_ANY || version == NULL) {
+		predicate->compare = PACMAN_DEPENDENCY_COMPARE_ANY;
+		predicate->version = NULL;
+	} else {
+		predicate->version = g_intern_string (version);
+	}
+}
+
+void pacman_dependency_compile (PacmanDependency *dependency, PacmanDependencyPredicate *predicate) {
+	g_return_if_fail (dependency != NULL);
+	
+	pacman_dependency_predicate_init (predicate, pacman_dependency_get_name (dependency), pacman_dependency_get_compare_operation (dependency), pacman_dependency_get_version (dependency));
+}
+
+void pacman_dependency_compile_string (const gchar *dependency, PacmanDependencyPredicate *predicate) {
+	PacmanDependencyCompare compare;
+	const gchar *version;
+	gchar *name;
+	
+	g_return_if_fail (dependency != NULL);
+	
+	name = pacman_dependency_split (dependency, &compare, &version);
+	pacman_dependency_predicate_init (predicate, name, compare, version);
+	g_free (name);
+}
+
+gboolean pacman_dependency_predicate_matches (const PacmanDependencyPredicate *predicate, PacmanPackage *package) {
+	const PacmanList *i;
+	const gchar *name;
+	
+	g_return_val_if_fail (predicate != NULL, FALSE);
+	g_return_val_if_fail (package != NULL, FALSE);
+	
+	/* equivalent to alpm_depcmp() */
+	name = pacman_package_get_name (package);
+	if (name[0] == predicate->name[0] && strcmp (name, predicate->name) == 0 && pacman_dependency_predicate_compare (predicate, pacman_package_get_version (package))) {
+		return TRUE;
+	}
+	
+	for (i = pacman_package_get_provides (package); i != NULL; i = pacman_list_next (i)) {
+		const gchar *provision = (const gchar *) pacman_list_get (i);
+		gchar end;
+		
+		if (provision[0] != predicate->name[0] || strncmp (provision, predicate->name, predicate->length) != 0) {
+			continue;
+		}
+		
+		/* provisions look like 'name' or 'name=version' */
+		end = provision[predicate->length];
+		if (end == '\0' && pacman_dependency_predicate_compare (predicate, NULL)) {
+			return TRUE;
+		} else if (end == '=' && pacman_dependency_predicate_compare (predicate, provision + predicate->length + 1)) {
+			return TRUE;
+		}
+	}
+	
+	return FALSE;
+}
+
+PacmanPackage *pacman_dependency_find_satisfier (PacmanDatabase *database, const gchar *dependency) {
+	PacmanDependencyPredicate predicate;
+	PacmanDependencyKey key;
+	PacmanPackage *result = NULL;
+	const PacmanList *i;
+	gpointer cached;
+	guint generation;
+	
+	g_return_val_if_fail (database != NULL, NULL);
+	g_return_val_if_fail (dependency != NULL, NULL);
+	
+	key.dependency = dependency;
+	key.database = database;
+	
+	pacman_statistics_count (PACMAN_STATISTIC_DEPENDENCY_CHECKS);
+	
+	cached = pacman_dependency_cache_lookup (&key, &generation);
+	if (cached != NULL) {
+		pacman_statistics_count (PACMAN_STATISTIC_DEPENDENCY_CACHE_HITS);
+		return (cached == &pacman_dependency_unsatisfied) ? NULL : (PacmanPackage *) cached;
+	}
+	
+	/* like alpm_deptest(), this finds the first package in the database that satisfies the dependency */
+	pacman_dependency_compile_string (dependency, &predicate);
+	for (i = pacman_database_get_packages (database); i != NULL; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		if (pacman_dependency_predicate_matches (&predicate, package)) {
+			result = package;
+			break;
+		}
+	}
+	
+	pacman_dependency_cache_insert (&key, generation, (result == NULL) ? (gpointer) &pacman_dependency_unsatisfied : (gpointer) result);
+	return result;
+}
+
 /**
  * pacman_dependency_satisfied_by:
  * @dependency: A #PacmanDependency.
@@ -97,9 +397,39 @@ gboolean pacman_dependency_satisfied_by (PacmanDependency *dependency, PacmanPac
 	g_return_val_if_fail (package != NULL, FALSE);
 	g_return_val_if_fail (dependency != NULL, TRUE);
 	
+	/* a single comparison is as cheap as looking it up, so only whole-database searches are cached */
+	pacman_statistics_count (PACMAN_STATISTIC_DEPENDENCY_CHECKS);
 	return alpm_depcmp (package, dependency) != 0;
 }
 
+/**
+ * pacman_dependency_filter_satisfying:
+ * @dependency: A #PacmanDependency.
+ * @packages: A list of #PacmanPackage.
+ *
+ * Finds every package in @packages that satisfies @dependency. This is faster than calling pacman_dependency_satisfied_by() for each package.
+ *
+ * Returns: A list of #PacmanPackage, in the same order as @packages. Free with pacman_list_free().
+ */
+PacmanList *pacman_dependency_filter_satisfying (PacmanDependency *dependency, const PacmanList *packages) {
+	PacmanDependencyPredicate predicate;
+	PacmanList *result = NULL;
+	const PacmanList *i;
+	
+	g_return_val_if_fail (dependency != NULL, NULL);
+	
+	pacman_dependency_compile (dependency, &predicate);
+	
+	for (i = packages; i != NULL; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		if (pacman_dependency_predicate_matches (&predicate, package)) {
+			result = pacman_list_add (result, package);
+		}
+	}
+	
+	return result;
+}
+
 /**
  * pacman_dependency_to_string:
  * @dependency: A #PacmanDependency.
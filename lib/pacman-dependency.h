@@ -60,6 +60,7 @@ const gchar *pacman_dependency_get_version (PacmanDependency *dependency);
 PacmanDependencyCompare pacman_dependency_get_compare_operation (PacmanDependency *dependency);
 
 gboolean pacman_dependency_satisfied_by (PacmanDependency *dependency, PacmanPackage *package);
+PacmanList *pacman_dependency_filter_satisfying (PacmanDependency *dependency, const PacmanList *packages);
 gchar *pacman_dependency_to_string (PacmanDependency *dependency);
 
 G_END_DECLS
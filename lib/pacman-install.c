@@ -25,6 +25,7 @@
 #include "pacman-conflict.h"
 #include "pacman-file-conflict.h"
 #include "pacman-package.h"
+#include "pacman-manager.h"
 #include "pacman-private.h"
 #include "pacman-install.h"
 
@@ -42,15 +43,31 @@
  * Represents an installation transaction.
  */
 
+#define PACMAN_INSTALL_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), PACMAN_TYPE_INSTALL, PacmanInstallPrivate))
+
 G_DEFINE_TYPE (PacmanInstall, pacman_install, PACMAN_TYPE_TRANSACTION);
 
+typedef struct _PacmanInstallPrivate {
+	GHashTable *downloads;
+} PacmanInstallPrivate;
+
 static void pacman_install_init (PacmanInstall *install) {	
+	PacmanInstallPrivate *priv;
+	
 	g_return_if_fail (install != NULL);
+	
+	priv = PACMAN_INSTALL_GET_PRIVATE (install);
+	priv->downloads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 }
 
 static void pacman_install_finalize (GObject *object) {
+	PacmanInstallPrivate *priv;
+	
 	g_return_if_fail (object != NULL);
 	
+	priv = PACMAN_INSTALL_GET_PRIVATE (PACMAN_INSTALL (object));
+	g_hash_table_unref (priv->downloads);
+	
 	G_OBJECT_CLASS (pacman_install_parent_class)->finalize (object);
 }
 
@@ -77,12 +94,15 @@ PacmanTransaction *pacman_manager_install (PacmanManager *manager, guint32 flags
 }
 
 static gboolean pacman_install_prepare (PacmanTransaction *transaction, const PacmanList *targets, GError **error) {
+	PacmanInstallPrivate *priv;
 	const PacmanList *i;
 	PacmanList *data = NULL;
 	
 	g_return_val_if_fail (transaction != NULL, FALSE);
 	g_return_val_if_fail (targets != NULL, FALSE);
 	
+	priv = PACMAN_INSTALL_GET_PRIVATE (PACMAN_INSTALL (transaction));
+	
 	if (pacman_transaction_get_installs (transaction) != NULL) {
 		/* reinitialize so transaction can be prepared multiple times */
 		if (!pacman_transaction_restart (transaction, error)) {
@@ -95,14 +115,22 @@ static gboolean pacman_install_prepare (PacmanTransaction *transaction, const Pa
 		gchar *target = (gchar *) pacman_list_get (i);
 		
 		if (strstr (target, "://") != NULL) {
-			target = alpm_fetch_pkgurl (target);
-			if (target == NULL) {
-				g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not download package with url '%s': %s"), (gchar *) pacman_list_get (i), alpm_strerrorlast ());
-				return FALSE;
-			}
+			/* don't download the same file again when targets are added or removed */
+			const gchar *filename = (const gchar *) g_hash_table_lookup (priv->downloads, target);
 			
-			result = alpm_add_target (target);
-			free (target);
+			if (filename != NULL && g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+				result = alpm_add_target ((gchar *) filename);
+			} else {
+				target = alpm_fetch_pkgurl (target);
+				if (target == NULL) {
+					g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not download package with url '%s': %s"), (gchar *) pacman_list_get (i), alpm_strerrorlast ());
+					return FALSE;
+				}
+				
+				g_hash_table_insert (priv->downloads, g_strdup ((const gchar *) pacman_list_get (i)), g_strdup (target));
+				result = alpm_add_target (target);
+				free (target);
+			}
 		} else {
 			result = alpm_add_target (target);
 		}
@@ -156,6 +184,8 @@ static gboolean pacman_install_prepare (PacmanTransaction *transaction, const Pa
 static void pacman_install_class_init (PacmanInstallClass *klass) {
 	g_return_if_fail (klass != NULL);
 	
+	g_type_class_add_private (klass, sizeof (PacmanInstallPrivate));
+	
 	G_OBJECT_CLASS (klass)->finalize = pacman_install_finalize;
 	
 	PACMAN_TRANSACTION_CLASS (klass)->prepare = pacman_install_prepare;
@@ -0,0 +1,395 @@
+/* pacman-log.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib/gprintf.h>
+#include <glib/gstdio.h>
+#include <alpm.h>
+#include "pacman-private.h"
+
+/* longer messages are truncated when buffered */
+#define PACMAN_LOG_MESSAGE_SIZE 512
+
+/* how often the flusher wakes up if nobody stops it, in microseconds */
+#define PACMAN_LOG_FLUSH_INTERVAL 50000
+
+typedef struct {
+	volatile gint sequence;
+	GLogLevelFlags level;
+	gchar message[PACMAN_LOG_MESSAGE_SIZE];
+} PacmanLogSlot;
+
+/* a bounded multi-producer, single-consumer queue: writers claim a slot by advancing head, and only the flusher reads */
+typedef struct {
+	PacmanLogSlot *slots;
+	guint capacity;
+	volatile gint head;
+	guint tail;
+	volatile gint dropped;
+	
+	GThread *thread;
+	GMutex mutex;
+	GCond cond;
+	gboolean stopping;
+} PacmanLogBuffer;
+
+static PacmanLogBuffer *pacman_log_buffer = NULL;
+
+/* writers that may still be using the buffer they found, so it is not freed under them */
+static volatile gint pacman_log_buffer_writers = 0;
+
+static gboolean pacman_log_buffer_pop (PacmanLogBuffer *buffer) {
+	PacmanLogSlot *slot;
+	
+	g_return_val_if_fail (buffer != NULL, FALSE);
+	
+	slot = &buffer->slots[buffer->tail & (buffer->capacity - 1)];
+	if ((gint) ((guint) g_atomic_int_get (&slot->sequence) - (buffer->tail + 1)) < 0) {
+		return FALSE;
+	}
+	
+	g_log (G_LOG_DOMAIN, slot->level, "%s", slot->message);
+	g_atomic_int_set (&slot->sequence, (gint) (buffer->tail + buffer->capacity));
+	++buffer->tail;
+	return TRUE;
+}
+
+static void pacman_log_buffer_flush (PacmanLogBuffer *buffer) {
+	gint dropped;
+	
+	g_return_if_fail (buffer != NULL);
+	
+	while (pacman_log_buffer_pop (buffer));
+	
+	dropped = g_atomic_int_get (&buffer->dropped);
+	if (dropped > 0) {
+		g_atomic_int_add (&buffer->dropped, -dropped);
+		g_log (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "%d log messages were dropped\n", dropped);
+	}
+}
+
+static gpointer pacman_log_buffer_run (gpointer data) {
+	PacmanLogBuffer *buffer = (PacmanLogBuffer *) data;
+	
+	g_return_val_if_fail (buffer != NULL, NULL);
+	
+	g_mutex_lock (&buffer->mutex);
+	while (!buffer->stopping) {
+		g_mutex_unlock (&buffer->mutex);
+		pacman_log_buffer_flush (buffer);
+		g_mutex_lock (&buffer->mutex);
+		
+		if (!buffer->stopping) {
+			g_cond_wait_until (&buffer->cond, &buffer->mutex, g_get_monotonic_time () + PACMAN_LOG_FLUSH_INTERVAL);
+		}
+	}
+	g_mutex_unlock (&buffer->mutex);
+	
+	pacman_log_buffer_flush (buffer);
+	return NULL;
+}
+
+void pacman_log_buffer_start (guint size) {
+	PacmanLogBuffer *buffer;
+	guint i;
+	
+	g_return_if_fail (pacman_log_buffer == NULL);
+	g_return_if_fail (size > 0);
+	
+	buffer = g_new0 (PacmanLogBuffer, 1);
+	for (buffer->capacity = 1; buffer->capacity < size; buffer->capacity <<= 1);
+	
+	buffer->slots = g_new (PacmanLogSlot, buffer->capacity);
+	for (i = 0; i < buffer->capacity; ++i) {
+		buffer->slots[i].sequence = (gint) i;
+	}
+	
+	g_mutex_init (&buffer->mutex);
+	g_cond_init (&buffer->cond);
+	buffer->thread = g_thread_new ("pacman-log", pacman_log_buffer_run, buffer);
+	
+	g_atomic_pointer_set (&pacman_log_buffer, buffer);
+}
+
+void pacman_log_buffer_stop (void) {
+	PacmanLogBuffer *buffer = (PacmanLogBuffer *) g_atomic_pointer_get (&pacman_log_buffer);
+	
+	if (buffer == NULL) {
+		return;
+	}
+	
+	/* later messages go straight to g_logv, and the flusher drains whatever is left */
+	g_atomic_pointer_set (&pacman_log_buffer, NULL);
+	while (g_atomic_int_get (&pacman_log_buffer_writers) > 0) {
+		g_thread_yield ();
+	}
+	
+	g_mutex_lock (&buffer->mutex);
+	buffer->stopping = TRUE;
+	g_cond_signal (&buffer->cond);
+	g_mutex_unlock (&buffer->mutex);
+	
+	g_thread_join (buffer->thread);
+	g_mutex_clear (&buffer->mutex);
+	g_cond_clear (&buffer->cond);
+	
+	g_free (buffer->slots);
+	g_free (buffer);
+}
+
+gboolean pacman_log_buffer_push (GLogLevelFlags level, const gchar *format, va_list args) {
+	PacmanLogBuffer *buffer;
+	PacmanLogSlot *slot;
+	guint position;
+	
+	g_return_val_if_fail (format != NULL, FALSE);
+	
+	/* errors are reported right away, so that they arrive before the GError that follows */
+	if ((level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL)) != 0) {
+		return FALSE;
+	}
+	
+	/* announce this writer before looking at the buffer, so that pacman_log_buffer_stop() waits for it */
+	g_atomic_int_inc (&pacman_log_buffer_writers);
+	buffer = (PacmanLogBuffer *) g_atomic_pointer_get (&pacman_log_buffer);
+	if (buffer == NULL) {
+		g_atomic_int_add (&pacman_log_buffer_writers, -1);
+		return FALSE;
+	}
+	
+	position = (guint) g_atomic_int_get (&buffer->head);
+	for (;;) {
+		gint difference;
+		
+		slot = &buffer->slots[position & (buffer->capacity - 1)];
+		difference = (gint) ((guint) g_atomic_int_get (&slot->sequence) - position);
+		
+		if (difference == 0) {
+			if (g_atomic_int_compare_and_exchange (&buffer->head, (gint) position, (gint) (position + 1))) {
+				break;
+			}
+		} else if (difference < 0) {
+			/* the flusher is behind, so drop the message rather than block */
+			g_atomic_int_inc (&buffer->dropped);
+			g_atomic_int_add (&pacman_log_buffer_writers, -1);
+			return TRUE;
+		}
+		
+		position = (guint) g_atomic_int_get (&buffer->head);
+	}
+	
+	slot->level = level;
+	g_vsnprintf (slot->message, PACMAN_LOG_MESSAGE_SIZE, format, args);
+	g_atomic_int_set (&slot->sequence, (gint) (position + 1));
+	
+	g_atomic_int_add (&pacman_log_buffer_writers, -1);
+	return TRUE;
+}
+
+/* room for a few hundred lines before the journal has to grow */
+#define PACMAN_LOG_JOURNAL_SIZE 65536
+
+/* log lines are written into a shared mapping so that they survive a crash, and appended to the log file when the caller commits them */
+struct _PacmanLogJournal {
+	gchar *filename;
+	gint fd;
+	gint log;
+	gchar *map;
+	gsize size;
+	gsize length;
+};
+
+static gboolean pacman_log_write (gint fd, const gchar *lines, gsize length) {
+	g_return_val_if_fail (fd >= 0, FALSE);
+	g_return_val_if_fail (lines != NULL, FALSE);
+	
+	/* not synced, the same as the lines alpm writes itself */
+	while (length > 0) {
+		gssize result = write (fd, lines, length);
+		
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			
+			return FALSE;
+		}
+		
+		lines += result;
+		length -= (gsize) result;
+	}
+	
+	return TRUE;
+}
+
+static void pacman_log_journal_recover (PacmanLogJournal *journal) {
+	gchar *contents;
+	gsize length;
+	
+	g_return_if_fail (journal != NULL);
+	
+	/* a previous transaction crashed before its lines were appended */
+	if (g_file_get_contents (journal->filename, &contents, &length, NULL)) {
+		length = strnlen (contents, length);
+		if (length > 0) {
+			pacman_log_write (journal->log, contents, length);
+		}
+		g_free (contents);
+	}
+}
+
+PacmanLogJournal *pacman_log_journal_open (void) {
+	PacmanLogJournal *journal;
+	const gchar *logfile;
+	
+	logfile = alpm_option_get_logfile ();
+	if (logfile == NULL) {
+		return NULL;
+	}
+	
+	journal = g_new0 (PacmanLogJournal, 1);
+	journal->filename = g_strconcat (logfile, ".journal", NULL);
+	journal->fd = -1;
+	
+	/* kept open for the whole transaction, so committing is a single write */
+	journal->log = open (logfile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (journal->log < 0) {
+		g_free (journal->filename);
+		g_free (journal);
+		return NULL;
+	}
+	
+	pacman_log_journal_recover (journal);
+	
+	journal->size = PACMAN_LOG_JOURNAL_SIZE;
+	journal->fd = open (journal->filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (journal->fd < 0 || ftruncate (journal->fd, (off_t) journal->size) < 0) {
+		goto error;
+	}
+	
+	journal->map = mmap (NULL, journal->size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+	if (journal->map == MAP_FAILED) {
+		goto error;
+	}
+	
+	return journal;
+
+error:
+	if (journal->fd >= 0) {
+		close (journal->fd);
+	}
+	close (journal->log);
+	g_unlink (journal->filename);
+	g_free (journal->filename);
+	g_free (journal);
+	return NULL;
+}
+
+static gboolean pacman_log_journal_grow (PacmanLogJournal *journal, gsize length) {
+	gsize size;
+	gchar *map;
+	
+	g_return_val_if_fail (journal != NULL, FALSE);
+	
+	for (size = journal->size; size < journal->length + length; size <<= 1);
+	if (ftruncate (journal->fd, (off_t) size) < 0) {
+		return FALSE;
+	}
+	
+	map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+	if (map == MAP_FAILED) {
+		return FALSE;
+	}
+	
+	munmap (journal->map, journal->size);
+	journal->map = map;
+	journal->size = size;
+	return TRUE;
+}
+
+void pacman_log_journal_append (PacmanLogJournal *journal, const gchar *format, ...) {
+	gchar prefix[32], *line;
+	struct tm now;
+	time_t t;
+	va_list args;
+	gsize length;
+	
+	g_return_if_fail (format != NULL);
+	
+	va_start (args, format);
+	line = g_strdup_vprintf (format, args);
+	va_end (args);
+	
+	/* the same format that alpm_logaction uses */
+	t = time (NULL);
+	localtime_r (&t, &now);
+	strftime (prefix, sizeof (prefix), "[%Y-%m-%d %H:%M] ", &now);
+	
+	length = strlen (prefix) + strlen (line);
+	if (journal == NULL || (journal->length + length > journal->size && !pacman_log_journal_grow (journal, length))) {
+		/* better to pay for the write than to lose the line */
+		alpm_logaction ("%s", line);
+		g_free (line);
+		return;
+	}
+	
+	memcpy (journal->map + journal->length, prefix, strlen (prefix));
+	memcpy (journal->map + journal->length + strlen (prefix), line, strlen (line));
+	journal->length += length;
+	
+	if (alpm_option_get_usesyslog ()) {
+		syslog (LOG_NOTICE, "%s", line);
+	}
+	g_free (line);
+}
+
+void pacman_log_journal_commit (PacmanLogJournal *journal) {
+	g_return_if_fail (journal != NULL);
+	
+	if (journal->length == 0) {
+		return;
+	}
+	
+	if (pacman_log_write (journal->log, journal->map, journal->length)) {
+		/* a crash before this point replays the lines, which is better than losing them */
+		memset (journal->map, 0, journal->length);
+		journal->length = 0;
+	}
+}
+
+void pacman_log_journal_close (PacmanLogJournal *journal) {
+	g_return_if_fail (journal != NULL);
+	
+	pacman_log_journal_commit (journal);
+	munmap (journal->map, journal->size);
+	close (journal->fd);
+	close (journal->log);
+	
+	if (journal->length == 0) {
+		g_unlink (journal->filename);
+	}
+	
+	g_free (journal->filename);
+	g_free (journal);
+}
@@ -17,13 +17,13 @@
  */
 
 #include <sys/utsname.h>
-#include <sys/wait.h>
 #include <glib/gi18n-lib.h>
 #include <alpm.h>
 #include "pacman-error.h"
 #include "pacman-list.h"
 #include "pacman-database.h"
 #include "pacman-transaction.h"
+#include "pacman-private.h"
 #include "pacman-manager.h"
 
 /**
@@ -46,15 +46,27 @@ G_DEFINE_TYPE (PacmanManager, pacman_manager, G_TYPE_OBJECT);
 
 PacmanManager *pacman_manager = NULL;
 
+/* read from whichever thread libalpm logs on, so kept outside the private struct */
+static volatile gint pacman_manager_log_mask = G_LOG_LEVEL_MASK;
+
 typedef struct _PacmanManagerPrivate {
 	PacmanTransaction *transaction;
 	
 	gboolean i_love_candy;
 	gboolean show_size;
 	gboolean total_download;
+	guint progress_rate;
+	guint log_buffer_size;
 	
 	gchar *clean_method;
 	GClosure *transfer;
+	PacmanTransferCommand *command;
+	gboolean internal_downloader;
+	guint parallel_downloads;
+	guint server_connections;
+	
+	/* files downloaded ahead of libalpm, and whether they changed */
+	GHashTable *fetched;
 	
 	PacmanList *hold_packages;
 	PacmanList *sync_firsts;
@@ -71,6 +83,10 @@ static void pacman_manager_init (PacmanManager *manager) {
 	
 	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
 	priv->clean_method = g_strdup ("KeepInstalled");
+	priv->progress_rate = 10;
+	priv->parallel_downloads = 4;
+	priv->server_connections = 2;
+	priv->fetched = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void pacman_manager_finalize (GObject *object) {
@@ -83,11 +99,16 @@ static void pacman_manager_finalize (GObject *object) {
 		g_object_unref (priv->transaction);
 	}
 	
+	pacman_log_buffer_stop ();
+	pacman_mirror_save ();
+	
 	g_free (priv->clean_method);
 	if (priv->transfer != NULL) {
 		g_closure_unref (priv->transfer);
 	}
 	
+	g_hash_table_unref (priv->fetched);
+	
 	pacman_list_free_full (priv->hold_packages, g_free);
 	pacman_list_free_full (priv->sync_firsts, g_free);
 	
@@ -122,7 +143,111 @@ static void pacman_manager_log_cb (pmloglevel_t level, gchar *format, va_list ar
 			break;
 	}
 	
-	g_logv (G_LOG_DOMAIN, flags, format, args);
+	/* drop unwanted messages before anything is formatted */
+	if ((flags & (GLogLevelFlags) g_atomic_int_get (&pacman_manager_log_mask)) == 0) {
+		return;
+	}
+	
+	if (!pacman_log_buffer_push (flags, format, args)) {
+		g_logv (G_LOG_DOMAIN, flags, format, args);
+	}
+}
+
+static void pacman_manager_transfer_progress (const gchar *filename, guint64 complete, guint64 total, gpointer user_data) {
+	alpm_cb_download func = alpm_option_get_dlcb ();
+	
+	/* report progress the same way libalpm would */
+	if (func != NULL) {
+		func (filename, (off_t) complete, (off_t) total);
+	}
+}
+
+static gint pacman_manager_fetch_with_closure (GClosure *closure, const gchar *url, const gchar *path, gboolean force) {
+	GValue result = { 0 }, params[4] = { 0 };
+	
+	g_return_val_if_fail (closure != NULL, -1);
+	
+	g_value_init (&params[0], PACMAN_TYPE_MANAGER);
+	g_value_set_instance (&params[0], pacman_manager);
+	
+	g_value_init (&params[1], G_TYPE_STRING);
+	g_value_set_string (&params[1], url);
+	
+	g_value_init (&params[2], G_TYPE_STRING);
+	g_value_set_string (&params[2], path);
+	
+	g_value_init (&params[3], G_TYPE_BOOLEAN);
+	g_value_set_boolean (&params[3], force);
+	
+	g_value_init (&result, G_TYPE_INT);
+	g_closure_invoke (closure, &result, 4, params, NULL);
+	return g_value_get_int (&result);
+}
+
+static gint pacman_manager_fetch_cb (const gchar *url, const gchar *path, int force) {
+	PacmanManagerPrivate *priv;
+	gchar *filename, *kept = NULL;
+	gpointer value;
+	gint status;
+	
+	g_return_val_if_fail (url != NULL, -1);
+	g_return_val_if_fail (path != NULL, -1);
+	g_return_val_if_fail (pacman_manager != NULL, -1);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (pacman_manager);
+	PACMAN_PROBE3 (fetch__start, url, path, force);
+	
+	filename = g_build_filename (path, (strrchr (url, '/') != NULL) ? strrchr (url, '/') + 1 : url, NULL);
+	if (g_hash_table_lookup_extended (priv->fetched, filename, NULL, &value)) {
+		/* downloaded already, along with several others at once */
+		status = GPOINTER_TO_INT (value);
+		g_hash_table_remove (priv->fetched, filename);
+		g_free (filename);
+		
+		if (status == 0) {
+			pacman_database_begin_update ();
+		}
+		
+		PACMAN_PROBE2 (fetch__done, url, status);
+		return status;
+	}
+	
+	/* a database sent again without changing does not need to be unpacked, unless an update is forced */
+	if (!force && g_str_has_suffix (filename, ".db.tar.gz") && g_file_test (filename, G_FILE_TEST_EXISTS)) {
+		kept = pacman_checksum_keep (filename);
+	}
+	
+	if (priv->transfer == NULL) {
+		GError *error = NULL;
+		
+		status = pacman_transfer_download (url, path, force != 0, pacman_manager_transfer_progress, NULL, NULL, &error);
+		if (status < 0) {
+			g_warning ("%s\n", error->message);
+			g_error_free (error);
+		}
+	} else {
+		status = pacman_manager_fetch_with_closure (priv->transfer, url, path, force != 0);
+		
+		/* hash new packages in the background while the next one downloads */
+		if (status == 0 && !g_str_has_suffix (url, ".db")) {
+			pacman_checksum_prefetch (filename);
+		}
+	}
+	
+	if (status == 0 && kept != NULL && pacman_checksum_unchanged (kept, filename)) {
+		status = 1;
+	}
+	
+	pacman_checksum_discard (kept);
+	g_free (filename);
+	
+	/* alpm unpacks a new database as soon as this returns */
+	if (status == 0) {
+		pacman_database_begin_update ();
+	}
+	
+	PACMAN_PROBE2 (fetch__done, url, status);
+	return status;
 }
 
 static gboolean pacman_set_user_agent (void) {
@@ -421,6 +546,113 @@ void pacman_manager_set_total_download (PacmanManager *manager, gboolean value)
 	priv->total_download = value;
 }
 
+/**
+ * pacman_manager_get_progress_rate:
+ * @manager: A #PacmanManager.
+ *
+ * Gets the maximum number of times per second that a transaction will emit #PacmanTransaction::progress and #PacmanTransaction::download for each target. Updates in between are held back, and the latest one is emitted once the interval is up or the transaction moves on to another phase. Updates that start or finish an operation are never held back. See #PacmanManager:progress-rate.
+ *
+ * Returns: A number of emissions per second, or 0 if there is no limit.
+ */
+guint pacman_manager_get_progress_rate (PacmanManager *manager) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_val_if_fail (manager != NULL, 0);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	return priv->progress_rate;
+}
+
+/**
+ * pacman_manager_set_progress_rate:
+ * @manager: A #PacmanManager.
+ * @value: A number of emissions per second, or 0.
+ *
+ * Sets the progress rate to @value. See pacman_manager_get_progress_rate().
+ */
+void pacman_manager_set_progress_rate (PacmanManager *manager, guint value) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_if_fail (manager != NULL);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->progress_rate != value) {
+		priv->progress_rate = value;
+		g_object_notify (G_OBJECT (manager), "progress-rate");
+	}
+}
+
+/**
+ * pacman_manager_get_log_mask:
+ * @manager: A #PacmanManager.
+ *
+ * Gets the log levels that messages from alpm are passed on at. Messages at other levels are discarded before they are formatted. alpm debug messages are logged at %G_LOG_LEVEL_DEBUG, function traces at %G_LOG_LEVEL_INFO, warnings at %G_LOG_LEVEL_WARNING and errors at %G_LOG_LEVEL_CRITICAL. See #PacmanManager:log-mask.
+ *
+ * Returns: A combination of #GLogLevelFlags.
+ */
+GLogLevelFlags pacman_manager_get_log_mask (PacmanManager *manager) {
+	g_return_val_if_fail (manager != NULL, 0);
+	
+	return (GLogLevelFlags) g_atomic_int_get (&pacman_manager_log_mask);
+}
+
+/**
+ * pacman_manager_set_log_mask:
+ * @manager: A #PacmanManager.
+ * @mask: A combination of #GLogLevelFlags.
+ *
+ * Sets the log mask to @mask. See pacman_manager_get_log_mask().
+ */
+void pacman_manager_set_log_mask (PacmanManager *manager, GLogLevelFlags mask) {
+	g_return_if_fail (manager != NULL);
+	
+	if (g_atomic_int_get (&pacman_manager_log_mask) != (gint) mask) {
+		g_atomic_int_set (&pacman_manager_log_mask, (gint) mask);
+		g_object_notify (G_OBJECT (manager), "log-mask");
+	}
+}
+
+/**
+ * pacman_manager_get_log_buffer_size:
+ * @manager: A #PacmanManager.
+ *
+ * Gets the number of messages from alpm that can be buffered before they are logged. If this is not 0, messages are formatted into a ring buffer and passed to g_log() by a background thread, so that logging does not hold up a transaction. If the buffer fills up, further messages are dropped and a warning is logged. Errors are never buffered. See #PacmanManager:log-buffer-size.
+ *
+ * Returns: A number of messages, or 0 if messages are logged immediately.
+ */
+guint pacman_manager_get_log_buffer_size (PacmanManager *manager) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_val_if_fail (manager != NULL, 0);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	return priv->log_buffer_size;
+}
+
+/**
+ * pacman_manager_set_log_buffer_size:
+ * @manager: A #PacmanManager.
+ * @size: A number of messages, or 0.
+ *
+ * Sets the log buffer size to @size, flushing any messages that are still buffered. This should not be called while a transaction is running in another thread. See pacman_manager_get_log_buffer_size().
+ */
+void pacman_manager_set_log_buffer_size (PacmanManager *manager, guint size) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_if_fail (manager != NULL);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->log_buffer_size != size) {
+		pacman_log_buffer_stop ();
+		if (size > 0) {
+			pacman_log_buffer_start (size);
+		}
+		
+		priv->log_buffer_size = size;
+		g_object_notify (G_OBJECT (manager), "log-buffer-size");
+	}
+}
+
 /**
  * pacman_manager_get_use_delta:
  * @manager: A #PacmanManager.
@@ -475,38 +707,61 @@ void pacman_manager_set_use_syslog (PacmanManager *manager, gboolean value) {
 	alpm_option_set_usesyslog (value);
 }
 
-static gint pacman_manager_fetch_cb (const gchar *url, const gchar *path, int force) {
+static void pacman_manager_update_fetch_cb (PacmanManager *manager) {
 	PacmanManagerPrivate *priv;
-	GValue result = { 0 }, params[4] = { 0 };
-	
-	g_return_val_if_fail (url != NULL, -1);
-	g_return_val_if_fail (path != NULL, -1);
-	g_return_val_if_fail (pacman_manager != NULL, -1);
 	
-	priv = PACMAN_MANAGER_GET_PRIVATE (pacman_manager);
-	
-	g_value_init (&params[0], PACMAN_TYPE_MANAGER);
-	g_value_set_instance (&params[0], pacman_manager);
+	g_return_if_fail (manager != NULL);
 	
-	g_value_init (&params[1], G_TYPE_STRING);
-	g_value_set_string (&params[1], url);
+	/* otherwise libalpm downloads files itself using libfetch */
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->transfer != NULL || priv->internal_downloader) {
+		alpm_option_set_fetchcb (pacman_manager_fetch_cb);
+	} else {
+		alpm_option_set_fetchcb (NULL);
+	}
+}
+
+/**
+ * pacman_manager_get_use_internal_downloader:
+ * @manager: A #PacmanManager.
+ *
+ * Checks whether pacman will download files itself instead of letting libalpm use libfetch, when no transfer handler has been set. The internal downloader fetches several files at once, resumes and splits large downloads and skips databases that have not changed, but it only speaks HTTP itself: other URLs are opened with #GFile, so ftp:// mirrors need gvfs and HTTPS needs glib-networking. Plain HTTP goes through http_proxy like libfetch, while HTTPS only uses a proxy if the #GProxyResolver of GIO provides one. See #PacmanManager:use-internal-downloader.
+ *
+ * Returns: %TRUE if the internal downloader will be used, %FALSE otherwise.
+ */
+gboolean pacman_manager_get_use_internal_downloader (PacmanManager *manager) {
+	PacmanManagerPrivate *priv;
 	
-	g_value_init (&params[2], G_TYPE_STRING);
-	g_value_set_string (&params[2], path);
+	g_return_val_if_fail (manager != NULL, FALSE);
 	
-	g_value_init (&params[3], G_TYPE_BOOLEAN);
-	g_value_set_boolean (&params[3], force != 0);
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	return priv->internal_downloader;
+}
+
+/**
+ * pacman_manager_set_use_internal_downloader:
+ * @manager: A #PacmanManager.
+ * @value: %TRUE or %FALSE.
+ *
+ * Sets whether the internal downloader will be used to @value. See pacman_manager_get_use_internal_downloader().
+ */
+void pacman_manager_set_use_internal_downloader (PacmanManager *manager, gboolean value) {
+	PacmanManagerPrivate *priv;
 	
-	g_value_init (&result, G_TYPE_INT);
-	g_closure_invoke (priv->transfer, &result, 4, params, NULL);
+	g_return_if_fail (manager != NULL);
 	
-	return g_value_get_int (&result);
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->internal_downloader != value) {
+		priv->internal_downloader = value;
+		pacman_manager_update_fetch_cb (manager);
+		g_object_notify (G_OBJECT (manager), "use-internal-downloader");
+	}
 }
 
 /**
  * pacman_manager_set_transfer_closure:
  * @manager: A #PacmanManager.
- * @closure: A #GClosure, or %NULL to download files internally.
+ * @closure: A #GClosure, or %NULL to use the default downloader.
  *
  * Sets the closure that pacman will use to download files to @closure. See #PacmanTransferFunc.
  */
@@ -520,15 +775,9 @@ void pacman_manager_set_transfer_closure (PacmanManager *manager, GClosure *clos
 		g_closure_unref (priv->transfer);
 	}
 	
-	if (closure == NULL) {
-		alpm_option_set_fetchcb (NULL);
-		priv->transfer = NULL;
-	} else {
-		if (priv->transfer == NULL) {
-			alpm_option_set_fetchcb (pacman_manager_fetch_cb);
-		}
-		priv->transfer = closure;
-	}
+	priv->transfer = closure;
+	priv->command = NULL;
+	pacman_manager_update_fetch_cb (manager);
 }
 
 void g_cclosure_user_marshal_INT__STRING_STRING_BOOLEAN (GClosure *closure, GValue *result, guint param_count, const GValue *param_values, gpointer hint, gpointer marshal_data);
@@ -536,7 +785,7 @@ void g_cclosure_user_marshal_INT__STRING_STRING_BOOLEAN (GClosure *closure, GVal
 /**
  * pacman_manager_set_transfer_handler:
  * @manager: A #PacmanManager.
- * @func: A #PacmanTransferFunc function, or %NULL to download files internally.
+ * @func: A #PacmanTransferFunc function, or %NULL to use the default downloader.
  * @user_data: User data to pass to @func.
  * @destroy_data: A #GClosureNotify to be called when @user_data is no longer needed.
  *
@@ -555,121 +804,176 @@ void pacman_manager_set_transfer_handler (PacmanManager *manager, PacmanTransfer
 }
 
 static gint pacman_transfer_with_command (PacmanManager *manager, const gchar *url, const gchar *path, gboolean again, gpointer user_data) {
-	const gchar *transfer_command = (const gchar *) user_data;
-	GRegex *input, *output;
-	gchar *old_pwd, *basename, *tempname, *filename;
-	gchar *temp_command, *final_command;
-	gint status = -1;
-	
-	g_return_val_if_fail (url != NULL, FALSE);
-	g_return_val_if_fail (path != NULL, FALSE);
-	g_return_val_if_fail (transfer_command != NULL, FALSE);
+	PacmanTransferCommand *command = (PacmanTransferCommand *) user_data;
+	GError *error = NULL;
+	gint result;
 	
-	old_pwd = g_get_current_dir ();
-	if (g_chdir (path) < 0) {
-		g_warning ("Could not locate download directory %s\n", path);
-		g_free (old_pwd);
-		return status;
-	}
+	g_return_val_if_fail (url != NULL, -1);
+	g_return_val_if_fail (path != NULL, -1);
+	g_return_val_if_fail (command != NULL, -1);
 	
-	input = g_regex_new ("%u", 0, 0, NULL);
-	if (input == NULL) {
-		g_chdir (old_pwd);
-		g_free (old_pwd);
-		return status;
+	result = pacman_transfer_command_run (command, url, path, again, &error);
+	if (result < 0) {
+		g_warning ("%s\n", error->message);
+		g_error_free (error);
 	}
 	
-	output = g_regex_new ("%o", 0, 0, NULL);
-	if (output == NULL) {
-		g_regex_unref (input);
-		g_chdir (old_pwd);
-		g_free (old_pwd);
-		return status;
-	}
+	return result;
+}
+
+static void pacman_manager_transfer_command_free (gpointer user_data, GClosure *closure) {
+	pacman_transfer_command_free ((PacmanTransferCommand *) user_data);
+}
+
+/**
+ * pacman_manager_set_transfer_command:
+ * @manager: A #PacmanManager.
+ * @command: A command, or %NULL to use the default downloader.
+ *
+ * Sets the command pacman will use to download files to @command. The placeholder \%u will be replaced by the URL of the file to download, and \%o will be replaced by a path where the file should be downloaded to. The command is split into arguments once, without using a shell, and is run in the download directory. Unlike other transfer handlers, several copies of it can run at the same time, see pacman_manager_get_parallel_downloads().
+ */
+void pacman_manager_set_transfer_command (PacmanManager *manager, const gchar *command) {
+	PacmanTransferCommand *template;
+	GError *error = NULL;
 	
-	basename = g_path_get_basename (url);
-	tempname = g_strdup_printf ("%s%s.part", path, basename);
-	filename = g_strdup_printf ("%s%s", path, basename);
+	g_return_if_fail (manager != NULL);
 	
-	if (again && g_file_test (tempname, G_FILE_TEST_EXISTS)) {
-		g_unlink (tempname);
-	}
-	if (again && g_file_test (filename, G_FILE_TEST_EXISTS)) {
-		g_unlink (filename);
+	if (command == NULL) {
+		pacman_manager_set_transfer_closure (manager, NULL);
+		return;
 	}
 	
-	temp_command = g_regex_replace_literal (output, transfer_command, -1, 0, tempname, 0, NULL);
-	if (temp_command != NULL) {
-		if (strcmp (temp_command, transfer_command) == 0) {
-			/* not using .part filename */
-			g_free (tempname);
-			tempname = NULL;
-		}
-		
-		final_command = g_regex_replace_literal (input, temp_command, -1, 0, url, 0, NULL);
-		if (final_command != NULL) {
-			if (!g_spawn_command_line_sync (final_command, NULL, NULL, &status, NULL)) {
-				g_warning ("Could not run transfer command %s\n", final_command);
-				status = -1;
-			} else if (WIFEXITED (status) == 0) {
-				g_warning ("Transfer command did not terminate correctly\n");
-				status = -1;
-			} else if (WEXITSTATUS (status) != EXIT_SUCCESS) {
-				g_warning ("Transfer command returned error code %d\n", WEXITSTATUS (status));
-				status = -1;
-			} else {
-				status = 0;
-				
-				if (tempname != NULL) {
-					/* using .part filename */
-					if (g_rename (tempname, filename) < 0) {
-						g_warning ("Could not rename resulting file %s\n", tempname);
-						status = -1;
-					}
-				}
-			}
-		}
+	template = pacman_transfer_command_new (command, &error);
+	if (template == NULL) {
+		g_warning ("Could not parse transfer command %s: %s\n", command, error->message);
+		g_error_free (error);
+		return;
 	}
 	
-	if (final_command != NULL) {
-		g_free (final_command);
-		g_free (temp_command);
-	}
+	pacman_manager_set_transfer_handler (manager, pacman_transfer_with_command, template, pacman_manager_transfer_command_free);
+	PACMAN_MANAGER_GET_PRIVATE (manager)->command = template;
+}
+
+/**
+ * pacman_manager_get_parallel_downloads:
+ * @manager: A #PacmanManager.
+ *
+ * Gets the maximum number of files that will be downloaded at the same time when committing a sync or update transaction. Missing packages and databases are downloaded before alpm looks for them, and each download that fails is tried again from the next mirror. This only applies to a transfer command or the internal downloader; otherwise files are downloaded one at a time, see pacman_manager_get_use_internal_downloader(). See #PacmanManager:parallel-downloads.
+ *
+ * Returns: A number of downloads.
+ */
+guint pacman_manager_get_parallel_downloads (PacmanManager *manager) {
+	PacmanManagerPrivate *priv;
 	
-	g_free (filename);
-	g_free (basename);
-	g_free (tempname);
+	g_return_val_if_fail (manager != NULL, 0);
 	
-	g_regex_unref (output);
-	g_regex_unref (input);
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	return priv->parallel_downloads;
+}
+
+/**
+ * pacman_manager_set_parallel_downloads:
+ * @manager: A #PacmanManager.
+ * @value: A number of downloads, at least 1.
+ *
+ * Sets the maximum number of parallel downloads to @value. See pacman_manager_get_parallel_downloads().
+ */
+void pacman_manager_set_parallel_downloads (PacmanManager *manager, guint value) {
+	PacmanManagerPrivate *priv;
 	
-	g_chdir (old_pwd);
-	g_free (old_pwd);
+	g_return_if_fail (manager != NULL);
+	g_return_if_fail (value > 0);
 	
-	return status;
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->parallel_downloads != value) {
+		priv->parallel_downloads = value;
+		g_object_notify (G_OBJECT (manager), "parallel-downloads");
+	}
 }
 
-static void pacman_transfer_command_free (gpointer user_data, GClosure *closure) {
-	g_free (user_data);
+/**
+ * pacman_manager_get_server_connections:
+ * @manager: A #PacmanManager.
+ *
+ * Gets the maximum number of files that will be downloaded from the same server at the same time. See pacman_manager_get_parallel_downloads() and #PacmanManager:server-connections.
+ *
+ * Returns: A number of connections.
+ */
+guint pacman_manager_get_server_connections (PacmanManager *manager) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_val_if_fail (manager != NULL, 0);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	return priv->server_connections;
 }
 
 /**
- * pacman_manager_set_transfer_command:
+ * pacman_manager_set_server_connections:
  * @manager: A #PacmanManager.
- * @command: A command, or %NULL to download files internally.
+ * @value: A number of connections, at least 1.
  *
- * Sets the command pacman will use to download files to @command. The placeholder \%u will be replaced by the URL of the file to download, and \%o will be replaced by a path where the file should be downloaded to.
+ * Sets the maximum number of connections to each server to @value. See pacman_manager_get_server_connections().
  */
-void pacman_manager_set_transfer_command (PacmanManager *manager, const gchar *command) {
+void pacman_manager_set_server_connections (PacmanManager *manager, guint value) {
+	PacmanManagerPrivate *priv;
+	
 	g_return_if_fail (manager != NULL);
+	g_return_if_fail (value > 0);
 	
-	if (command != NULL) {
-		pacman_manager_set_transfer_handler (manager, pacman_transfer_with_command, g_strdup (command), pacman_transfer_command_free);
-	} else {
-		pacman_manager_set_transfer_closure (manager, NULL);
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->server_connections != value) {
+		priv->server_connections = value;
+		g_object_notify (G_OBJECT (manager), "server-connections");
 	}
 }
 
+gboolean pacman_manager_download (PacmanManager *manager, const PacmanList *jobs, guint64 total) {
+	PacmanManagerPrivate *priv;
+	alpm_cb_totaldl func;
+	
+	g_return_val_if_fail (manager != NULL, FALSE);
+	
+	/* other handlers and libfetch are left to alpm, which runs them one file at a time */
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	if (priv->command == NULL && (priv->transfer != NULL || !priv->internal_downloader)) {
+		return FALSE;
+	}
+	
+	/* without a total, the caller says when downloading starts and finishes */
+	func = (total > 0) ? alpm_option_get_totaldlcb () : NULL;
+	if (func != NULL) {
+		func ((off_t) total);
+	}
+	
+	pacman_transfer_download_all (jobs, priv->parallel_downloads, priv->server_connections, priv->command, pacman_manager_transfer_progress, NULL, NULL);
+	
+	if (func != NULL) {
+		func (0);
+	}
+	
+	return TRUE;
+}
+
+void pacman_manager_remember_fetch (PacmanManager *manager, const gchar *filename, gint status) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_if_fail (manager != NULL);
+	g_return_if_fail (filename != NULL);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	g_hash_table_insert (priv->fetched, g_strdup (filename), GINT_TO_POINTER (status));
+}
+
+void pacman_manager_forget_fetches (PacmanManager *manager) {
+	PacmanManagerPrivate *priv;
+	
+	g_return_if_fail (manager != NULL);
+	
+	priv = PACMAN_MANAGER_GET_PRIVATE (manager);
+	g_hash_table_remove_all (priv->fetched);
+}
+
 /**
  * pacman_manager_get_architecture:
  * @manager: A #PacmanManager.
@@ -1138,6 +1442,8 @@ PacmanDatabase *pacman_manager_register_local_database (PacmanManager *manager,
 			g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not register database [%s]: %s"), "local", alpm_strerrorlast ());
 			return NULL;
 		}
+		
+		PACMAN_PROBE1 (database__register, "local");
 	}
 	
 	return database;
@@ -1165,6 +1471,7 @@ PacmanDatabase *pacman_manager_register_sync_database (PacmanManager *manager, c
 		return NULL;
 	}
 	
+	PACMAN_PROBE1 (database__register, name);
 	return database;
 }
 
@@ -1233,6 +1540,11 @@ PacmanDatabase *pacman_manager_find_sync_database (PacmanManager *manager, const
 gboolean pacman_manager_unregister_database (PacmanManager *manager, PacmanDatabase *database, GError **error) {
 	g_return_val_if_fail (manager != NULL, FALSE);
 	
+	/* the packages are freed along with the database */
+	pacman_dependency_invalidate ();
+	pacman_statistics_forget_databases ();
+	pacman_database_forget_servers (database);
+	pacman_database_forget_generations (database);
 	if (alpm_db_unregister (database) < 0) {
 		g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not unregister database: %s"), alpm_strerrorlast ());
 		return FALSE;
@@ -1253,6 +1565,11 @@ gboolean pacman_manager_unregister_database (PacmanManager *manager, PacmanDatab
 gboolean pacman_manager_unregister_all_databases (PacmanManager *manager, GError **error) {
 	g_return_val_if_fail (manager != NULL, FALSE);
 	
+	/* the packages are freed along with the database */
+	pacman_dependency_invalidate ();
+	pacman_statistics_forget_databases ();
+	pacman_database_forget_servers (NULL);
+	pacman_database_forget_generations (NULL);
 	if (alpm_db_unregister_all () < 0) {
 		g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not unregister all databases: %s"), alpm_strerrorlast ());
 		return FALSE;
@@ -1264,7 +1581,13 @@ gboolean pacman_manager_unregister_all_databases (PacmanManager *manager, GError
 enum {
 	PROP_0,
 	PROP_VERSION,
-	PROP_TRANSACTION
+	PROP_TRANSACTION,
+	PROP_PROGRESS_RATE,
+	PROP_LOG_MASK,
+	PROP_LOG_BUFFER_SIZE,
+	PROP_USE_INTERNAL_DOWNLOADER,
+	PROP_PARALLEL_DOWNLOADS,
+	PROP_SERVER_CONNECTIONS
 };
 
 /**
@@ -1331,6 +1654,68 @@ static void pacman_manager_get_property (GObject *object, guint prop_id, GValue
 			g_value_set_instance (value, pacman_manager_get_transaction (manager));
 			break;
 		
+		case PROP_PROGRESS_RATE:
+			g_value_set_uint (value, pacman_manager_get_progress_rate (manager));
+			break;
+		
+		case PROP_LOG_MASK:
+			g_value_set_uint (value, (guint) pacman_manager_get_log_mask (manager));
+			break;
+		
+		case PROP_LOG_BUFFER_SIZE:
+			g_value_set_uint (value, pacman_manager_get_log_buffer_size (manager));
+			break;
+		
+		case PROP_USE_INTERNAL_DOWNLOADER:
+			g_value_set_boolean (value, pacman_manager_get_use_internal_downloader (manager));
+			break;
+		
+		case PROP_PARALLEL_DOWNLOADS:
+			g_value_set_uint (value, pacman_manager_get_parallel_downloads (manager));
+			break;
+		
+		case PROP_SERVER_CONNECTIONS:
+			g_value_set_uint (value, pacman_manager_get_server_connections (manager));
+			break;
+		
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void pacman_manager_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+	g_return_if_fail (object != NULL);
+	g_return_if_fail (value != NULL);
+	
+	PacmanManager *manager;
+	manager = PACMAN_MANAGER (object);
+	
+	switch (prop_id) {
+		case PROP_PROGRESS_RATE:
+			pacman_manager_set_progress_rate (manager, g_value_get_uint (value));
+			break;
+		
+		case PROP_LOG_MASK:
+			pacman_manager_set_log_mask (manager, (GLogLevelFlags) g_value_get_uint (value));
+			break;
+		
+		case PROP_LOG_BUFFER_SIZE:
+			pacman_manager_set_log_buffer_size (manager, g_value_get_uint (value));
+			break;
+		
+		case PROP_USE_INTERNAL_DOWNLOADER:
+			pacman_manager_set_use_internal_downloader (manager, g_value_get_boolean (value));
+			break;
+		
+		case PROP_PARALLEL_DOWNLOADS:
+			pacman_manager_set_parallel_downloads (manager, g_value_get_uint (value));
+			break;
+		
+		case PROP_SERVER_CONNECTIONS:
+			pacman_manager_set_server_connections (manager, g_value_get_uint (value));
+			break;
+		
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -1369,13 +1754,37 @@ PacmanList *pacman_manager_find_missing_dependencies (PacmanManager *manager, co
  */
 PacmanList *pacman_manager_test_dependencies (PacmanManager *manager, const PacmanList *dependencies) {
 	PacmanDatabase *database;
+	PacmanList *result = NULL;
+	const PacmanList *i;
 	
 	g_return_val_if_fail (manager != NULL, NULL);
 	
 	database = pacman_manager_get_local_database (manager);
 	g_return_val_if_fail (database != NULL, NULL);
 	
-	return alpm_deptest (database, (PacmanList *) dependencies);
+	/* same as alpm_deptest(), but remembers the answer for next time */
+	for (i = dependencies; i != NULL; i = pacman_list_next (i)) {
+		const gchar *dependency = (const gchar *) pacman_list_get (i);
+		if (pacman_dependency_find_satisfier (database, dependency) == NULL) {
+			result = pacman_list_add (result, (gpointer) dependency);
+		}
+	}
+	
+	return result;
+}
+
+/**
+ * pacman_manager_get_statistics:
+ * @manager: A #PacmanManager.
+ *
+ * Takes a snapshot of the counters and timings the library keeps, for monitoring purposes. Counters are updated with atomic operations, so this can be called at any time, from any thread.
+ *
+ * Returns: A #PacmanStatistics. Free with pacman_statistics_free().
+ */
+PacmanStatistics *pacman_manager_get_statistics (PacmanManager *manager) {
+	g_return_val_if_fail (manager != NULL, NULL);
+	
+	return pacman_statistics_get ();
 }
 
 static void pacman_manager_class_init (PacmanManagerClass *klass) {
@@ -1384,6 +1793,7 @@ static void pacman_manager_class_init (PacmanManagerClass *klass) {
 	g_type_class_add_private (klass, sizeof (PacmanManagerPrivate));
 	
 	G_OBJECT_CLASS (klass)->get_property = pacman_manager_get_property;
+	G_OBJECT_CLASS (klass)->set_property = pacman_manager_set_property;
 	G_OBJECT_CLASS (klass)->finalize = pacman_manager_finalize;
 	
 	/**
@@ -1399,4 +1809,46 @@ static void pacman_manager_class_init (PacmanManagerClass *klass) {
 	 * The current transaction, created by pacman_manager_install(), pacman_manager_remove(), pacman_manager_sync() or pacman_manager_update().
 	 */
 	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_TRANSACTION, g_param_spec_object ("transaction", _("Transaction"), _("current transaction"), PACMAN_TYPE_TRANSACTION, G_PARAM_STATIC_NAME | G_PARAM_READABLE));
+	
+	/**
+	 * PacmanManager:progress-rate:
+	 *
+	 * The maximum number of progress and download signals a transaction emits per second, or 0 for no limit.
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_PROGRESS_RATE, g_param_spec_uint ("progress-rate", _("Progress rate"), _("maximum progress updates per second"), 0, G_MAXUINT, 10, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
+	
+	/**
+	 * PacmanManager:log-mask:
+	 *
+	 * The #GLogLevelFlags that messages from alpm are logged at. See pacman_manager_get_log_mask().
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_LOG_MASK, g_param_spec_uint ("log-mask", _("Log mask"), _("log levels to pass on"), 0, G_MAXUINT, G_LOG_LEVEL_MASK, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
+	
+	/**
+	 * PacmanManager:log-buffer-size:
+	 *
+	 * The number of messages from alpm that can be buffered for a background thread to log, or 0 to log them immediately. See pacman_manager_get_log_buffer_size().
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_LOG_BUFFER_SIZE, g_param_spec_uint ("log-buffer-size", _("Log buffer size"), _("messages to buffer for logging"), 0, G_MAXUINT, 0, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
+	
+	/**
+	 * PacmanManager:use-internal-downloader:
+	 *
+	 * Whether files are downloaded by pacman-glib instead of libfetch when no transfer handler is set. See pacman_manager_get_use_internal_downloader().
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_USE_INTERNAL_DOWNLOADER, g_param_spec_boolean ("use-internal-downloader", _("Use internal downloader"), _("download files without libfetch"), FALSE, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
+	
+	/**
+	 * PacmanManager:parallel-downloads:
+	 *
+	 * The maximum number of files to download at the same time. See pacman_manager_get_parallel_downloads().
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_PARALLEL_DOWNLOADS, g_param_spec_uint ("parallel-downloads", _("Parallel downloads"), _("maximum number of simultaneous downloads"), 1, G_MAXUINT, 4, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
+	
+	/**
+	 * PacmanManager:server-connections:
+	 *
+	 * The maximum number of files to download from the same server at the same time. See pacman_manager_get_server_connections().
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_SERVER_CONNECTIONS, g_param_spec_uint ("server-connections", _("Server connections"), _("maximum number of simultaneous downloads from each server"), 1, G_MAXUINT, 2, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
 }
@@ -26,6 +26,7 @@
 #include <glib.h>
 #include <glib-object.h>
 #include "pacman-types.h"
+#include "pacman-statistics.h"
 
 G_BEGIN_DECLS
 
@@ -71,6 +72,15 @@ void pacman_manager_set_show_size (PacmanManager *manager, gboolean value);
 gboolean pacman_manager_get_total_download (PacmanManager *manager);
 void pacman_manager_set_total_download (PacmanManager *manager, gboolean value);
 
+guint pacman_manager_get_progress_rate (PacmanManager *manager);
+void pacman_manager_set_progress_rate (PacmanManager *manager, guint value);
+
+GLogLevelFlags pacman_manager_get_log_mask (PacmanManager *manager);
+void pacman_manager_set_log_mask (PacmanManager *manager, GLogLevelFlags mask);
+
+guint pacman_manager_get_log_buffer_size (PacmanManager *manager);
+void pacman_manager_set_log_buffer_size (PacmanManager *manager, guint size);
+
 gboolean pacman_manager_get_use_delta (PacmanManager *manager);
 void pacman_manager_set_use_delta (PacmanManager *manager, gboolean value);
 
@@ -94,6 +104,16 @@ void pacman_manager_set_transfer_closure (PacmanManager *manager, GClosure *clos
 void pacman_manager_set_transfer_handler (PacmanManager *manager, PacmanTransferFunc func, gpointer user_data, GClosureNotify destroy_data);
 void pacman_manager_set_transfer_command (PacmanManager *manager, const gchar *command);
 
+
+gboolean pacman_manager_get_use_internal_downloader (PacmanManager *manager);
+void pacman_manager_set_use_internal_downloader (PacmanManager *manager, gboolean value);
+
+guint pacman_manager_get_parallel_downloads (PacmanManager *manager);
+void pacman_manager_set_parallel_downloads (PacmanManager *manager, guint value);
+
+guint pacman_manager_get_server_connections (PacmanManager *manager);
+void pacman_manager_set_server_connections (PacmanManager *manager, guint value);
+
 const gchar *pacman_manager_get_architecture (PacmanManager *manager);
 void pacman_manager_set_architecture (PacmanManager *manager, const gchar *architecture);
 
@@ -153,6 +173,7 @@ PacmanTransaction *pacman_manager_update (PacmanManager *manager, guint32 flags,
 
 PacmanList *pacman_manager_find_missing_dependencies (PacmanManager *manager, const PacmanList *remove, const PacmanList *install);
 PacmanList *pacman_manager_test_dependencies (PacmanManager *manager, const PacmanList *dependencies);
+PacmanStatistics *pacman_manager_get_statistics (PacmanManager *manager);
 
 G_END_DECLS
 
@@ -0,0 +1,331 @@
+/* pacman-mirror.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <alpm.h>
+#include "pacman-list.h"
+#include "pacman-private.h"
+
+/* the weight given to each new measurement */
+#define PACMAN_MIRROR_SMOOTHING 0.3
+
+/* mirrors are compared by how long they would take to send a file of this size, in bytes */
+#define PACMAN_MIRROR_SAMPLE_SIZE (1024.0 * 1024.0)
+
+/* a mirror that fails is skipped for this long, doubling with each further failure, in seconds */
+#define PACMAN_MIRROR_BACKOFF 30
+#define PACMAN_MIRROR_BACKOFF_MAX (60 * 60)
+
+/* how often a mirror that has never been tried is put first, so that a better one can be found */
+#define PACMAN_MIRROR_EXPLORATION 0.1
+
+typedef struct {
+	gdouble latency;
+	gdouble throughput;
+	gint64 successes;
+	gint64 failures;
+	gint64 streak;
+	gint64 failed;
+} PacmanMirror;
+
+G_LOCK_DEFINE_STATIC (pacman_mirrors);
+static GHashTable *pacman_mirrors = NULL;
+static gchar *pacman_mirrors_filename = NULL;
+static gboolean pacman_mirrors_changed = FALSE;
+
+gchar *pacman_mirror_get_host (const gchar *url) {
+	const gchar *authority;
+	
+	g_return_val_if_fail (url != NULL, NULL);
+	
+	/* scheme and authority, since mirrors for different repositories usually share a host */
+	authority = strstr (url, "://");
+	if (authority == NULL) {
+		return g_strdup (url);
+	}
+	
+	authority += 3;
+	return g_ascii_strdown (url, authority + strcspn (authority, "/?#") - url);
+}
+
+static void pacman_mirror_free (gpointer data) {
+	g_slice_free (PacmanMirror, data);
+}
+
+static void pacman_mirrors_write (void) {
+	GKeyFile *file;
+	GHashTableIter iter;
+	gpointer key, value;
+	gchar *data;
+	gsize length;
+	GError *error = NULL;
+	
+	/* called with the lock held */
+	if (!pacman_mirrors_changed || pacman_mirrors_filename == NULL) {
+		return;
+	}
+	
+	file = g_key_file_new ();
+	g_hash_table_iter_init (&iter, pacman_mirrors);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		PacmanMirror *mirror = (PacmanMirror *) value;
+		gchar *group;
+		
+		/* group names cannot contain brackets, which IPv6 hosts do */
+		group = g_uri_escape_string ((const gchar *) key, ":/@", FALSE);
+		g_key_file_set_double (file, group, "Latency", mirror->latency);
+		g_key_file_set_double (file, group, "Throughput", mirror->throughput);
+		g_key_file_set_int64 (file, group, "Successes", mirror->successes);
+		g_key_file_set_int64 (file, group, "Failures", mirror->failures);
+		g_key_file_set_int64 (file, group, "Streak", mirror->streak);
+		g_key_file_set_int64 (file, group, "Failed", mirror->failed);
+		g_free (group);
+	}
+	
+	data = g_key_file_to_data (file, &length, NULL);
+	if (!g_file_set_contents (pacman_mirrors_filename, data, length, &error)) {
+		g_debug ("Could not save mirror statistics: %s\n", error->message);
+		g_error_free (error);
+	} else {
+		pacman_mirrors_changed = FALSE;
+	}
+	
+	g_free (data);
+	g_key_file_free (file);
+}
+
+static void pacman_mirrors_read (void) {
+	GKeyFile *file;
+	gchar *filename, **hosts;
+	gsize i, length;
+	
+	/* called with the lock held; the statistics live next to the databases they describe */
+	filename = g_build_filename (alpm_option_get_dbpath (), "mirrors", NULL);
+	if (pacman_mirrors != NULL && g_strcmp0 (filename, pacman_mirrors_filename) == 0) {
+		g_free (filename);
+		return;
+	}
+	
+	if (pacman_mirrors != NULL) {
+		pacman_mirrors_write ();
+		g_hash_table_unref (pacman_mirrors);
+	}
+	
+	g_free (pacman_mirrors_filename);
+	pacman_mirrors_filename = filename;
+	pacman_mirrors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, pacman_mirror_free);
+	pacman_mirrors_changed = FALSE;
+	
+	file = g_key_file_new ();
+	if (!g_key_file_load_from_file (file, filename, G_KEY_FILE_NONE, NULL)) {
+		g_key_file_free (file);
+		return;
+	}
+	
+	hosts = g_key_file_get_groups (file, &length);
+	for (i = 0; i < length; ++i) {
+		PacmanMirror *mirror;
+		gchar *host;
+		
+		host = g_uri_unescape_string (hosts[i], NULL);
+		if (host == NULL) {
+			continue;
+		}
+		
+		mirror = g_slice_new0 (PacmanMirror);
+		mirror->latency = g_key_file_get_double (file, hosts[i], "Latency", NULL);
+		mirror->throughput = g_key_file_get_double (file, hosts[i], "Throughput", NULL);
+		mirror->successes = g_key_file_get_int64 (file, hosts[i], "Successes", NULL);
+		mirror->failures = g_key_file_get_int64 (file, hosts[i], "Failures", NULL);
+		mirror->streak = g_key_file_get_int64 (file, hosts[i], "Streak", NULL);
+		mirror->failed = g_key_file_get_int64 (file, hosts[i], "Failed", NULL);
+		
+		g_hash_table_insert (pacman_mirrors, host, mirror);
+	}
+	
+	g_strfreev (hosts);
+	g_key_file_free (file);
+}
+
+static PacmanMirror *pacman_mirror_lookup (const gchar *url, gboolean create) {
+	PacmanMirror *result;
+	gchar *host;
+	
+	/* called with the lock held */
+	pacman_mirrors_read ();
+	
+	host = pacman_mirror_get_host (url);
+	result = (PacmanMirror *) g_hash_table_lookup (pacman_mirrors, host);
+	if (result == NULL && create) {
+		result = g_slice_new0 (PacmanMirror);
+		g_hash_table_insert (pacman_mirrors, host, result);
+	} else {
+		g_free (host);
+	}
+	
+	return result;
+}
+
+static gdouble pacman_mirror_smooth (gdouble average, gdouble value, gint64 samples) {
+	return (samples == 0) ? value : average + PACMAN_MIRROR_SMOOTHING * (value - average);
+}
+
+void pacman_mirror_record_success (const gchar *url, gint64 latency, guint64 bytes, gint64 time) {
+	PacmanMirror *mirror;
+	
+	g_return_if_fail (url != NULL);
+	
+	G_LOCK (pacman_mirrors);
+	mirror = pacman_mirror_lookup (url, TRUE);
+	
+	if (latency >= 0) {
+		mirror->latency = pacman_mirror_smooth (mirror->latency, (gdouble) latency / G_USEC_PER_SEC, mirror->successes);
+	}
+	
+	/* small files say more about latency than throughput */
+	if (bytes >= 64 * 1024 && time > 0) {
+		gdouble throughput = (gdouble) bytes * G_USEC_PER_SEC / time;
+		mirror->throughput = (mirror->throughput > 0) ? pacman_mirror_smooth (mirror->throughput, throughput, mirror->successes) : throughput;
+	}
+	
+	++mirror->successes;
+	mirror->streak = 0;
+	pacman_mirrors_changed = TRUE;
+	G_UNLOCK (pacman_mirrors);
+}
+
+void pacman_mirror_record_failure (const gchar *url) {
+	PacmanMirror *mirror;
+	
+	g_return_if_fail (url != NULL);
+	
+	G_LOCK (pacman_mirrors);
+	mirror = pacman_mirror_lookup (url, TRUE);
+	
+	++mirror->failures;
+	++mirror->streak;
+	mirror->failed = g_get_real_time () / G_USEC_PER_SEC;
+	pacman_mirrors_changed = TRUE;
+	G_UNLOCK (pacman_mirrors);
+}
+
+static gboolean pacman_mirror_backing_off (PacmanMirror *mirror, gint64 now) {
+	gint64 backoff;
+	
+	if (mirror == NULL || mirror->streak == 0) {
+		return FALSE;
+	}
+	
+	backoff = (mirror->streak > 7) ? PACMAN_MIRROR_BACKOFF_MAX : MIN (PACMAN_MIRROR_BACKOFF << (mirror->streak - 1), PACMAN_MIRROR_BACKOFF_MAX);
+	return now < mirror->failed + backoff;
+}
+
+gboolean pacman_mirror_is_backing_off (const gchar *url) {
+	gboolean result;
+	
+	g_return_val_if_fail (url != NULL, FALSE);
+	
+	G_LOCK (pacman_mirrors);
+	result = pacman_mirror_backing_off (pacman_mirror_lookup (url, FALSE), g_get_real_time () / G_USEC_PER_SEC);
+	G_UNLOCK (pacman_mirrors);
+	
+	return result;
+}
+
+typedef struct {
+	const gchar *url;
+	guint rank;
+	gdouble cost;
+} PacmanMirrorRanking;
+
+static gint pacman_mirror_ranking_compare (gconstpointer a, gconstpointer b) {
+	const PacmanMirrorRanking *first = (const PacmanMirrorRanking *) a, *second = (const PacmanMirrorRanking *) b;
+	
+	if (first->rank != second->rank) {
+		return (first->rank < second->rank) ? -1 : 1;
+	} else if (first->cost != second->cost) {
+		return (first->cost < second->cost) ? -1 : 1;
+	}
+	
+	return 0;
+}
+
+PacmanList *pacman_mirror_sort (PacmanList *urls) {
+	PacmanList *rankings = NULL, *i, *j;
+	PacmanMirrorRanking *untried = NULL;
+	gboolean measured = FALSE;
+	gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+	
+	G_LOCK (pacman_mirrors);
+	for (i = urls; i != NULL; i = pacman_list_next (i)) {
+		PacmanMirrorRanking *ranking = g_slice_new0 (PacmanMirrorRanking);
+		PacmanMirror *mirror;
+		
+		ranking->url = (const gchar *) pacman_list_get (i);
+		mirror = pacman_mirror_lookup (ranking->url, FALSE);
+		
+		/* measured mirrors first, then those never tried in the order given, then those that just failed */
+		if (pacman_mirror_backing_off (mirror, now)) {
+			ranking->rank = 2;
+			ranking->cost = (gdouble) mirror->failed;
+		} else if (mirror == NULL || mirror->successes == 0) {
+			ranking->rank = 1;
+			if (untried == NULL) {
+				untried = ranking;
+			}
+		} else {
+			measured = TRUE;
+			ranking->cost = mirror->latency;
+			if (mirror->throughput > 0) {
+				ranking->cost += PACMAN_MIRROR_SAMPLE_SIZE / mirror->throughput;
+			}
+			
+			/* expected time including retries elsewhere */
+			ranking->cost *= (gdouble) (mirror->successes + mirror->failures) / mirror->successes;
+		}
+		
+		rankings = pacman_list_add (rankings, ranking);
+	}
+	G_UNLOCK (pacman_mirrors);
+	
+	/* otherwise a mirror that is never tried can never be found to be faster */
+	if (measured && untried != NULL && g_random_double () < PACMAN_MIRROR_EXPLORATION) {
+		untried->rank = 0;
+		untried->cost = -1.0;
+	}
+	
+	/* the sort is stable, so ties keep the configured order */
+	rankings = pacman_list_sort (rankings, pacman_mirror_ranking_compare);
+	for (i = urls, j = rankings; i != NULL; i = pacman_list_next (i), j = pacman_list_next (j)) {
+		PacmanMirrorRanking *ranking = (PacmanMirrorRanking *) pacman_list_get (j);
+		pacman_list_set (i, (gpointer) ranking->url);
+		g_slice_free (PacmanMirrorRanking, ranking);
+	}
+	
+	pacman_list_free (rankings);
+	return urls;
+}
+
+void pacman_mirror_save (void) {
+	G_LOCK (pacman_mirrors);
+	if (pacman_mirrors != NULL) {
+		pacman_mirrors_write ();
+	}
+	G_UNLOCK (pacman_mirrors);
+}
@@ -16,11 +16,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <alpm.h>
 #include "pacman-error.h"
 #include "pacman-list.h"
 #include "pacman-database.h"
+#include "pacman-package.h"
 #include "pacman-manager.h"
 #include "pacman-private.h"
 #include "pacman-modify.h"
@@ -124,10 +130,116 @@ static gboolean pacman_modify_prepare (PacmanTransaction *transaction, const Pac
 	return TRUE;
 }
 
+static gchar *pacman_modify_make_desc (const gchar *contents, pmpkgreason_t reason) {
+	GString *result;
+	gchar **lines, **i;
+	gboolean skip = FALSE;
+	
+	g_return_val_if_fail (contents != NULL, NULL);
+	
+	/* same layout as libalpm: explicit packages have no %REASON% section */
+	result = g_string_new ("");
+	lines = g_strsplit (contents, "\n", -1);
+	
+	for (i = lines; *i != NULL; ++i) {
+		if (skip) {
+			skip = (**i != '\0');
+		} else if (g_strcmp0 (*i, "%REASON%") == 0) {
+			skip = TRUE;
+		} else if (*(i + 1) != NULL || **i != '\0') {
+			g_string_append_printf (result, "%s\n", *i);
+		}
+	}
+	g_strfreev (lines);
+	
+	if (reason != PM_PKG_REASON_EXPLICIT) {
+		g_string_append_printf (result, "%%REASON%%\n%u\n\n", (guint) reason);
+	}
+	
+	return g_string_free (result, FALSE);
+}
+
+static gboolean pacman_modify_write (const gchar *filename, const gchar *contents, GError **error) {
+	gsize length = strlen (contents);
+	gint fd;
+	
+	g_return_val_if_fail (filename != NULL, FALSE);
+	g_return_val_if_fail (contents != NULL, FALSE);
+	
+	fd = g_open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), filename, g_strerror (errno));
+		return FALSE;
+	}
+	
+	while (length > 0) {
+		gssize result = write (fd, contents, length);
+		
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			
+			g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), filename, g_strerror (errno));
+			close (fd);
+			return FALSE;
+		}
+		
+		contents += result;
+		length -= (gsize) result;
+	}
+	
+	if (close (fd) < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), filename, g_strerror (errno));
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static gboolean pacman_modify_sync (const gchar *path, GError **error) {
+	gint fd;
+	
+	g_return_val_if_fail (path != NULL, FALSE);
+	
+	/* one flush for the whole database rather than one per package */
+#ifdef HAVE_SYNCFS
+	fd = g_open (path, O_RDONLY | O_DIRECTORY, 0);
+	if (fd < 0 || syncfs (fd) < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), path, g_strerror (errno));
+		if (fd >= 0) {
+			close (fd);
+		}
+		return FALSE;
+	}
+	
+	close (fd);
+#else
+	sync ();
+#endif
+	
+	return TRUE;
+}
+
+static gchar *pacman_modify_get_desc (const gchar *path, PacmanPackage *package) {
+	gchar *directory, *result;
+	
+	g_return_val_if_fail (path != NULL, NULL);
+	g_return_val_if_fail (package != NULL, NULL);
+	
+	directory = g_strdup_printf ("%s-%s", pacman_package_get_name (package), pacman_package_get_version (package));
+	result = g_build_filename (path, directory, "desc", NULL);
+	
+	g_free (directory);
+	return result;
+}
+
 static gboolean pacman_modify_commit (PacmanTransaction *transaction, GError **error) {
-	PacmanList *i, *packages;
+	PacmanList *i, *packages, *changes = NULL;
 	PacmanDatabase *database;
 	pmpkgreason_t reason;
+	gchar *path;
+	gboolean result = TRUE;
 	
 	g_return_val_if_fail (transaction != NULL, FALSE);
 	g_return_val_if_fail (pacman_manager != NULL, FALSE);
@@ -151,15 +263,90 @@ static gboolean pacman_modify_commit (PacmanTransaction *transaction, GError **e
 		return FALSE;
 	}
 	
+	/* check every package before anything is written */
 	for (i = packages; i != NULL; i = pacman_list_next (i)) {
-		const gchar *package = (const gchar *) pacman_list_get (i);
-		if (alpm_db_set_pkgreason (database, package, reason) < 0) {
-			g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not set install reason for package %s: %s"), package, alpm_strerrorlast ());
+		const gchar *name = (const gchar *) pacman_list_get (i);
+		PacmanPackage *package = pacman_database_find_package (database, name);
+		
+		if (package == NULL) {
+			g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_PACKAGE_NOT_FOUND, _("Could not set install reason for package %s: %s"), name, alpm_strerror (PACMAN_ERROR_PACKAGE_NOT_FOUND));
+			pacman_list_free (changes);
 			return FALSE;
+		} else if (alpm_pkg_get_reason (package) != reason) {
+			changes = pacman_list_add (changes, package);
 		}
 	}
 	
-	return TRUE;
+	if (changes == NULL) {
+		return TRUE;
+	}
+	
+	/* write every desc file to a temporary file first, so that a failure leaves the database untouched */
+	path = g_build_filename (alpm_option_get_dbpath (), "local", NULL);
+	
+	for (i = changes; i != NULL && result; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		gchar *filename, *temporary, *contents, *desc;
+		
+		filename = pacman_modify_get_desc (path, package);
+		temporary = g_strconcat (filename, ".tmp", NULL);
+		
+		if (!g_file_get_contents (filename, &contents, NULL, NULL)) {
+			g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DATABASE_UPDATE_FAILED, _("Could not set install reason for package %s: %s"), pacman_package_get_name (package), alpm_strerror (PACMAN_ERROR_DATABASE_UPDATE_FAILED));
+			result = FALSE;
+		} else {
+			desc = pacman_modify_make_desc (contents, reason);
+			result = pacman_modify_write (temporary, desc, error);
+			g_free (desc);
+			g_free (contents);
+		}
+		
+		g_free (temporary);
+		g_free (filename);
+	}
+	
+	/* the new files have to be on disk before they replace the old ones */
+	if (result) {
+		result = pacman_modify_sync (path, error);
+	}
+	
+	for (i = changes; i != NULL; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		gchar *filename, *temporary;
+		
+		filename = pacman_modify_get_desc (path, package);
+		temporary = g_strconcat (filename, ".tmp", NULL);
+		
+		if (!result) {
+			g_unlink (temporary);
+		} else if (g_rename (temporary, filename) < 0) {
+			g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not set install reason for package %s: %s"), pacman_package_get_name (package), g_strerror (errno));
+			g_unlink (temporary);
+			result = FALSE;
+		}
+		
+		g_free (temporary);
+		g_free (filename);
+	}
+	
+	/* makes the renames durable */
+	if (result) {
+		result = pacman_modify_sync (path, error);
+	}
+	
+	/* libalpm can only be told through a call that writes the desc file again, but it writes what is already there */
+	for (i = changes; i != NULL && result; i = pacman_list_next (i)) {
+		const gchar *name = pacman_package_get_name ((PacmanPackage *) pacman_list_get (i));
+		
+		if (alpm_db_set_pkgreason (database, (char *) name, reason) < 0) {
+			g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not set install reason for package %s: %s"), name, alpm_strerrorlast ());
+			result = FALSE;
+		}
+	}
+	
+	g_free (path);
+	pacman_list_free (changes);
+	return result;
 }
 
 static void pacman_modify_class_init (PacmanModifyClass *klass) {
@@ -516,22 +516,9 @@ const gchar *pacman_package_get_md5sum (PacmanPackage *package) {
  * Returns: An MD5 sum, or %NULL if @error is set. Free with g_free().
  */
 gchar *pacman_package_generate_md5sum (const gchar *filename, GError **error) {
-	gchar *result, *temp;
-	
 	g_return_val_if_fail (filename != NULL, NULL);
 	
-	if (alpm_compute_md5sum (filename) == NULL) {
-		g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not generate the MD5 sum of '%s': %s"), filename, alpm_strerrorlast ());
-		return NULL;
-	}
-	
-	if (!g_mem_is_system_malloc ()) {
-		temp = result;
-		result = g_strdup (result);
-		free (temp);
-	}
-	
-	return result;
+	return pacman_checksum_file (filename, error);
 }
 
 /**
@@ -20,20 +20,160 @@
 #define __PACMAN_PRIVATE_H__
 
 #include <glib.h>
+#include <gio/gio.h>
 #include "pacman-types.h"
+#include "pacman-dependency.h"
+#include "pacman-statistics.h"
 #include "pacman-transaction.h"
 
+#ifdef PACMAN_ENABLE_PROBES
+/* probes are only fired while a tracer has them attached, see pacman-probes.c */
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#endif
+
 G_BEGIN_DECLS
 
+/* static probes under the pacman_glib provider, see --enable-probes */
+#ifdef PACMAN_ENABLE_PROBES
+extern volatile unsigned short pacman_glib_database__register_semaphore;
+extern volatile unsigned short pacman_glib_database__search_semaphore;
+extern volatile unsigned short pacman_glib_database__update__start_semaphore;
+extern volatile unsigned short pacman_glib_database__update__done_semaphore;
+extern volatile unsigned short pacman_glib_fetch__start_semaphore;
+extern volatile unsigned short pacman_glib_fetch__done_semaphore;
+extern volatile unsigned short pacman_glib_transaction__start_semaphore;
+extern volatile unsigned short pacman_glib_transaction__end_semaphore;
+extern volatile unsigned short pacman_glib_transaction__status_semaphore;
+extern volatile unsigned short pacman_glib_transaction__progress_semaphore;
+extern volatile unsigned short pacman_glib_transaction__download_semaphore;
+
+/* the arguments are not evaluated unless the probe is enabled */
+#define PACMAN_PROBE_ENABLED(name) G_UNLIKELY (pacman_glib_##name##_semaphore != 0)
+#define PACMAN_PROBE(name) G_STMT_START { if (PACMAN_PROBE_ENABLED (name)) { DTRACE_PROBE (pacman_glib, name); } } G_STMT_END
+#define PACMAN_PROBE1(name, a) G_STMT_START { if (PACMAN_PROBE_ENABLED (name)) { DTRACE_PROBE1 (pacman_glib, name, a); } } G_STMT_END
+#define PACMAN_PROBE2(name, a, b) G_STMT_START { if (PACMAN_PROBE_ENABLED (name)) { DTRACE_PROBE2 (pacman_glib, name, a, b); } } G_STMT_END
+#define PACMAN_PROBE3(name, a, b, c) G_STMT_START { if (PACMAN_PROBE_ENABLED (name)) { DTRACE_PROBE3 (pacman_glib, name, a, b, c); } } G_STMT_END
+#else
+#define PACMAN_PROBE_ENABLED(name) FALSE
+#define PACMAN_PROBE(name)
+#define PACMAN_PROBE1(name, a)
+#define PACMAN_PROBE2(name, a, b)
+#define PACMAN_PROBE3(name, a, b, c)
+#endif
+
+
+gchar *pacman_checksum_file (const gchar *filename, GError **error);
+void pacman_checksum_remember (const gchar *filename, const gchar *md5sum);
+void pacman_checksum_prefetch (const gchar *filename);
+gchar *pacman_checksum_lookup (const gchar *filename);
+gchar *pacman_checksum_get (const gchar *filename);
+gchar *pacman_checksum_keep (const gchar *filename);
+gboolean pacman_checksum_unchanged (const gchar *kept, const gchar *filename);
+void pacman_checksum_discard (gchar *kept);
+
+PacmanConflict *pacman_conflict_new (const gchar *first, const gchar *second, const gchar *reason);
 void pacman_conflict_free (PacmanConflict *conflict);
 void pacman_dependency_free (PacmanDependency *dependency);
+PacmanPackage *pacman_dependency_find_satisfier (PacmanDatabase *database, const gchar *dependency);
+void pacman_dependency_invalidate (void);
+
+typedef struct {
+	const gchar *name;
+	gsize length;
+	PacmanDependencyCompare compare;
+	const gchar *version;
+} PacmanDependencyPredicate;
+
+void pacman_dependency_compile (PacmanDependency *dependency, PacmanDependencyPredicate *predicate);
+void pacman_dependency_compile_string (const gchar *dependency, PacmanDependencyPredicate *predicate);
+gboolean pacman_dependency_predicate_compare (const PacmanDependencyPredicate *predicate, const gchar *version);
+gboolean pacman_dependency_predicate_matches (const PacmanDependencyPredicate *predicate, PacmanPackage *package);
+
+
+void pacman_database_forget_servers (PacmanDatabase *database);
+void pacman_database_forget_generations (PacmanDatabase *database);
+void pacman_database_expect_update (PacmanDatabase *database);
+gboolean pacman_database_is_updating (void);
+void pacman_database_begin_update (void);
+void pacman_database_end_update (gboolean changed);
+
+gchar *pacman_mirror_get_host (const gchar *url);
+void pacman_mirror_record_success (const gchar *url, gint64 latency, guint64 bytes, gint64 time);
+void pacman_mirror_record_failure (const gchar *url);
+gboolean pacman_mirror_is_backing_off (const gchar *url);
+PacmanList *pacman_mirror_sort (PacmanList *urls);
+void pacman_mirror_save (void);
+
 void pacman_file_conflict_free (PacmanFileConflict *conflict);
 
+typedef enum {
+	PACMAN_STATISTIC_DATABASE_LOADS,
+	PACMAN_STATISTIC_SEARCHES,
+	PACMAN_STATISTIC_LOOKUPS,
+	PACMAN_STATISTIC_DEPENDENCY_CHECKS,
+	PACMAN_STATISTIC_DEPENDENCY_CACHE_HITS,
+	PACMAN_STATISTIC_SIGNAL_EMISSIONS,
+	PACMAN_STATISTIC_ALLOCATIONS,
+	PACMAN_STATISTIC_LAST
+} PacmanStatistic;
+
+void pacman_statistics_count (PacmanStatistic statistic);
+gboolean pacman_statistics_database_loaded (PacmanDatabase *database);
+void pacman_statistics_record_database_load (PacmanDatabase *database, gint64 time);
+void pacman_statistics_forget_databases (void);
+void pacman_statistics_record_phase (PacmanTransactionStatus status, gint64 time);
+void pacman_statistics_record_transfer (const gchar *server, guint64 bytes);
+PacmanStatistics *pacman_statistics_get (void);
+
+void pacman_log_buffer_start (guint size);
+void pacman_log_buffer_stop (void);
+gboolean pacman_log_buffer_push (GLogLevelFlags level, const gchar *format, va_list args);
+
+typedef struct _PacmanLogJournal PacmanLogJournal;
+
+PacmanLogJournal *pacman_log_journal_open (void);
+void pacman_log_journal_append (PacmanLogJournal *journal, const gchar *format, ...) G_GNUC_PRINTF (2, 3);
+void pacman_log_journal_commit (PacmanLogJournal *journal);
+void pacman_log_journal_close (PacmanLogJournal *journal);
+
+typedef void (*PacmanTransferProgressFunc) (const gchar *filename, guint64 complete, guint64 total, gpointer user_data);
+
+gint pacman_transfer_download (const gchar *url, const gchar *path, gboolean force, PacmanTransferProgressFunc func, gpointer user_data, GCancellable *cancellable, GError **error);
+
+typedef struct _PacmanTransferCommand PacmanTransferCommand;
+
+PacmanTransferCommand *pacman_transfer_command_new (const gchar *command, GError **error);
+void pacman_transfer_command_free (PacmanTransferCommand *command);
+gint pacman_transfer_command_run (PacmanTransferCommand *command, const gchar *url, const gchar *path, gboolean force, GError **error);
+
+typedef struct {
+	PacmanList *urls;
+	gchar *path;
+	gboolean force;
+	
+	/* if known, large files can be fetched from several mirrors at once and checked afterwards */
+	guint64 size;
+	gchar *md5sum;
+	
+	gint result;
+	GError *error;
+} PacmanTransferJob;
+
+PacmanTransferJob *pacman_transfer_job_new (const gchar *path, gboolean force);
+void pacman_transfer_job_free (PacmanTransferJob *job);
+void pacman_transfer_download_all (const PacmanList *jobs, guint parallel, guint connections, PacmanTransferCommand *command, PacmanTransferProgressFunc func, gpointer user_data, GCancellable *cancellable);
+
 extern PacmanManager *pacman_manager;
 
 PacmanTransaction *pacman_manager_new_transaction (PacmanManager *manager, GType type);
+gboolean pacman_manager_download (PacmanManager *manager, const PacmanList *jobs, guint64 total);
+void pacman_manager_remember_fetch (PacmanManager *manager, const gchar *filename, gint status);
+void pacman_manager_forget_fetches (PacmanManager *manager);
 gboolean pacman_transaction_ask (PacmanTransaction *transaction, PacmanTransactionQuestion question, const gchar *format, ...);
 void pacman_transaction_tell (PacmanTransaction *transaction, PacmanTransactionStatus status, const gchar *format, ...);
+void pacman_transaction_download (PacmanTransaction *transaction, const gchar *filename, guint complete, guint total);
+void pacman_transaction_set_repository (PacmanTransaction *transaction, const gchar *name);
 
 gboolean pacman_transaction_start (guint32 flags, GError **error);
 gboolean pacman_transaction_end (GError **error);
@@ -0,0 +1,38 @@
+/* pacman-probes.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pacman-private.h"
+
+#ifdef PACMAN_ENABLE_PROBES
+
+/* tracers find these through the probe notes, and count themselves in and out while attached */
+#define PACMAN_PROBE_SEMAPHORE(name) volatile unsigned short pacman_glib_##name##_semaphore __attribute__ ((unused)) __attribute__ ((section (".probes"))) = 0
+
+PACMAN_PROBE_SEMAPHORE (database__register);
+PACMAN_PROBE_SEMAPHORE (database__search);
+PACMAN_PROBE_SEMAPHORE (database__update__start);
+PACMAN_PROBE_SEMAPHORE (database__update__done);
+PACMAN_PROBE_SEMAPHORE (fetch__start);
+PACMAN_PROBE_SEMAPHORE (fetch__done);
+PACMAN_PROBE_SEMAPHORE (transaction__start);
+PACMAN_PROBE_SEMAPHORE (transaction__end);
+PACMAN_PROBE_SEMAPHORE (transaction__status);
+PACMAN_PROBE_SEMAPHORE (transaction__progress);
+PACMAN_PROBE_SEMAPHORE (transaction__download);
+
+#endif
@@ -0,0 +1,531 @@
+/* pacman-queue.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n-lib.h>
+#include <alpm.h>
+#include "pacman-error.h"
+#include "pacman-list.h"
+#include "pacman-manager.h"
+#include "pacman-transaction.h"
+#include "pacman-private.h"
+#include "pacman-queue.h"
+
+/**
+ * SECTION:pacman-queue
+ * @title: PacmanQueue
+ * @short_description: Batch transaction requests
+ *
+ * A #PacmanQueue collects transaction requests from several clients and carries them out together. Requests pushed within a short window of each other are combined into a single transaction if they are of the same type and have the same flags, so that the databases are only locked, loaded and resolved once. Requests that cannot be combined are run in separate transactions, in the order they were pushed. If a combined transaction cannot be prepared, its requests are retried one at a time, so that each caller gets its own result.
+ */
+
+/**
+ * PacmanQueue:
+ *
+ * Represents a queue of transaction requests.
+ */
+
+#define PACMAN_QUEUE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), PACMAN_TYPE_QUEUE, PacmanQueuePrivate))
+
+G_DEFINE_TYPE (PacmanQueue, pacman_queue, G_TYPE_OBJECT);
+
+typedef struct {
+	GType type;
+	guint32 flags;
+	PacmanList *targets;
+	GTask *task;
+} PacmanQueueRequest;
+
+typedef struct _PacmanQueuePrivate {
+	PacmanManager *manager;
+	GMainContext *context;
+	guint window;
+	
+	GQueue pending;
+	GQueue retry;
+	GSource *timeout;
+	
+	PacmanTransaction *transaction;
+	GList *batch;
+	PacmanList *targets;
+} PacmanQueuePrivate;
+
+static void pacman_queue_request_free (PacmanQueueRequest *request) {
+	g_return_if_fail (request != NULL);
+	
+	pacman_list_free_full (request->targets, g_free);
+	g_object_unref (request->task);
+	g_slice_free (PacmanQueueRequest, request);
+}
+
+static void pacman_queue_init (PacmanQueue *queue) {
+	PacmanQueuePrivate *priv;
+	
+	g_return_if_fail (queue != NULL);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	priv->context = g_main_context_ref_thread_default ();
+	priv->window = 50;
+	g_queue_init (&priv->pending);
+	g_queue_init (&priv->retry);
+}
+
+static void pacman_queue_finalize (GObject *object) {
+	PacmanQueuePrivate *priv;
+	
+	g_return_if_fail (object != NULL);
+	
+	/* every request holds a reference through its task, so there is nothing left to run */
+	priv = PACMAN_QUEUE_GET_PRIVATE (PACMAN_QUEUE (object));
+	if (priv->timeout != NULL) {
+		g_source_destroy (priv->timeout);
+		g_source_unref (priv->timeout);
+	}
+	
+	g_main_context_unref (priv->context);
+	g_object_unref (priv->manager);
+	
+	G_OBJECT_CLASS (pacman_queue_parent_class)->finalize (object);
+}
+
+/**
+ * pacman_queue_new:
+ * @manager: A #PacmanManager.
+ *
+ * Creates a queue that runs transactions through @manager. Transactions are prepared and committed in separate threads, with signals emitted in the thread-default main context of the caller, which must be running for requests to finish.
+ *
+ * Returns: A #PacmanQueue. Free with g_object_unref().
+ */
+PacmanQueue *pacman_queue_new (PacmanManager *manager) {
+	PacmanQueue *queue;
+	
+	g_return_val_if_fail (manager != NULL, NULL);
+	
+	queue = PACMAN_QUEUE (g_object_new (PACMAN_TYPE_QUEUE, NULL));
+	PACMAN_QUEUE_GET_PRIVATE (queue)->manager = g_object_ref (manager);
+	return queue;
+}
+
+/**
+ * pacman_queue_get_window:
+ * @queue: A #PacmanQueue.
+ *
+ * Gets how long @queue waits for more requests after one is pushed to an idle queue. Requests pushed while a transaction is running are combined regardless. See #PacmanQueue:window.
+ *
+ * Returns: A number of milliseconds.
+ */
+guint pacman_queue_get_window (PacmanQueue *queue) {
+	PacmanQueuePrivate *priv;
+	
+	g_return_val_if_fail (queue != NULL, 0);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	return priv->window;
+}
+
+/**
+ * pacman_queue_set_window:
+ * @queue: A #PacmanQueue.
+ * @value: A number of milliseconds.
+ *
+ * Sets the window to @value. See pacman_queue_get_window().
+ */
+void pacman_queue_set_window (PacmanQueue *queue, guint value) {
+	PacmanQueuePrivate *priv;
+	
+	g_return_if_fail (queue != NULL);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	if (priv->window != value) {
+		priv->window = value;
+		g_object_notify (G_OBJECT (queue), "window");
+	}
+}
+
+enum {
+	SIGNAL_TRANSACTION,
+	SIGNAL_LAST
+};
+
+static guint queue_signals[SIGNAL_LAST] = { 0 };
+
+static void pacman_queue_schedule (PacmanQueue *queue, guint delay);
+
+static gboolean pacman_queue_request_touches (PacmanQueueRequest *request, GHashTable *targets) {
+	const PacmanList *i;
+	
+	g_return_val_if_fail (request != NULL, FALSE);
+	g_return_val_if_fail (targets != NULL, FALSE);
+	
+	for (i = request->targets; i != NULL; i = pacman_list_next (i)) {
+		if (g_hash_table_contains (targets, pacman_list_get (i))) {
+			return TRUE;
+		}
+	}
+	
+	return FALSE;
+}
+
+static void pacman_queue_request_mark (PacmanQueueRequest *request, GHashTable *targets) {
+	const PacmanList *i;
+	
+	g_return_if_fail (request != NULL);
+	g_return_if_fail (targets != NULL);
+	
+	for (i = request->targets; i != NULL; i = pacman_list_next (i)) {
+		g_hash_table_add (targets, pacman_list_get (i));
+	}
+}
+
+static GList *pacman_queue_take_batch (PacmanQueue *queue) {
+	PacmanQueuePrivate *priv;
+	PacmanQueueRequest *first;
+	GHashTable *skipped;
+	GList *batch, *i;
+	
+	g_return_val_if_fail (queue != NULL, NULL);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	if (!g_queue_is_empty (&priv->retry)) {
+		return g_list_prepend (NULL, g_queue_pop_head (&priv->retry));
+	}
+	
+	for (i = priv->pending.head; i != NULL;) {
+		PacmanQueueRequest *request = (PacmanQueueRequest *) i->data;
+		GList *next = i->next;
+		
+		if (g_task_return_error_if_cancelled (request->task)) {
+			g_queue_delete_link (&priv->pending, i);
+			pacman_queue_request_free (request);
+		}
+		
+		i = next;
+	}
+	
+	first = (PacmanQueueRequest *) g_queue_pop_head (&priv->pending);
+	if (first == NULL) {
+		return NULL;
+	}
+	
+	batch = g_list_prepend (NULL, first);
+	if (first->targets == NULL) {
+		/* an empty request means something different to each type, such as a full upgrade */
+		return batch;
+	}
+	
+	/* a request cannot overtake an earlier one that it was not combined with if they have a target in common */
+	skipped = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = priv->pending.head; i != NULL;) {
+		PacmanQueueRequest *request = (PacmanQueueRequest *) i->data;
+		GList *next = i->next;
+		
+		if (request->type == first->type && request->flags == first->flags && request->targets != NULL && !pacman_queue_request_touches (request, skipped)) {
+			g_queue_delete_link (&priv->pending, i);
+			batch = g_list_prepend (batch, request);
+		} else {
+			pacman_queue_request_mark (request, skipped);
+		}
+		
+		i = next;
+	}
+	g_hash_table_unref (skipped);
+	
+	return g_list_reverse (batch);
+}
+
+static void pacman_queue_finish_batch (PacmanQueue *queue, const GError *error) {
+	PacmanQueuePrivate *priv;
+	GList *i;
+	
+	g_return_if_fail (queue != NULL);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	for (i = priv->batch; i != NULL; i = i->next) {
+		PacmanQueueRequest *request = (PacmanQueueRequest *) i->data;
+		
+		if (error == NULL) {
+			g_task_return_boolean (request->task, TRUE);
+		} else {
+			g_task_return_error (request->task, g_error_copy (error));
+		}
+		
+		pacman_queue_request_free (request);
+	}
+	
+	g_list_free (priv->batch);
+	priv->batch = NULL;
+	
+	pacman_list_free (priv->targets);
+	priv->targets = NULL;
+	
+	if (priv->transaction != NULL) {
+		g_object_unref (priv->transaction);
+		priv->transaction = NULL;
+	}
+	
+	pacman_queue_schedule (queue, 0);
+}
+
+static void pacman_queue_committed (GObject *source, GAsyncResult *result, gpointer data) {
+	PacmanQueue *queue = PACMAN_QUEUE (data);
+	GError *error = NULL;
+	
+	/* some requests may have been carried out already, so retrying them separately is not safe */
+	pacman_transaction_commit_finish (PACMAN_TRANSACTION (source), result, &error);
+	pacman_queue_finish_batch (queue, error);
+	
+	g_clear_error (&error);
+	g_object_unref (queue);
+}
+
+static void pacman_queue_prepared (GObject *source, GAsyncResult *result, gpointer data) {
+	PacmanQueue *queue = PACMAN_QUEUE (data);
+	PacmanQueuePrivate *priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	GError *error = NULL;
+	
+	if (pacman_transaction_prepare_finish (PACMAN_TRANSACTION (source), result, &error)) {
+		pacman_transaction_commit_async (PACMAN_TRANSACTION (source), NULL, pacman_queue_committed, queue);
+		return;
+	}
+	
+	if (priv->batch != NULL && priv->batch->next != NULL) {
+		/* find out which requests were to blame by running them one at a time */
+		GList *i;
+		
+		for (i = g_list_last (priv->batch); i != NULL; i = i->prev) {
+			g_queue_push_head (&priv->retry, i->data);
+		}
+		
+		g_list_free (priv->batch);
+		priv->batch = NULL;
+		pacman_queue_finish_batch (queue, NULL);
+	} else {
+		pacman_queue_finish_batch (queue, error);
+	}
+	
+	g_clear_error (&error);
+	g_object_unref (queue);
+}
+
+static void pacman_queue_run (PacmanQueue *queue) {
+	PacmanQueuePrivate *priv;
+	PacmanQueueRequest *first;
+	GHashTable *seen;
+	GError *error = NULL;
+	GList *i;
+	
+	g_return_if_fail (queue != NULL);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	if (priv->batch != NULL) {
+		return;
+	}
+	
+	priv->batch = pacman_queue_take_batch (queue);
+	if (priv->batch == NULL) {
+		return;
+	}
+	
+	/* requests for the same target are merged, and both get the result */
+	seen = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = priv->batch; i != NULL; i = i->next) {
+		PacmanQueueRequest *request = (PacmanQueueRequest *) i->data;
+		const PacmanList *j;
+		
+		for (j = request->targets; j != NULL; j = pacman_list_next (j)) {
+			gchar *target = (gchar *) pacman_list_get (j);
+			
+			if (!g_hash_table_contains (seen, target)) {
+				g_hash_table_add (seen, target);
+				priv->targets = pacman_list_add (priv->targets, target);
+			}
+		}
+	}
+	g_hash_table_unref (seen);
+	
+	first = (PacmanQueueRequest *) priv->batch->data;
+	if (!pacman_transaction_start (first->flags, &error)) {
+		pacman_queue_finish_batch (queue, error);
+		g_error_free (error);
+		return;
+	}
+	
+	/* this fails if the local database has not been registered */
+	priv->transaction = pacman_manager_new_transaction (priv->manager, first->type);
+	if (priv->transaction == NULL) {
+		PacmanError code = PACMAN_ERROR_DATABASE_NOT_INITIALIZED;
+		g_set_error (&error, PACMAN_ERROR, code, _("Could not initialize transaction: %s"), alpm_strerror (code));
+		
+		pacman_transaction_end (NULL);
+		pacman_queue_finish_batch (queue, error);
+		g_error_free (error);
+		return;
+	}
+	
+	g_signal_emit (queue, queue_signals[SIGNAL_TRANSACTION], 0, priv->transaction);
+	pacman_transaction_prepare_async (priv->transaction, priv->targets, NULL, pacman_queue_prepared, g_object_ref (queue));
+}
+
+static gboolean pacman_queue_timeout (gpointer data) {
+	PacmanQueue *queue = PACMAN_QUEUE (data);
+	PacmanQueuePrivate *priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	
+	g_source_unref (priv->timeout);
+	priv->timeout = NULL;
+	
+	pacman_queue_run (queue);
+	return FALSE;
+}
+
+static void pacman_queue_schedule (PacmanQueue *queue, guint delay) {
+	PacmanQueuePrivate *priv;
+	
+	g_return_if_fail (queue != NULL);
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	if (priv->timeout != NULL || priv->batch != NULL) {
+		return;
+	}
+	
+	if (g_queue_is_empty (&priv->pending) && g_queue_is_empty (&priv->retry)) {
+		return;
+	}
+	
+	priv->timeout = (delay > 0) ? g_timeout_source_new (delay) : g_idle_source_new ();
+	g_source_set_callback (priv->timeout, pacman_queue_timeout, queue, NULL);
+	g_source_attach (priv->timeout, priv->context);
+}
+
+/**
+ * pacman_queue_push_async:
+ * @queue: A #PacmanQueue.
+ * @type: The #GType of a transaction, such as #PACMAN_TYPE_INSTALL, #PACMAN_TYPE_REMOVE, #PACMAN_TYPE_SYNC or #PACMAN_TYPE_MODIFY.
+ * @flags: A set of #PacmanTransactionFlags.
+ * @targets: A list of strings, as passed to pacman_transaction_prepare().
+ * @cancellable: A #GCancellable, or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the request has been carried out.
+ * @user_data: The data to pass to @callback.
+ *
+ * Adds a request to @queue. It will be carried out in a transaction of type @type, possibly along with other requests. Cancelling @cancellable only has an effect before the transaction is started.
+ */
+void pacman_queue_push_async (PacmanQueue *queue, GType type, guint32 flags, const PacmanList *targets, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+	PacmanQueuePrivate *priv;
+	PacmanQueueRequest *request;
+	const PacmanList *i;
+	
+	g_return_if_fail (queue != NULL);
+	g_return_if_fail (g_type_is_a (type, PACMAN_TYPE_TRANSACTION));
+	
+	priv = PACMAN_QUEUE_GET_PRIVATE (queue);
+	
+	request = g_slice_new0 (PacmanQueueRequest);
+	request->type = type;
+	request->flags = flags;
+	for (i = targets; i != NULL; i = pacman_list_next (i)) {
+		request->targets = pacman_list_add (request->targets, g_strdup ((const gchar *) pacman_list_get (i)));
+	}
+	
+	request->task = g_task_new (queue, cancellable, callback, user_data);
+	g_task_set_source_tag (request->task, pacman_queue_push_async);
+	
+	g_queue_push_tail (&priv->pending, request);
+	pacman_queue_schedule (queue, priv->window);
+}
+
+/**
+ * pacman_queue_push_finish:
+ * @queue: A #PacmanQueue.
+ * @result: The #GAsyncResult passed to the callback of pacman_queue_push_async().
+ * @error: A #GError, or %NULL.
+ *
+ * Finishes a request started with pacman_queue_push_async().
+ *
+ * Returns: %TRUE if the request was carried out, or %FALSE if @error is set.
+ */
+gboolean pacman_queue_push_finish (PacmanQueue *queue, GAsyncResult *result, GError **error) {
+	g_return_val_if_fail (queue != NULL, FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, queue), FALSE);
+	
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+enum {
+	PROP_0,
+	PROP_WINDOW
+};
+
+static void pacman_queue_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+	g_return_if_fail (object != NULL);
+	g_return_if_fail (value != NULL);
+	
+	PacmanQueue *queue;
+	queue = PACMAN_QUEUE (object);
+	
+	switch (prop_id) {
+		case PROP_WINDOW:
+			g_value_set_uint (value, pacman_queue_get_window (queue));
+			break;
+		
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void pacman_queue_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+	g_return_if_fail (object != NULL);
+	g_return_if_fail (value != NULL);
+	
+	PacmanQueue *queue;
+	queue = PACMAN_QUEUE (object);
+	
+	switch (prop_id) {
+		case PROP_WINDOW:
+			pacman_queue_set_window (queue, g_value_get_uint (value));
+			break;
+		
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void pacman_queue_class_init (PacmanQueueClass *klass) {
+	g_return_if_fail (klass != NULL);
+	
+	g_type_class_add_private (klass, sizeof (PacmanQueuePrivate));
+	
+	G_OBJECT_CLASS (klass)->get_property = pacman_queue_get_property;
+	G_OBJECT_CLASS (klass)->set_property = pacman_queue_set_property;
+	G_OBJECT_CLASS (klass)->finalize = pacman_queue_finalize;
+	
+	/**
+	 * PacmanQueue:window:
+	 *
+	 * The number of milliseconds to wait for more requests before starting a transaction.
+	 */
+	g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_WINDOW, g_param_spec_uint ("window", _("Window"), _("time to wait for more requests"), 0, G_MAXUINT, 50, G_PARAM_STATIC_NAME | G_PARAM_READWRITE));
+	
+	/**
+	 * PacmanQueue::transaction:
+	 * @queue: The queue that started the transaction.
+	 * @transaction: A #PacmanTransaction.
+	 *
+	 * Emitted when @queue starts @transaction, before it is prepared. Connect to the signals of @transaction here to follow its progress and answer its questions.
+	 */
+	queue_signals[SIGNAL_TRANSACTION] = g_signal_new ("transaction", PACMAN_TYPE_QUEUE, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__OBJECT, G_TYPE_NONE, 1, PACMAN_TYPE_TRANSACTION);
+}
@@ -0,0 +1,60 @@
+/* pacman-queue.h
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__PACMAN_H_INSIDE__) && !defined (PACMAN_COMPILATION)
+#error "Only <pacman.h> can be included directly."
+#endif
+
+#ifndef __PACMAN_QUEUE_H__
+#define __PACMAN_QUEUE_H__
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+#include "pacman-types.h"
+
+G_BEGIN_DECLS
+
+#define PACMAN_TYPE_QUEUE (pacman_queue_get_type ())
+#define PACMAN_QUEUE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), PACMAN_TYPE_QUEUE, PacmanQueue))
+#define PACMAN_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), PACMAN_TYPE_QUEUE, PacmanQueueClass))
+#define PACMAN_IS_QUEUE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PACMAN_TYPE_QUEUE))
+#define PACMAN_IS_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), PACMAN_TYPE_QUEUE))
+#define PACMAN_QUEUE_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), PACMAN_TYPE_QUEUE, PacmanQueueClass))
+
+struct _PacmanQueue {
+	GObject parent_instance;
+};
+
+typedef struct _PacmanQueueClass {
+	GObjectClass parent_class;
+} PacmanQueueClass;
+
+GType pacman_queue_get_type (void);
+
+PacmanQueue *pacman_queue_new (PacmanManager *manager);
+
+guint pacman_queue_get_window (PacmanQueue *queue);
+void pacman_queue_set_window (PacmanQueue *queue, guint value);
+
+void pacman_queue_push_async (PacmanQueue *queue, GType type, guint32 flags, const PacmanList *targets, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+gboolean pacman_queue_push_finish (PacmanQueue *queue, GAsyncResult *result, GError **error);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,234 @@
+/* pacman-statistics.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "pacman-list.h"
+#include "pacman-private.h"
+#include "pacman-statistics.h"
+
+/**
+ * SECTION:pacman-statistics
+ * @title: PacmanStatistics
+ * @short_description: Performance counters
+ *
+ * A #PacmanStatistics is a snapshot of counters and timings that the library keeps about itself, obtained using pacman_manager_get_statistics().
+ */
+
+/* counters are gsize so that they can be updated with g_atomic_pointer_add() */
+typedef struct {
+	volatile gsize count;
+	volatile gsize total;
+	volatile gsize buckets[PACMAN_HISTOGRAM_BUCKETS];
+} PacmanHistogramCounters;
+
+static volatile gsize pacman_statistics_counters[PACMAN_STATISTIC_LAST] = { 0 };
+static PacmanHistogramCounters pacman_statistics_database_load_time = { 0 };
+static PacmanHistogramCounters pacman_statistics_phase_time[PACMAN_TRANSACTION_STATUS_LAST] = { { 0 } };
+
+/* one flag per database, read without a lock since every accessor checks it */
+typedef struct _PacmanDatabaseLoaded PacmanDatabaseLoaded;
+
+struct _PacmanDatabaseLoaded {
+	PacmanDatabase *database;
+	volatile gint loaded;
+	PacmanDatabaseLoaded *next;
+};
+
+G_LOCK_DEFINE_STATIC (pacman_statistics);
+static PacmanDatabaseLoaded * volatile pacman_statistics_loaded = NULL;
+static GHashTable *pacman_statistics_transfers = NULL;
+
+void pacman_statistics_count (PacmanStatistic statistic) {
+	g_return_if_fail (statistic < PACMAN_STATISTIC_LAST);
+	
+	g_atomic_pointer_add (&pacman_statistics_counters[statistic], 1);
+}
+
+static void pacman_histogram_counters_add (PacmanHistogramCounters *counters, gint64 time) {
+	guint bucket = 0;
+	
+	g_return_if_fail (counters != NULL);
+	
+	if (time < 0) {
+		time = 0;
+	}
+	
+	for (; time > 0 && bucket < PACMAN_HISTOGRAM_BUCKETS - 1; time >>= 1) {
+		++bucket;
+	}
+	
+	g_atomic_pointer_add (&counters->count, 1);
+	g_atomic_pointer_add (&counters->total, (gssize) time);
+	g_atomic_pointer_add (&counters->buckets[bucket], 1);
+}
+
+static void pacman_histogram_counters_get (PacmanHistogramCounters *counters, PacmanHistogram *histogram) {
+	guint i;
+	
+	g_return_if_fail (counters != NULL);
+	g_return_if_fail (histogram != NULL);
+	
+	histogram->count = (guint64) (gsize) g_atomic_pointer_get (&counters->count);
+	histogram->total = (guint64) (gsize) g_atomic_pointer_get (&counters->total);
+	for (i = 0; i < PACMAN_HISTOGRAM_BUCKETS; ++i) {
+		histogram->buckets[i] = (guint64) (gsize) g_atomic_pointer_get (&counters->buckets[i]);
+	}
+}
+
+static PacmanDatabaseLoaded *pacman_database_loaded_find (PacmanDatabase *database) {
+	PacmanDatabaseLoaded *i;
+	
+	g_return_val_if_fail (database != NULL, NULL);
+	
+	/* nodes are only ever prepended, and are kept until the library is unloaded */
+	for (i = (PacmanDatabaseLoaded *) g_atomic_pointer_get (&pacman_statistics_loaded); i != NULL; i = i->next) {
+		if (i->database == database) {
+			return i;
+		}
+	}
+	
+	return NULL;
+}
+
+gboolean pacman_statistics_database_loaded (PacmanDatabase *database) {
+	PacmanDatabaseLoaded *node;
+	
+	g_return_val_if_fail (database != NULL, FALSE);
+	
+	node = pacman_database_loaded_find (database);
+	return node != NULL && g_atomic_int_get (&node->loaded);
+}
+
+void pacman_statistics_record_database_load (PacmanDatabase *database, gint64 time) {
+	PacmanDatabaseLoaded *node;
+	
+	g_return_if_fail (database != NULL);
+	
+	node = pacman_database_loaded_find (database);
+	if (node == NULL) {
+		G_LOCK (pacman_statistics);
+		node = pacman_database_loaded_find (database);
+		if (node == NULL) {
+			node = g_new0 (PacmanDatabaseLoaded, 1);
+			node->database = database;
+			node->next = (PacmanDatabaseLoaded *) pacman_statistics_loaded;
+			g_atomic_pointer_set (&pacman_statistics_loaded, node);
+		}
+		G_UNLOCK (pacman_statistics);
+	}
+	
+	g_atomic_int_set (&node->loaded, TRUE);
+	
+	pacman_statistics_count (PACMAN_STATISTIC_DATABASE_LOADS);
+	pacman_histogram_counters_add (&pacman_statistics_database_load_time, time);
+}
+
+void pacman_statistics_forget_databases (void) {
+	PacmanDatabaseLoaded *i;
+	
+	/* a database registered later may reuse the address of one that was freed */
+	for (i = (PacmanDatabaseLoaded *) g_atomic_pointer_get (&pacman_statistics_loaded); i != NULL; i = i->next) {
+		g_atomic_int_set (&i->loaded, FALSE);
+	}
+}
+
+void pacman_statistics_record_phase (PacmanTransactionStatus status, gint64 time) {
+	g_return_if_fail (status < PACMAN_TRANSACTION_STATUS_LAST);
+	
+	pacman_histogram_counters_add (&pacman_statistics_phase_time[status], time);
+}
+
+void pacman_statistics_record_transfer (const gchar *server, guint64 bytes) {
+	PacmanTransferStatistics *transfer;
+	
+	g_return_if_fail (server != NULL);
+	
+	G_LOCK (pacman_statistics);
+	
+	if (pacman_statistics_transfers == NULL) {
+		pacman_statistics_transfers = g_hash_table_new (g_str_hash, g_str_equal);
+	}
+	
+	transfer = (PacmanTransferStatistics *) g_hash_table_lookup (pacman_statistics_transfers, server);
+	if (transfer == NULL) {
+		transfer = g_new0 (PacmanTransferStatistics, 1);
+		transfer->server = g_strdup (server);
+		g_hash_table_insert (pacman_statistics_transfers, transfer->server, transfer);
+	}
+	
+	transfer->bytes += bytes;
+	++transfer->files;
+	
+	G_UNLOCK (pacman_statistics);
+}
+
+PacmanStatistics *pacman_statistics_get (void) {
+	PacmanStatistics *result = g_new0 (PacmanStatistics, 1);
+	guint i;
+	
+	result->database_loads = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_DATABASE_LOADS]);
+	result->searches = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_SEARCHES]);
+	result->lookups = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_LOOKUPS]);
+	result->dependency_checks = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_DEPENDENCY_CHECKS]);
+	result->dependency_cache_hits = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_DEPENDENCY_CACHE_HITS]);
+	result->signal_emissions = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_SIGNAL_EMISSIONS]);
+	result->allocations = (guint64) (gsize) g_atomic_pointer_get (&pacman_statistics_counters[PACMAN_STATISTIC_ALLOCATIONS]);
+	
+	pacman_histogram_counters_get (&pacman_statistics_database_load_time, &result->database_load_time);
+	for (i = 0; i < PACMAN_TRANSACTION_STATUS_LAST; ++i) {
+		pacman_histogram_counters_get (&pacman_statistics_phase_time[i], &result->phase_time[i]);
+	}
+	
+	G_LOCK (pacman_statistics);
+	if (pacman_statistics_transfers != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		
+		g_hash_table_iter_init (&iter, pacman_statistics_transfers);
+		while (g_hash_table_iter_next (&iter, NULL, &value)) {
+			PacmanTransferStatistics *transfer = g_new (PacmanTransferStatistics, 1);
+			
+			*transfer = *(PacmanTransferStatistics *) value;
+			transfer->server = g_strdup (transfer->server);
+			result->transfers = pacman_list_add (result->transfers, transfer);
+		}
+	}
+	G_UNLOCK (pacman_statistics);
+	
+	return result;
+}
+
+static void pacman_transfer_statistics_free (PacmanTransferStatistics *transfer) {
+	g_return_if_fail (transfer != NULL);
+	
+	g_free (transfer->server);
+	g_free (transfer);
+}
+
+/**
+ * pacman_statistics_free:
+ * @statistics: A #PacmanStatistics.
+ *
+ * Frees @statistics, including the list of transfers.
+ */
+void pacman_statistics_free (PacmanStatistics *statistics) {
+	g_return_if_fail (statistics != NULL);
+	
+	pacman_list_free_full (statistics->transfers, (GDestroyNotify) pacman_transfer_statistics_free);
+	g_free (statistics);
+}
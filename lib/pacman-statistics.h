@@ -0,0 +1,94 @@
+/* pacman-statistics.h
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__PACMAN_H_INSIDE__) && !defined (PACMAN_COMPILATION)
+#error "Only <pacman.h> can be included directly."
+#endif
+
+#ifndef __PACMAN_STATISTICS_H__
+#define __PACMAN_STATISTICS_H__
+
+#include <glib.h>
+#include "pacman-types.h"
+#include "pacman-transaction.h"
+
+G_BEGIN_DECLS
+
+#define PACMAN_HISTOGRAM_BUCKETS 32
+
+/**
+ * PacmanHistogram:
+ * @count: The number of samples.
+ * @total: The sum of all samples, in microseconds.
+ * @buckets: The number of samples in each bucket. Bucket 0 holds samples under a microsecond, bucket n holds samples of at least 2^(n-1) but less than 2^n microseconds, and the last bucket also holds anything longer.
+ *
+ * A distribution of durations.
+ */
+typedef struct {
+	guint64 count;
+	guint64 total;
+	guint64 buckets[PACMAN_HISTOGRAM_BUCKETS];
+} PacmanHistogram;
+
+/**
+ * PacmanTransferStatistics:
+ * @server: The URL of a server.
+ * @bytes: The number of bytes downloaded from @server.
+ * @files: The number of files downloaded from @server.
+ *
+ * The amount of data downloaded from one server.
+ */
+typedef struct {
+	gchar *server;
+	guint64 bytes;
+	guint64 files;
+} PacmanTransferStatistics;
+
+/**
+ * PacmanStatistics:
+ * @database_loads: The number of times a package cache was loaded.
+ * @database_load_time: How long loading each package cache took.
+ * @searches: The number of calls to pacman_database_search().
+ * @lookups: The number of packages, groups and dependency satisfiers looked up by name.
+ * @dependency_checks: The number of dependencies tested against a package or database.
+ * @dependency_cache_hits: The number of those dependency checks answered from the cache.
+ * @signal_emissions: The number of status, question, event, progress and download signals emitted.
+ * @allocations: The number of status messages, marked package lists and cache entries allocated.
+ * @phase_time: How long each phase of a transaction took, indexed by the #PacmanTransactionStatus that started it.
+ * @transfers: A list of #PacmanTransferStatistics.
+ *
+ * A snapshot of counters kept since the library was loaded.
+ */
+typedef struct {
+	guint64 database_loads;
+	PacmanHistogram database_load_time;
+	guint64 searches;
+	guint64 lookups;
+	guint64 dependency_checks;
+	guint64 dependency_cache_hits;
+	guint64 signal_emissions;
+	guint64 allocations;
+	PacmanHistogram phase_time[PACMAN_TRANSACTION_STATUS_LAST];
+	PacmanList *transfers;
+} PacmanStatistics;
+
+void pacman_statistics_free (PacmanStatistics *statistics);
+
+G_END_DECLS
+
+#endif
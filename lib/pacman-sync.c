@@ -16,7 +16,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <alpm.h>
 #include "pacman-error.h"
 #include "pacman-list.h"
@@ -213,11 +215,93 @@ static gchar *pacman_file_make_list (const PacmanList *files) {
 	return g_string_free (result, FALSE);
 }
 
+static gchar *pacman_sync_find_cached (const gchar *filename) {
+	const PacmanList *i;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	for (i = alpm_option_get_cachedirs (); i != NULL; i = pacman_list_next (i)) {
+		gchar *path = g_build_filename ((const gchar *) pacman_list_get (i), filename, NULL);
+		
+		if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+			return path;
+		}
+		
+		g_free (path);
+	}
+	
+	return NULL;
+}
+
+static void pacman_sync_download (PacmanTransaction *transaction) {
+	PacmanList *jobs = NULL;
+	const PacmanList *i, *j;
+	const gchar *cache = NULL;
+	guint64 total = 0;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (pacman_manager != NULL);
+	
+	/* alpm decides which deltas to download while committing */
+	if (pacman_manager_get_use_delta (pacman_manager)) {
+		return;
+	}
+	
+	/* the same cache directory that alpm would download to */
+	for (i = alpm_option_get_cachedirs (); i != NULL; i = pacman_list_next (i)) {
+		if (g_access ((const gchar *) pacman_list_get (i), W_OK) == 0) {
+			cache = (const gchar *) pacman_list_get (i);
+			break;
+		}
+	}
+	
+	if (cache == NULL) {
+		return;
+	}
+	
+	for (i = pacman_transaction_get_installs (transaction); i != NULL; i = pacman_list_next (i)) {
+		PacmanPackage *package = (PacmanPackage *) pacman_list_get (i);
+		PacmanDatabase *database = pacman_package_get_database (package);
+		const gchar *filename = pacman_package_get_filename (package);
+		PacmanTransferJob *job;
+		gchar *path;
+		
+		if (database == NULL || filename == NULL) {
+			continue;
+		}
+		
+		path = pacman_sync_find_cached (filename);
+		if (path != NULL) {
+			g_free (path);
+			continue;
+		}
+		
+		job = pacman_transfer_job_new (cache, FALSE);
+		job->size = (guint64) pacman_package_get_size (package);
+		job->md5sum = g_strdup (pacman_package_get_md5sum (package));
+		for (j = pacman_database_get_servers (database); j != NULL; j = pacman_list_next (j)) {
+			job->urls = pacman_list_add (job->urls, g_strdup_printf ("%s/%s", (const gchar *) pacman_list_get (j), filename));
+		}
+		
+		total += (guint64) pacman_package_get_download_size (package);
+		jobs = pacman_list_add (jobs, job);
+	}
+	
+	/* anything that could not be downloaded is left for alpm to try and report */
+	if (jobs != NULL) {
+		pacman_manager_download (pacman_manager, jobs, total);
+	}
+	
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+}
+
 static gboolean pacman_sync_commit (PacmanTransaction *transaction, GError **error) {
 	PacmanList *data = NULL;
 	
 	g_return_val_if_fail (transaction != NULL, FALSE);
 	
+	pacman_sync_download (transaction);
+	
 	if (alpm_trans_commit (&data) < 0) {
 		if (pm_errno == PACMAN_ERROR_FILE_CONFLICT) {
 			gchar *conflict = pacman_file_conflict_make_list (data);
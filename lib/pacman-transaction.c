@@ -16,7 +16,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <unistd.h>
 #include <glib/gi18n-lib.h>
+#include <gio/gio.h>
 #include <alpm.h>
 #include "pacman-error.h"
 #include "pacman-list.h"
@@ -25,6 +28,7 @@
 #include "pacman-package.h"
 #include "pacman-database.h"
 #include "pacman-manager.h"
+#include "pacman-modify.h"
 #include "pacman-private.h"
 #include "pacman-transaction.h"
 
@@ -34,6 +38,8 @@
  * @short_description: Manipulate installed packages
  *
  * #PacmanTransaction is an abstract base class for package management operations. Transactions can be created by a #PacmanManager and prepared in a transaction-specific way using pacman_transaction_prepare(). At this point the transaction can be carried out using pacman_transaction_commit(), and then cancelled with pacman_transaction_cancel(). Transactions emit a number of signals to report on their progress and/or interact with the user.
+ *
+ * pacman_transaction_prepare_async() and pacman_transaction_commit_async() do the same work in a separate thread. In this case signals are still emitted in the thread-default main context of the caller, and the worker thread waits for each of them to be handled.
  */
 
 /**
@@ -47,15 +53,41 @@
 G_DEFINE_ABSTRACT_TYPE (PacmanTransaction, pacman_transaction, G_TYPE_OBJECT);
 
 typedef struct _PacmanTransactionPrivate {
+	PacmanList *targets;
+	gboolean prepared;
+	
 	PacmanList *marked_packages;
 	PacmanList *missing_dependencies;
 	PacmanList *conflicts;
 	PacmanList *file_conflicts;
 	PacmanList *invalid_files;
+	
+	GHashTable *progress;
+	PacmanList *pending;
+	
+	GArray *timeline;
+	GStringChunk *names;
+	gchar *repository;
+	
+	PacmanLogJournal *journal;
+	
+	GThread *worker;
+	GMainContext *context;
+	GMutex mutex;
+	GCond cond;
 } PacmanTransactionPrivate;
 
 static void pacman_transaction_init (PacmanTransaction *transaction) {
+	PacmanTransactionPrivate *priv;
+	
 	g_return_if_fail (transaction != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	priv->progress = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	priv->timeline = g_array_new (FALSE, FALSE, sizeof (PacmanTransactionSpan));
+	priv->names = g_string_chunk_new (1024);
+	g_mutex_init (&priv->mutex);
+	g_cond_init (&priv->cond);
 }
 
 static void pacman_transaction_finalize (GObject *object) {
@@ -64,12 +96,24 @@ static void pacman_transaction_finalize (GObject *object) {
 	g_return_if_fail (object != NULL);
 	
 	priv = PACMAN_TRANSACTION_GET_PRIVATE (PACMAN_TRANSACTION (object));
+	pacman_list_free_full (priv->targets, g_free);
 	pacman_list_free (priv->marked_packages);
 	pacman_list_free_full (priv->missing_dependencies, (GDestroyNotify) pacman_missing_dependency_free);
 	pacman_list_free_full (priv->conflicts, (GDestroyNotify) pacman_conflict_free);
 	pacman_list_free_full (priv->file_conflicts, (GDestroyNotify) pacman_file_conflict_free);
 	pacman_list_free (priv->invalid_files);
 	
+	g_hash_table_unref (priv->progress);
+	pacman_list_free (priv->pending);
+	g_array_free (priv->timeline, TRUE);
+	g_string_chunk_free (priv->names);
+	g_free (priv->repository);
+	if (priv->journal != NULL) {
+		pacman_log_journal_close (priv->journal);
+	}
+	g_mutex_clear (&priv->mutex);
+	g_cond_clear (&priv->cond);
+	
 	pacman_transaction_end (NULL);
 	pacman_manager_new_transaction (pacman_manager, G_TYPE_NONE);
 	
@@ -81,6 +125,7 @@ enum {
 	SIGNAL_QUESTION,
 	SIGNAL_PROGRESS,
 	SIGNAL_DOWNLOAD,
+	SIGNAL_EVENT,
 	SIGNAL_LAST
 };
 
@@ -88,6 +133,142 @@ static guint transaction_signals[SIGNAL_LAST] = { 0 };
 
 static GQuark transaction_signal_statuses[PACMAN_TRANSACTION_STATUS_LAST] = { 0 };
 
+typedef struct {
+	PacmanTransaction *transaction;
+	guint signal;
+	GQuark detail;
+	guint type;
+	const gchar *string;
+	PacmanTransactionEvent *event;
+	guint values[3];
+	gboolean result;
+	gboolean done;
+} PacmanTransactionEmission;
+
+/* the last progress emitted for one type of progress and target, and the latest one held back since */
+typedef struct {
+	PacmanTransactionEmission emission;
+	guint emitted;
+	gint64 time;
+	gboolean pending;
+} PacmanTransactionThrottle;
+
+static gchar *pacman_transaction_event_format (const PacmanTransactionEvent *event) {
+	va_list args;
+	gchar *result;
+	
+	g_return_val_if_fail (event != NULL, NULL);
+	
+	if (event->message != NULL) {
+		return g_strdup (event->message);
+	}
+	
+	g_return_val_if_fail (event->format != NULL, NULL);
+	g_return_val_if_fail (event->args != NULL, NULL);
+	
+	/* the arguments stay on the stack of whoever posted the event until it has been delivered */
+	va_copy (args, *(va_list *) event->args);
+	result = g_strdup_vprintf (event->format, args);
+	va_end (args);
+	
+	pacman_statistics_count (PACMAN_STATISTIC_ALLOCATIONS);
+	return result;
+}
+
+static void pacman_transaction_deliver (PacmanTransaction *transaction, PacmanTransactionEvent *event) {
+	GQuark detail;
+	gchar *message;
+	PacmanList *packages = NULL;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (event != NULL);
+	
+	/* "event" costs nothing to emit, so emission hooks can always rely on it */
+	detail = transaction_signal_statuses[event->status];
+	g_signal_emit (transaction, transaction_signals[SIGNAL_EVENT], detail, event);
+	
+	/* only build the message and marked packages for handlers that use them */
+	if (!g_signal_has_handler_pending (transaction, transaction_signals[SIGNAL_STATUS], detail, FALSE)) {
+		return;
+	}
+	
+	message = pacman_transaction_event_format (event);
+	if (event->package != NULL) {
+		packages = pacman_list_add (NULL, event->package);
+		if (event->old_package != NULL) {
+			packages = pacman_list_add (packages, event->old_package);
+		}
+		pacman_transaction_set_marked_packages (transaction, packages);
+		pacman_statistics_count (PACMAN_STATISTIC_ALLOCATIONS);
+	}
+	
+	g_signal_emit (transaction, transaction_signals[SIGNAL_STATUS], detail, event->status, message);
+	
+	if (packages != NULL) {
+		pacman_transaction_set_marked_packages (transaction, NULL);
+	}
+	g_free (message);
+}
+
+static gboolean pacman_transaction_emission_dispatch (gpointer data) {
+	PacmanTransactionEmission *emission = (PacmanTransactionEmission *) data;
+	PacmanTransactionPrivate *priv;
+	
+	g_return_val_if_fail (emission != NULL, FALSE);
+	
+	switch (emission->signal) {
+		case SIGNAL_STATUS:
+			pacman_transaction_deliver (emission->transaction, emission->event);
+			break;
+		case SIGNAL_QUESTION:
+			g_signal_emit (emission->transaction, transaction_signals[SIGNAL_QUESTION], emission->detail, (PacmanTransactionQuestion) emission->type, emission->string, &emission->result);
+			break;
+		case SIGNAL_PROGRESS:
+			g_signal_emit (emission->transaction, transaction_signals[SIGNAL_PROGRESS], emission->detail, (PacmanTransactionProgress) emission->type, emission->string, emission->values[0], emission->values[1], emission->values[2]);
+			break;
+		case SIGNAL_DOWNLOAD:
+			g_signal_emit (emission->transaction, transaction_signals[SIGNAL_DOWNLOAD], 0, emission->string, emission->values[0], emission->values[1]);
+			break;
+		default:
+			break;
+	}
+	
+	pacman_statistics_count (PACMAN_STATISTIC_SIGNAL_EMISSIONS);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (emission->transaction);
+	g_mutex_lock (&priv->mutex);
+	emission->done = TRUE;
+	g_cond_broadcast (&priv->cond);
+	g_mutex_unlock (&priv->mutex);
+	
+	return FALSE;
+}
+
+static void pacman_transaction_emit (PacmanTransaction *transaction, PacmanTransactionEmission *emission) {
+	PacmanTransactionPrivate *priv;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (emission != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	emission->transaction = transaction;
+	emission->done = FALSE;
+	
+	if (priv->worker != g_thread_self ()) {
+		pacman_transaction_emission_dispatch (emission);
+		return;
+	}
+	
+	/* handlers may look at marked packages etc., so wait for them to finish before carrying on */
+	g_main_context_invoke (priv->context, pacman_transaction_emission_dispatch, emission);
+	
+	g_mutex_lock (&priv->mutex);
+	while (!emission->done) {
+		g_cond_wait (&priv->cond, &priv->mutex);
+	}
+	g_mutex_unlock (&priv->mutex);
+}
+
 const gchar *pacman_transaction_status_get_nick (PacmanTransactionStatus status);
 
 static void transaction_signal_statuses_make_details (void) {
@@ -315,20 +496,88 @@ void pacman_transaction_set_invalid_files (PacmanTransaction *transaction, Pacma
 	priv->invalid_files = filenames;
 }
 
+static gboolean pacman_transaction_same_targets (const PacmanList *first, const PacmanList *second) {
+	GHashTable *before, *after;
+	const PacmanList *i;
+	gboolean result = TRUE;
+	
+	/* neither the order of targets nor repeats make any difference to libalpm */
+	before = g_hash_table_new (g_str_hash, g_str_equal);
+	after = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = first; i != NULL; i = pacman_list_next (i)) {
+		g_hash_table_add (before, pacman_list_get (i));
+	}
+	for (i = second; i != NULL && result; i = pacman_list_next (i)) {
+		g_hash_table_add (after, pacman_list_get (i));
+		result = g_hash_table_contains (before, pacman_list_get (i));
+	}
+	
+	result = result && g_hash_table_size (before) == g_hash_table_size (after);
+	g_hash_table_unref (after);
+	g_hash_table_unref (before);
+	return result;
+}
+
 /**
  * pacman_transaction_prepare:
  * @transaction: A #PacmanTransaction.
  * @targets: A list of strings.
  * @error: A #GError, or %NULL.
  *
- * Prepares @transaction to use @targets in some way. Safe to be called multiple times, but each call will discard the results of the previous one.
+ * Prepares @transaction to use @targets in some way. Safe to be called multiple times, but each call will discard the results of the previous one. If @transaction was last prepared successfully with the same targets, in any order, the previous result is kept rather than resolved again, along with the answers given to any questions.
  *
  * Returns: %TRUE if the operation succeeded, or %FALSE if @error is set.
  */
 gboolean pacman_transaction_prepare (PacmanTransaction *transaction, const PacmanList *targets, GError **error) {
+	PacmanTransactionPrivate *priv;
+	PacmanList *copy = NULL;
+	const PacmanList *i;
+	
 	g_return_val_if_fail (transaction != NULL, FALSE);
 	
-	return PACMAN_TRANSACTION_GET_CLASS (transaction)->prepare (transaction, targets, error);
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	
+	/* front ends often prepare again after each change to a selection, which may not have changed anything */
+	if (priv->prepared && pacman_transaction_same_targets (priv->targets, targets)) {
+		return TRUE;
+	}
+	
+	/* targets may be the list that is about to be replaced */
+	for (i = targets; i != NULL; i = pacman_list_next (i)) {
+		copy = pacman_list_add (copy, g_strdup ((const gchar *) pacman_list_get (i)));
+	}
+	
+	priv->prepared = FALSE;
+	priv->prepared = PACMAN_TRANSACTION_GET_CLASS (transaction)->prepare (transaction, copy, error);
+	
+	pacman_list_free_full (priv->targets, g_free);
+	priv->targets = copy;
+	
+	return priv->prepared;
+}
+
+/**
+ * pacman_transaction_get_targets:
+ * @transaction: A #PacmanTransaction.
+ *
+ * Gets the targets that @transaction was last prepared with.
+ *
+ * Returns: A list of strings. Do not free.
+ */
+const PacmanList *pacman_transaction_get_targets (PacmanTransaction *transaction) {
+	PacmanTransactionPrivate *priv;
+	
+	g_return_val_if_fail (transaction != NULL, NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	return priv->targets;
+}
+
+static void pacman_transaction_committed (PacmanTransaction *transaction) {
+	g_return_if_fail (transaction != NULL);
+	
+	/* even a failed commit may have installed or removed some packages */
+	pacman_dependency_invalidate ();
 }
 
 /**
@@ -341,9 +590,22 @@ gboolean pacman_transaction_prepare (PacmanTransaction *transaction, const Pacma
  * Returns: %TRUE if the operation succeeded, or %FALSE if @error is set.
  */
 gboolean pacman_transaction_commit (PacmanTransaction *transaction, GError **error) {
+	PacmanTransactionPrivate *priv;
+	gboolean result;
+	
 	g_return_val_if_fail (transaction != NULL, FALSE);
 	
-	return PACMAN_TRANSACTION_GET_CLASS (transaction)->commit (transaction, error);
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	result = PACMAN_TRANSACTION_GET_CLASS (transaction)->commit (transaction, error);
+	priv->prepared = FALSE;
+	
+	/* one append for every package this commit installed, upgraded or removed */
+	if (priv->journal != NULL) {
+		pacman_log_journal_commit (priv->journal);
+	}
+	pacman_transaction_committed (transaction);
+	
+	return result;
 }
 
 static gboolean pacman_transaction_real_commit (PacmanTransaction *transaction, GError **error) {
@@ -377,25 +639,506 @@ gboolean pacman_transaction_cancel (PacmanTransaction *transaction, GError **err
 	return TRUE;
 }
 
+static void pacman_transaction_run_in_thread (PacmanTransaction *transaction, GTask *task) {
+	PacmanTransactionPrivate *priv;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (task != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	priv->context = g_task_get_context (task);
+	priv->worker = g_thread_self ();
+}
+
+static void pacman_transaction_free_targets (gpointer data) {
+	pacman_list_free_full ((PacmanList *) data, g_free);
+}
+
+static void pacman_transaction_prepare_thread (GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+	PacmanTransaction *transaction = PACMAN_TRANSACTION (source);
+	PacmanTransactionPrivate *priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	GError *error = NULL;
+	gboolean result;
+	
+	/* libalpm cannot interrupt a prepare operation, so only check before it starts */
+	if (g_task_return_error_if_cancelled (task)) {
+		return;
+	}
+	
+	pacman_transaction_run_in_thread (transaction, task);
+	
+	result = pacman_transaction_prepare (transaction, (const PacmanList *) data, &error);
+	
+	/* the callback may start another operation as soon as the task returns */
+	priv->worker = NULL;
+	priv->context = NULL;
+	
+	if (result) {
+		g_task_return_boolean (task, TRUE);
+	} else {
+		g_task_return_error (task, error);
+	}
+}
+
+/**
+ * pacman_transaction_prepare_async:
+ * @transaction: A #PacmanTransaction.
+ * @targets: A list of strings.
+ * @cancellable: A #GCancellable, or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the operation is finished.
+ * @user_data: The data to pass to @callback.
+ *
+ * Starts preparing @transaction in a separate thread, as in pacman_transaction_prepare(). Signals are emitted in the thread-default main context of the caller, which must be running for the operation to finish. Do not use @transaction or any other pacman object until @callback is called, except from signal handlers.
+ */
+void pacman_transaction_prepare_async (PacmanTransaction *transaction, const PacmanList *targets, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+	PacmanList *copy = NULL;
+	const PacmanList *i;
+	GTask *task;
+	
+	g_return_if_fail (transaction != NULL);
+	
+	for (i = targets; i != NULL; i = pacman_list_next (i)) {
+		copy = pacman_list_add (copy, g_strdup ((const gchar *) pacman_list_get (i)));
+	}
+	
+	task = g_task_new (transaction, cancellable, callback, user_data);
+	g_task_set_source_tag (task, pacman_transaction_prepare_async);
+	g_task_set_task_data (task, copy, pacman_transaction_free_targets);
+	g_task_run_in_thread (task, pacman_transaction_prepare_thread);
+	g_object_unref (task);
+}
+
+/**
+ * pacman_transaction_prepare_finish:
+ * @transaction: A #PacmanTransaction.
+ * @result: The #GAsyncResult passed to the callback of pacman_transaction_prepare_async().
+ * @error: A #GError, or %NULL.
+ *
+ * Finishes an operation started with pacman_transaction_prepare_async().
+ *
+ * Returns: %TRUE if the operation succeeded, or %FALSE if @error is set.
+ */
+gboolean pacman_transaction_prepare_finish (PacmanTransaction *transaction, GAsyncResult *result, GError **error) {
+	g_return_val_if_fail (transaction != NULL, FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, transaction), FALSE);
+	
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void pacman_transaction_cancelled (GCancellable *cancellable, PacmanTransaction *transaction) {
+	g_return_if_fail (transaction != NULL);
+	
+	/* fails harmlessly if libalpm is not committing yet */
+	pacman_transaction_cancel (transaction, NULL);
+}
+
+static void pacman_transaction_commit_thread (GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+	PacmanTransaction *transaction = PACMAN_TRANSACTION (source);
+	PacmanTransactionPrivate *priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	GError *error = NULL;
+	gulong handler = 0;
+	gboolean result;
+	
+	if (g_task_return_error_if_cancelled (task)) {
+		return;
+	}
+	
+	pacman_transaction_run_in_thread (transaction, task);
+	
+	if (cancellable != NULL) {
+		handler = g_cancellable_connect (cancellable, G_CALLBACK (pacman_transaction_cancelled), transaction, NULL);
+	}
+	
+	result = pacman_transaction_commit (transaction, &error);
+	
+	if (cancellable != NULL) {
+		g_cancellable_disconnect (cancellable, handler);
+	}
+	
+	/* the callback may start another operation as soon as the task returns */
+	priv->worker = NULL;
+	priv->context = NULL;
+	
+	if (result) {
+		g_task_return_boolean (task, TRUE);
+	} else if (g_cancellable_is_cancelled (cancellable)) {
+		g_clear_error (&error);
+		g_task_return_error_if_cancelled (task);
+	} else {
+		g_task_return_error (task, error);
+	}
+}
+
+/**
+ * pacman_transaction_commit_async:
+ * @transaction: A #PacmanTransaction.
+ * @cancellable: A #GCancellable, or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the operation is finished.
+ * @user_data: The data to pass to @callback.
+ *
+ * Starts carrying out @transaction in a separate thread, as in pacman_transaction_commit(). Cancelling @cancellable has the same effect as pacman_transaction_cancel(). Signals are emitted in the thread-default main context of the caller, which must be running for the operation to finish. Do not use @transaction or any other pacman object until @callback is called, except from signal handlers.
+ */
+void pacman_transaction_commit_async (PacmanTransaction *transaction, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+	GTask *task;
+	
+	g_return_if_fail (transaction != NULL);
+	
+	task = g_task_new (transaction, cancellable, callback, user_data);
+	g_task_set_source_tag (task, pacman_transaction_commit_async);
+	g_task_run_in_thread (task, pacman_transaction_commit_thread);
+	g_object_unref (task);
+}
+
+/**
+ * pacman_transaction_commit_finish:
+ * @transaction: A #PacmanTransaction.
+ * @result: The #GAsyncResult passed to the callback of pacman_transaction_commit_async().
+ * @error: A #GError, or %NULL.
+ *
+ * Finishes an operation started with pacman_transaction_commit_async().
+ *
+ * Returns: %TRUE if the operation succeeded, or %FALSE if @error is set.
+ */
+gboolean pacman_transaction_commit_finish (PacmanTransaction *transaction, GAsyncResult *result, GError **error) {
+	g_return_val_if_fail (transaction != NULL, FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, transaction), FALSE);
+	
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * pacman_transaction_event_get_message:
+ * @event: A #PacmanTransactionEvent.
+ *
+ * Formats a human-readable description of @event, the same as the message passed to #PacmanTransaction::status. Can only be called from a handler for #PacmanTransaction::event.
+ *
+ * Returns: A status message. Free with g_free().
+ */
+gchar *pacman_transaction_event_get_message (const PacmanTransactionEvent *event) {
+	g_return_val_if_fail (event != NULL, NULL);
+	
+	return pacman_transaction_event_format (event);
+}
+
+static PacmanTransactionStatus pacman_transaction_status_get_end (PacmanTransactionStatus status) {
+	switch (status) {
+		case PACMAN_TRANSACTION_STATUS_DEPENDENCY_CHECK_START:
+		case PACMAN_TRANSACTION_STATUS_FILE_CONFLICT_CHECK_START:
+		case PACMAN_TRANSACTION_STATUS_DEPENDENCY_RESOLVE_START:
+		case PACMAN_TRANSACTION_STATUS_CONFLICT_CHECK_START:
+		case PACMAN_TRANSACTION_STATUS_INSTALL_START:
+		case PACMAN_TRANSACTION_STATUS_REMOVE_START:
+		case PACMAN_TRANSACTION_STATUS_UPGRADE_START:
+		case PACMAN_TRANSACTION_STATUS_PACKAGE_INTEGRITY_CHECK_START:
+		case PACMAN_TRANSACTION_STATUS_DELTA_INTEGRITY_CHECK_START:
+		case PACMAN_TRANSACTION_STATUS_DELTA_PATCHING_START:
+		case PACMAN_TRANSACTION_STATUS_DELTA_PATCH_START:
+			/* PacmanTransactionStatus is set up so that this works */
+			return status + 1;
+		case PACMAN_TRANSACTION_STATUS_DOWNLOAD_START:
+			return PACMAN_TRANSACTION_STATUS_DOWNLOAD_END;
+		default:
+			return PACMAN_TRANSACTION_STATUS_LAST;
+	}
+}
+
+static void pacman_transaction_record (PacmanTransaction *transaction, const PacmanTransactionEvent *event) {
+	PacmanTransactionPrivate *priv;
+	PacmanTransactionSpan span;
+	PacmanTransactionStatus end;
+	const gchar *name = NULL;
+	guint i;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (event != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	span.start = span.end = g_get_monotonic_time ();
+	
+	if (event->package != NULL) {
+		name = pacman_package_get_name (event->package);
+	} else if (event->target != NULL) {
+		name = event->target;
+	}
+	
+	/* close the most recent matching span, which is almost always the last one */
+	for (i = priv->timeline->len; i > 0; --i) {
+		PacmanTransactionSpan *open = &g_array_index (priv->timeline, PacmanTransactionSpan, i - 1);
+		
+		if (open->end < 0 && pacman_transaction_status_get_end (open->status) == event->status && (name == NULL || g_strcmp0 (open->name, name) == 0)) {
+			open->end = span.end;
+			pacman_statistics_record_phase (open->status, open->end - open->start);
+			return;
+		}
+	}
+	
+	end = pacman_transaction_status_get_end (event->status);
+	if (end != PACMAN_TRANSACTION_STATUS_LAST) {
+		span.end = -1;
+	} else if (event->status != PACMAN_TRANSACTION_STATUS_DOWNLOAD_FROM) {
+		/* an end status without a start */
+		return;
+	}
+	
+	span.status = event->status;
+	span.name = (name == NULL) ? NULL : g_string_chunk_insert_const (priv->names, name);
+	g_array_append_val (priv->timeline, span);
+}
+
+/**
+ * pacman_transaction_get_timeline:
+ * @transaction: A #PacmanTransaction.
+ * @length: The location to store the number of spans.
+ *
+ * Gets a record of how long each phase of @transaction took, and how long each package took to install, remove or upgrade. Spans are in the order they started. Do not call this while an asynchronous operation is running.
+ *
+ * Returns: An array of #PacmanTransactionSpan. Do not free.
+ */
+const PacmanTransactionSpan *pacman_transaction_get_timeline (PacmanTransaction *transaction, guint *length) {
+	PacmanTransactionPrivate *priv;
+	
+	g_return_val_if_fail (transaction != NULL, NULL);
+	g_return_val_if_fail (length != NULL, NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	*length = priv->timeline->len;
+	return (const PacmanTransactionSpan *) priv->timeline->data;
+}
+
+static void pacman_transaction_append_json_string (GString *json, const gchar *string) {
+	const gchar *i;
+	
+	g_string_append_c (json, '"');
+	for (i = string; *i != '\0'; ++i) {
+		if (*i == '"' || *i == '\\') {
+			g_string_append_c (json, '\\');
+			g_string_append_c (json, *i);
+		} else if ((guchar) *i < 0x20) {
+			g_string_append_printf (json, "\\u%04x", (guint) *i);
+		} else {
+			g_string_append_c (json, *i);
+		}
+	}
+	g_string_append_c (json, '"');
+}
+
+/**
+ * pacman_transaction_export_timeline:
+ * @transaction: A #PacmanTransaction.
+ *
+ * Converts the timeline of @transaction to the JSON trace event format used by Chrome's about:tracing. Times are relative to the start of the first span. See pacman_transaction_get_timeline().
+ *
+ * Returns: A JSON string. Free with g_free().
+ */
+gchar *pacman_transaction_export_timeline (PacmanTransaction *transaction) {
+	const PacmanTransactionSpan *spans;
+	GString *json;
+	guint i, length;
+	
+	g_return_val_if_fail (transaction != NULL, NULL);
+	
+	spans = pacman_transaction_get_timeline (transaction, &length);
+	json = g_string_new ("{\"traceEvents\":[");
+	
+	for (i = 0; i < length; ++i) {
+		const gchar *phase = pacman_transaction_status_get_nick (spans[i].status);
+		gsize size = strlen (phase);
+		
+		/* "install-start" becomes "install" */
+		if (g_str_has_suffix (phase, "-start")) {
+			size -= strlen ("-start");
+		}
+		
+		g_string_append (json, (i == 0) ? "\n" : ",\n");
+		g_string_append_printf (json, "{\"cat\":\"%.*s\",\"name\":", (gint) size, phase);
+		pacman_transaction_append_json_string (json, (spans[i].name != NULL) ? spans[i].name : phase);
+		
+		if (spans[i].start == spans[i].end) {
+			g_string_append (json, ",\"ph\":\"i\",\"s\":\"p\"");
+		} else if (spans[i].end < 0) {
+			g_string_append (json, ",\"ph\":\"B\"");
+		} else {
+			g_string_append_printf (json, ",\"ph\":\"X\",\"dur\":%" G_GINT64_FORMAT, spans[i].end - spans[i].start);
+		}
+		
+		g_string_append_printf (json, ",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%lu,\"tid\":1}", spans[i].start - spans[0].start, (gulong) getpid ());
+	}
+	
+	g_string_append (json, "\n]}\n");
+	return g_string_free (json, FALSE);
+}
+
+/* one throttle for each type of progress, and one for downloads after them */
+#define PACMAN_TRANSACTION_PROGRESS_DOWNLOAD PACMAN_TRANSACTION_PROGRESS_LAST
+
+static gint64 pacman_transaction_throttle_interval (void) {
+	guint rate;
+	
+	g_return_val_if_fail (pacman_manager != NULL, 0);
+	
+	rate = pacman_manager_get_progress_rate (pacman_manager);
+	return (rate > 0) ? G_USEC_PER_SEC / rate : 0;
+}
+
+static void pacman_transaction_throttle_emit (PacmanTransaction *transaction, PacmanTransactionThrottle *throttle, gint64 now) {
+	PacmanTransactionEmission emission;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (throttle != NULL);
+	
+	/* values[0] is the percentage or the number of bytes so far */
+	throttle->emitted = throttle->emission.values[0] + 1;
+	throttle->time = now;
+	throttle->pending = FALSE;
+	
+	emission = throttle->emission;
+	pacman_transaction_emit (transaction, &emission);
+}
+
+static void pacman_transaction_flush_progress (PacmanTransaction *transaction, gboolean all) {
+	PacmanTransactionPrivate *priv;
+	PacmanList *i, *next;
+	gint64 now, interval;
+	
+	g_return_if_fail (transaction != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	if (priv->pending == NULL) {
+		return;
+	}
+	
+	now = g_get_monotonic_time ();
+	interval = pacman_transaction_throttle_interval ();
+	
+	for (i = priv->pending; i != NULL; i = next) {
+		PacmanTransactionThrottle *throttle = (PacmanTransactionThrottle *) pacman_list_get (i);
+		next = pacman_list_next (i);
+		
+		if (all || now - throttle->time >= interval) {
+			priv->pending = pacman_list_remove_direct (priv->pending, throttle, NULL);
+			if (throttle->pending) {
+				pacman_transaction_throttle_emit (transaction, throttle, now);
+			}
+		}
+	}
+}
+
+static void pacman_transaction_throttle (PacmanTransaction *transaction, PacmanTransactionEmission *emission, gboolean final) {
+	PacmanTransactionPrivate *priv;
+	PacmanTransactionThrottle *throttle;
+	gpointer key;
+	gint64 now;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (emission != NULL);
+	g_return_if_fail (emission->string != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	
+	if (!g_hash_table_lookup_extended (priv->progress, emission->string, &key, (gpointer *) &throttle)) {
+		key = g_strdup (emission->string);
+		throttle = g_new0 (PacmanTransactionThrottle, PACMAN_TRANSACTION_PROGRESS_DOWNLOAD + 1);
+		g_hash_table_insert (priv->progress, key, throttle);
+	}
+	
+	/* held back values for other targets may be due by now */
+	pacman_transaction_flush_progress (transaction, FALSE);
+	
+	throttle += emission->type;
+	throttle->emission = *emission;
+	throttle->emission.string = (const gchar *) key;
+	
+	if (throttle->emitted == emission->values[0] + 1) {
+		throttle->pending = FALSE;
+		return;
+	}
+	
+	/* always let through the first and last update for each target, so nobody misses the start or end */
+	now = g_get_monotonic_time ();
+	if (throttle->emitted == 0 || final || now - throttle->time >= pacman_transaction_throttle_interval ()) {
+		pacman_transaction_throttle_emit (transaction, throttle, now);
+	} else if (!throttle->pending) {
+		/* emitted once the interval is up, or when the phase changes */
+		throttle->pending = TRUE;
+		priv->pending = pacman_list_add (priv->pending, throttle);
+	}
+}
+
+static void pacman_transaction_vpost (PacmanTransaction *transaction, PacmanTransactionEvent *event, const gchar *format, va_list args) {
+	PacmanTransactionPrivate *priv;
+	PacmanTransactionEmission emission;
+	va_list copy;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (event != NULL);
+	g_return_if_fail (event->status < PACMAN_TRANSACTION_STATUS_LAST);
+	g_return_if_fail (format != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	pacman_transaction_record (transaction, event);
+	PACMAN_PROBE2 (transaction__status, event->status, event->target);
+	
+	/* progress held back from the phase that is ending arrives before the event that ends it */
+	pacman_transaction_flush_progress (transaction, TRUE);
+	
+	/* a va_list cannot be read on another thread, so events crossing to the caller's main context are formatted here */
+	va_copy (copy, args);
+	if (priv->worker == g_thread_self ()) {
+		event->message = g_strdup_vprintf (format, copy);
+		pacman_statistics_count (PACMAN_STATISTIC_ALLOCATIONS);
+	} else {
+		event->format = format;
+		event->args = &copy;
+	}
+	
+	emission.signal = SIGNAL_STATUS;
+	emission.event = event;
+	pacman_transaction_emit (transaction, &emission);
+	
+	g_free (event->message);
+	event->message = NULL;
+	event->format = NULL;
+	event->args = NULL;
+	va_end (copy);
+}
+
+static void pacman_transaction_post (PacmanTransaction *transaction, PacmanTransactionEvent *event, const gchar *format, ...) {
+	va_list args;
+	
+	va_start (args, format);
+	pacman_transaction_vpost (transaction, event, format, args);
+	va_end (args);
+}
+
 void pacman_transaction_tell (PacmanTransaction *transaction, PacmanTransactionStatus status, const gchar *format, ...) {
+	PacmanTransactionEvent event = { 0 };
 	va_list args;
-	gchar *message;
 	
-	g_return_if_fail (transaction != NULL);
 	g_return_if_fail (status < PACMAN_TRANSACTION_STATUS_LAST);
 	
+	event.status = status;
+	
 	va_start (args, format);
-	message = g_strdup_vprintf (format, args);
+	pacman_transaction_vpost (transaction, &event, format, args);
 	va_end (args);
+}
+
+static PacmanLogJournal *pacman_transaction_get_journal (PacmanTransaction *transaction) {
+	PacmanTransactionPrivate *priv;
 	
-	g_return_if_fail (message != NULL);
+	g_return_val_if_fail (transaction != NULL, NULL);
 	
-	g_signal_emit (transaction, transaction_signals[SIGNAL_STATUS], transaction_signal_statuses[status], status, message);
+	/* if this fails, lines are passed to alpm_logaction one at a time */
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	if (priv->journal == NULL) {
+		priv->journal = pacman_log_journal_open ();
+	}
 	
-	g_free (message);
+	return priv->journal;
 }
 
 static void pacman_transaction_event_cb (pmtransevt_t event, gpointer data1, gpointer data2) {
+	PacmanTransactionEvent post = { 0 };
 	PacmanTransaction *transaction;
 	
 	g_return_if_fail (pacman_manager != NULL);
@@ -428,18 +1171,18 @@ static void pacman_transaction_event_cb (pmtransevt_t event, gpointer data1, gpo
 			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_CONFLICT_CHECK_END, _("Finished checking for conflicts"));
 			break;
 		} case PM_TRANS_EVT_ADD_START: {
-			pacman_transaction_set_marked_packages (transaction, pacman_list_add (NULL, data1));
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_INSTALL_START, _("Installing %s"), pacman_package_get_name ((PacmanPackage *) data1));
-			pacman_transaction_set_marked_packages (transaction, NULL);
+			post.status = PACMAN_TRANSACTION_STATUS_INSTALL_START;
+			post.package = (PacmanPackage *) data1;
+			pacman_transaction_post (transaction, &post, _("Installing %s"), pacman_package_get_name (post.package));
 			break;
 		} case PM_TRANS_EVT_ADD_DONE: {
 			PacmanPackage *package = (PacmanPackage *) data1;
 			const PacmanList *optional_dependencies, *i;
-			alpm_logaction ("installed %s (%s)\n", pacman_package_get_name (package), pacman_package_get_version (package));
+			pacman_log_journal_append (pacman_transaction_get_journal (transaction), "installed %s (%s)\n", pacman_package_get_name (package), pacman_package_get_version (package));
 			
-			pacman_transaction_set_marked_packages (transaction, pacman_list_add (NULL, data1));
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_INSTALL_END, _("Finished installing %s"), pacman_package_get_name (package));
-			pacman_transaction_set_marked_packages (transaction, NULL);
+			post.status = PACMAN_TRANSACTION_STATUS_INSTALL_END;
+			post.package = package;
+			pacman_transaction_post (transaction, &post, _("Finished installing %s"), pacman_package_get_name (package));
 			
 			optional_dependencies = pacman_package_get_optional_dependencies (package);
 			if (optional_dependencies != NULL) {
@@ -458,38 +1201,33 @@ static void pacman_transaction_event_cb (pmtransevt_t event, gpointer data1, gpo
 			}
 			break;
 		} case PM_TRANS_EVT_REMOVE_START: {
-			pacman_transaction_set_marked_packages (transaction, pacman_list_add (NULL, data1));
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_REMOVE_START, _("Removing %s"), pacman_package_get_name ((PacmanPackage *) data1));
-			pacman_transaction_set_marked_packages (transaction, NULL);
+			post.status = PACMAN_TRANSACTION_STATUS_REMOVE_START;
+			post.package = (PacmanPackage *) data1;
+			pacman_transaction_post (transaction, &post, _("Removing %s"), pacman_package_get_name (post.package));
 			break;
 		} case PM_TRANS_EVT_REMOVE_DONE: {
 			PacmanPackage *package = (PacmanPackage *) data1;
-			alpm_logaction ("removed %s (%s)\n", pacman_package_get_name (package), pacman_package_get_version (package));
+			pacman_log_journal_append (pacman_transaction_get_journal (transaction), "removed %s (%s)\n", pacman_package_get_name (package), pacman_package_get_version (package));
 			
-			pacman_transaction_set_marked_packages (transaction, pacman_list_add (NULL, data1));
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_REMOVE_END, _("Finished removing %s"), pacman_package_get_name (package));
-			pacman_transaction_set_marked_packages (transaction, NULL);
+			post.status = PACMAN_TRANSACTION_STATUS_REMOVE_END;
+			post.package = package;
+			pacman_transaction_post (transaction, &post, _("Finished removing %s"), pacman_package_get_name (package));
 			break;
 		} case PM_TRANS_EVT_UPGRADE_START: {
-			PacmanList *new_then_old = NULL;
-			new_then_old = pacman_list_add (new_then_old, data1);
-			new_then_old = pacman_list_add (new_then_old, data2);
-			
-			pacman_transaction_set_marked_packages (transaction, new_then_old);
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_UPGRADE_START, _("Upgrading %s"), pacman_package_get_name ((PacmanPackage *) data1));
-			pacman_transaction_set_marked_packages (transaction, NULL);
+			post.status = PACMAN_TRANSACTION_STATUS_UPGRADE_START;
+			post.package = (PacmanPackage *) data1;
+			post.old_package = (PacmanPackage *) data2;
+			pacman_transaction_post (transaction, &post, _("Upgrading %s"), pacman_package_get_name (post.package));
 			break;
 		} case PM_TRANS_EVT_UPGRADE_DONE: {
 			PacmanPackage *package = (PacmanPackage *) data1, *old_package = (PacmanPackage *) data2;
-			PacmanList *optional_dependencies, *i, *new_then_old = NULL;
-			alpm_logaction ("upgraded %s (%s -> %s)\n", pacman_package_get_name (package), pacman_package_get_version (old_package), pacman_package_get_version (package));
+			PacmanList *optional_dependencies, *i;
+			pacman_log_journal_append (pacman_transaction_get_journal (transaction), "upgraded %s (%s -> %s)\n", pacman_package_get_name (package), pacman_package_get_version (old_package), pacman_package_get_version (package));
 			
-			new_then_old = pacman_list_add (new_then_old, data1);
-			new_then_old = pacman_list_add (new_then_old, data2);
-			
-			pacman_transaction_set_marked_packages (transaction, new_then_old);
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_UPGRADE_END, _("Finished upgrading %s"), pacman_package_get_name (package));
-			pacman_transaction_set_marked_packages (transaction, NULL);
+			post.status = PACMAN_TRANSACTION_STATUS_UPGRADE_END;
+			post.package = package;
+			post.old_package = old_package;
+			pacman_transaction_post (transaction, &post, _("Finished upgrading %s"), pacman_package_get_name (package));
 			
 			optional_dependencies = pacman_list_diff (pacman_package_get_optional_dependencies (package), pacman_package_get_optional_dependencies (old_package), (GCompareFunc) g_strcmp0);
 			if (optional_dependencies != NULL) {
@@ -527,7 +1265,9 @@ static void pacman_transaction_event_cb (pmtransevt_t event, gpointer data1, gpo
 			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DELTA_PATCHING_END, _("Finished applying delta patches"));
 			break;
 		} case PM_TRANS_EVT_DELTA_PATCH_START: {
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DELTA_PATCH_START, _("Creating %s from the delta patch %s"), (const gchar *) data1, (const gchar *) data2);
+			post.status = PACMAN_TRANSACTION_STATUS_DELTA_PATCH_START;
+			post.target = (const gchar *) data1;
+			pacman_transaction_post (transaction, &post, _("Creating %s from the delta patch %s"), (const gchar *) data1, (const gchar *) data2);
 			break;
 		} case PM_TRANS_EVT_DELTA_PATCH_DONE: {
 			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DELTA_PATCH_END, _("Finished applying delta patch"));
@@ -539,7 +1279,14 @@ static void pacman_transaction_event_cb (pmtransevt_t event, gpointer data1, gpo
 			g_message ("%s\n", (const gchar *) data1);
 			break;
 		} case PM_TRANS_EVT_RETRIEVE_START: {
-			pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DOWNLOAD_FROM, _("Downloading packages from [%s]"), (const gchar *) data1);
+			PacmanTransactionPrivate *priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+			
+			g_free (priv->repository);
+			priv->repository = g_strdup ((const gchar *) data1);
+			
+			post.status = PACMAN_TRANSACTION_STATUS_DOWNLOAD_FROM;
+			post.target = (const gchar *) data1;
+			pacman_transaction_post (transaction, &post, _("Downloading packages from [%s]"), (const gchar *) data1);
 			break;
 		} default: {
 			g_debug ("Unrecognised event: %d\n", event);
@@ -549,9 +1296,9 @@ static void pacman_transaction_event_cb (pmtransevt_t event, gpointer data1, gpo
 }
 
 gboolean pacman_transaction_ask (PacmanTransaction *transaction, PacmanTransactionQuestion question, const gchar *format, ...) {
+	PacmanTransactionEmission emission;
 	va_list args;
 	gchar *message;
-	gboolean result;
 	
 	g_return_val_if_fail (transaction != NULL, FALSE);
 	g_return_val_if_fail (question < PACMAN_TRANSACTION_QUESTION_LAST, FALSE);
@@ -562,38 +1309,15 @@ gboolean pacman_transaction_ask (PacmanTransaction *transaction, PacmanTransacti
 	
 	g_return_val_if_fail (message != NULL, FALSE);
 	
-	g_signal_emit (transaction, transaction_signals[SIGNAL_QUESTION], transaction_signal_questions[question], question, message, &result);
+	emission.signal = SIGNAL_QUESTION;
+	emission.detail = transaction_signal_questions[question];
+	emission.type = (guint) question;
+	emission.string = message;
+	emission.result = FALSE;
+	pacman_transaction_emit (transaction, &emission);
 	
 	g_free (message);
-	return result;
-}
-
-/* pretty fucked up kludge, keep this in sync with libalpm/conflict.h */
-struct __pmconflict_t {
-	gchar *first;
-	gchar *second;
-	gchar *reason;
-};
-
-static PacmanConflict *pacman_conflict_new (const gchar *first, const gchar *second, const gchar *reason) {
-	PacmanConflict *result;
-	
-	g_return_val_if_fail (first != NULL, NULL);
-	g_return_val_if_fail (second != NULL, NULL);
-	g_return_val_if_fail (reason != NULL, NULL);
-	
-	result = malloc (sizeof (PacmanConflict));
-	g_return_val_if_fail (result != NULL, NULL);
-	
-	result->first = strdup (first);
-	result->second = strdup (second);
-	result->reason = strdup (reason);
-	
-	g_warn_if_fail (first != pacman_conflict_get_first_package (result));
-	g_warn_if_fail (second != pacman_conflict_get_second_package (result));
-	g_warn_if_fail (reason != pacman_conflict_get_reason (result));
-	
-	return result;
+	return emission.result;
 }
 
 static void pacman_transaction_question_cb (pmtransconv_t question, gpointer data1, gpointer data2, gpointer data3, gint *response) {
@@ -686,9 +1410,24 @@ static gboolean pacman_transaction_question_accumulator (GSignalInvocationHint *
 	return TRUE;
 }
 
+static void pacman_transaction_progress (PacmanTransaction *transaction, PacmanTransactionProgress type, const gchar *target, guint percent, guint current, guint targets) {
+	PacmanTransactionEmission emission;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (type < PACMAN_TRANSACTION_PROGRESS_LAST);
+	
+	emission.signal = SIGNAL_PROGRESS;
+	emission.detail = transaction_signal_progresses[type];
+	emission.type = (guint) type;
+	emission.string = target;
+	emission.values[0] = percent;
+	emission.values[1] = current;
+	emission.values[2] = targets;
+	pacman_transaction_throttle (transaction, &emission, percent == 100);
+}
+
 static void pacman_transaction_progress_cb (pmtransprog_t type, const gchar *target, gint percent, gint targets, gint current) {
 	PacmanTransaction *transaction;
-	static gint last_percent = 101;
 	
 	g_return_if_fail (target != NULL);
 	g_return_if_fail (type < PACMAN_TRANSACTION_PROGRESS_LAST);
@@ -706,15 +1445,63 @@ static void pacman_transaction_progress_cb (pmtransprog_t type, const gchar *tar
 		percent = 100;
 	}
 	
-	if (percent != last_percent) {
-		last_percent = percent;
-		
-		/* PacmanTransactionProgress is set up so that this works */
-		g_signal_emit (transaction, transaction_signals[SIGNAL_PROGRESS], transaction_signal_progresses[type], (PacmanTransactionProgress) type, target, (guint) percent, (guint) current, (guint) targets);
+	PACMAN_PROBE3 (transaction__progress, type, target, percent);
+	
+	/* PacmanTransactionProgress is set up so that this works */
+	pacman_transaction_progress (transaction, (PacmanTransactionProgress) type, target, (guint) percent, (guint) current, (guint) targets);
+}
+
+void pacman_transaction_set_repository (PacmanTransaction *transaction, const gchar *name) {
+	PacmanTransactionPrivate *priv;
+	
+	g_return_if_fail (transaction != NULL);
+	
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	g_free (priv->repository);
+	priv->repository = g_strdup (name);
+}
+
+static void pacman_transaction_downloaded (PacmanTransaction *transaction, guint64 size) {
+	PacmanTransactionPrivate *priv;
+	PacmanDatabase *database = NULL;
+	const gchar *server = NULL;
+	
+	g_return_if_fail (transaction != NULL);
+	g_return_if_fail (pacman_manager != NULL);
+	
+	/* libalpm does not say which mirror it used, so blame the first server of the current repository */
+	priv = PACMAN_TRANSACTION_GET_PRIVATE (transaction);
+	if (priv->repository != NULL) {
+		database = pacman_manager_find_sync_database (pacman_manager, priv->repository);
+	}
+	if (database != NULL) {
+		server = pacman_database_get_server (database);
+	}
+	
+	if (server != NULL) {
+		pacman_statistics_record_transfer (server, size);
+	} else {
+		pacman_statistics_record_transfer ((priv->repository != NULL) ? priv->repository : "unknown", size);
 	}
 }
 
+void pacman_transaction_download (PacmanTransaction *transaction, const gchar *filename, guint complete, guint total) {
+	PacmanTransactionEmission emission;
+	
+	g_return_if_fail (transaction != NULL);
+	
+	emission.signal = SIGNAL_DOWNLOAD;
+	emission.detail = 0;
+	emission.type = 0;
+	emission.string = filename;
+	emission.values[0] = complete;
+	emission.values[1] = total;
+	emission.values[2] = 0;
+	pacman_transaction_emit (transaction, &emission);
+}
+
 static void pacman_transaction_download_cb (const gchar *filename, off_t complete, off_t total) {
+	PacmanTransactionEmission emission;
 	PacmanTransaction *transaction;
 	
 	g_return_if_fail (filename != NULL);
@@ -723,10 +1510,38 @@ static void pacman_transaction_download_cb (const gchar *filename, off_t complet
 	transaction = pacman_manager_get_transaction (pacman_manager);
 	g_return_if_fail (transaction != NULL);
 	
-	g_signal_emit (transaction, transaction_signals[SIGNAL_DOWNLOAD], 0, filename, (guint) complete, (guint) total);
+	PACMAN_PROBE3 (transaction__download, filename, (guint64) complete, (guint64) total);
+	
+	/* readers of a database being updated are held off from here on, so nothing may wait for the main loop */
+	if (total <= 0 && complete == 0) {
+		/* libfetch does not say when a file of unknown size is finished */
+		pacman_database_begin_update ();
+	}
+	if (pacman_database_is_updating ()) {
+		return;
+	}
+	
+	emission.signal = SIGNAL_DOWNLOAD;
+	emission.detail = 0;
+	emission.type = PACMAN_TRANSACTION_PROGRESS_DOWNLOAD;
+	emission.string = filename;
+	emission.values[0] = (guint) complete;
+	emission.values[1] = (guint) total;
+	emission.values[2] = 0;
+	pacman_transaction_throttle (transaction, &emission, complete == total);
+	
+	if (complete == total && total > 0) {
+		pacman_transaction_downloaded (transaction, (guint64) total);
+	}
+	
+	/* libfetch gives alpm the new database straight after this */
+	if (complete == total && total > 0) {
+		pacman_database_begin_update ();
+	}
 }
 
 static void pacman_transaction_total_download_cb (off_t total) {
+	PacmanTransactionEvent event = { 0 };
 	PacmanTransaction *transaction;
 	
 	g_return_if_fail (pacman_manager != NULL);
@@ -734,11 +1549,14 @@ static void pacman_transaction_total_download_cb (off_t total) {
 	g_return_if_fail (transaction != NULL);
 	
 	if (total == 0) {
-		g_signal_emit (transaction, transaction_signals[SIGNAL_DOWNLOAD], 0, NULL, (guint) 0, (guint) 0);
-		pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DOWNLOAD_END, _("Finished downloading packages"));
+		pacman_transaction_download (transaction, NULL, 0, 0);
+		event.status = PACMAN_TRANSACTION_STATUS_DOWNLOAD_END;
+		pacman_transaction_post (transaction, &event, _("Finished downloading packages"));
 	} else {
-		g_signal_emit (transaction, transaction_signals[SIGNAL_DOWNLOAD], 0, NULL, (guint) 0, (guint) total);
-		pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DOWNLOAD_START, _("Downloading packages"));
+		pacman_transaction_download (transaction, NULL, 0, (guint) total);
+		event.status = PACMAN_TRANSACTION_STATUS_DOWNLOAD_START;
+		event.total = (guint64) total;
+		pacman_transaction_post (transaction, &event, _("Downloading packages"));
 	}
 }
 
@@ -762,6 +1580,7 @@ gboolean pacman_transaction_start (guint32 flags, GError **error) {
 	
 	alpm_option_set_dlcb (pacman_transaction_download_cb);
 	alpm_option_set_totaldlcb (pacman_transaction_total_download_cb);
+	PACMAN_PROBE1 (transaction__start, flags);
 	return TRUE;
 }
 
@@ -769,11 +1588,15 @@ gboolean pacman_transaction_end (GError **error) {
 	alpm_option_set_dlcb (NULL);
 	alpm_option_set_totaldlcb (NULL);
 	
+	/* so that mirrors are ranked using this transaction's downloads next time */
+	pacman_mirror_save ();
+	
 	if (alpm_trans_release () < 0) {
 		g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not release transaction: %s"), alpm_strerrorlast ());
 		return FALSE;
 	}
 	
+	PACMAN_PROBE (transaction__end);
 	return TRUE;
 }
 
@@ -785,6 +1608,7 @@ gboolean pacman_transaction_restart (PacmanTransaction *transaction, GError **er
 	pacman_transaction_set_conflicts (transaction, NULL);
 	pacman_transaction_set_file_conflicts (transaction, NULL);
 	pacman_transaction_set_invalid_files (transaction, NULL);
+	g_hash_table_remove_all (PACMAN_TRANSACTION_GET_PRIVATE (transaction)->progress);
 	
 	if (!pacman_transaction_end (error) || !pacman_transaction_start (flags, error)) {
 		return FALSE;
@@ -853,7 +1677,16 @@ static void pacman_transaction_class_init (PacmanTransactionClass *klass) {
 	 * @complete: The proportion of the download completed, in bytes.
 	 * @total: The size of the file being downloaded, in bytes.
 	 *
-	 * Emitted when downloading @filename makes some progress towards completion.
+	 * Emitted when downloading @filename makes some progress towards completion. If a database was already up to date, @complete and @total are both the number of bytes that did not need to be downloaded.
 	 */
 	transaction_signals[SIGNAL_DOWNLOAD] = g_signal_new ("download", PACMAN_TYPE_TRANSACTION, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_user_marshal_VOID__STRING_UINT_UINT, G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT);
+	
+	/**
+	 * PacmanTransaction::event:
+	 * @transaction: The current #PacmanTransaction.
+	 * @event: A #PacmanTransactionEvent.
+	 *
+	 * Emitted alongside #PacmanTransaction::status, with the same detail. Unlike #PacmanTransaction::status, no message is formatted unless pacman_transaction_event_get_message() is called, and the package involved is passed directly rather than through pacman_transaction_get_marked_packages(). #PacmanTransaction::status is only emitted when it has a handler, so emission hooks should be added to this signal instead.
+	 */
+	transaction_signals[SIGNAL_EVENT] = g_signal_new ("event", PACMAN_TYPE_TRANSACTION, G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED, 0, NULL, NULL, g_cclosure_marshal_VOID__POINTER, G_TYPE_NONE, 1, G_TYPE_POINTER);
 }
@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 #include "pacman-types.h"
 
 G_BEGIN_DECLS
@@ -200,6 +201,47 @@ typedef enum {
 	PACMAN_TRANSACTION_PROGRESS_LAST /*< skip >*/
 } PacmanTransactionProgress;
 
+/**
+ * PacmanTransactionEvent:
+ * @status: The type of event.
+ * @package: The package being installed, removed or upgraded, or %NULL.
+ * @old_package: The package being replaced by @package during an upgrade, or %NULL.
+ * @target: The name of a file or database the event refers to, or %NULL.
+ * @complete: The number of bytes downloaded so far, if relevant.
+ * @total: The total number of bytes to download, if relevant.
+ *
+ * Describes an event passed to #PacmanTransaction::event. Only valid until the signal handler returns.
+ */
+typedef struct {
+	PacmanTransactionStatus status;
+	PacmanPackage *package;
+	PacmanPackage *old_package;
+	const gchar *target;
+	guint64 complete;
+	guint64 total;
+	
+	/*< private >*/
+	const gchar *format;
+	gpointer args;
+	gchar *message;
+} PacmanTransactionEvent;
+
+/**
+ * PacmanTransactionSpan:
+ * @status: The status that started the span, e.g. %PACMAN_TRANSACTION_STATUS_INSTALL_START.
+ * @name: The name of the package, file or database involved, or %NULL.
+ * @start: When the span started, in microseconds. See g_get_monotonic_time().
+ * @end: When the span finished, or -1 if it is still going.
+ *
+ * Represents a phase of a transaction, or the installation, removal or upgrade of a single package. Statuses that have no matching end status have the same @start and @end.
+ */
+typedef struct {
+	PacmanTransactionStatus status;
+	const gchar *name;
+	gint64 start;
+	gint64 end;
+} PacmanTransactionSpan;
+
 GType pacman_transaction_get_type (void);
 GType pacman_transaction_flags_get_type (void);
 GType pacman_transaction_status_get_type (void);
@@ -217,9 +259,19 @@ const PacmanList *pacman_transaction_get_file_conflicts (PacmanTransaction *tran
 const PacmanList *pacman_transaction_get_invalid_files (PacmanTransaction *transaction);
 
 gboolean pacman_transaction_prepare (PacmanTransaction *transaction, const PacmanList *targets, GError **error);
+const PacmanList *pacman_transaction_get_targets (PacmanTransaction *transaction);
+void pacman_transaction_prepare_async (PacmanTransaction *transaction, const PacmanList *targets, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+gboolean pacman_transaction_prepare_finish (PacmanTransaction *transaction, GAsyncResult *result, GError **error);
 gboolean pacman_transaction_commit (PacmanTransaction *transaction, GError **error);
+void pacman_transaction_commit_async (PacmanTransaction *transaction, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+gboolean pacman_transaction_commit_finish (PacmanTransaction *transaction, GAsyncResult *result, GError **error);
 gboolean pacman_transaction_cancel (PacmanTransaction *transaction, GError **error);
 
+gchar *pacman_transaction_event_get_message (const PacmanTransactionEvent *event);
+
+const PacmanTransactionSpan *pacman_transaction_get_timeline (PacmanTransaction *transaction, guint *length);
+gchar *pacman_transaction_export_timeline (PacmanTransaction *transaction);
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,1439 @@
+/* pacman-transfer.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <alpm.h>
+#include "pacman-error.h"
+#include "pacman-list.h"
+#include "pacman-private.h"
+
+#define PACMAN_TRANSFER_BUFFER_SIZE (64 * 1024)
+#define PACMAN_TRANSFER_REDIRECTS 5
+
+/* in seconds, the same as libfetch */
+#define PACMAN_TRANSFER_TIMEOUT 10
+#define PACMAN_TRANSFER_PROXY_PORT 3128
+
+/* validators are kept with the file itself, so they go away with it */
+#define PACMAN_TRANSFER_ETAG_ATTRIBUTE "xattr::pacman-glib.etag"
+
+typedef struct {
+	const gchar *name;
+	gchar *filename;
+	gchar *partname;
+	gboolean force;
+	
+	/* only this part of the file is fetched, unless the length is zero */
+	guint64 offset;
+	guint64 length;
+	
+	PacmanTransferProgressFunc func;
+	gpointer user_data;
+	GCancellable *cancellable;
+	
+	gint fd;
+	guchar *buffer;
+	GChecksum *checksum;
+	guint64 complete;
+	guint64 total;
+	time_t modified;
+	gchar *etag;
+	
+	/* for ranking mirrors */
+	gint64 latency;
+	gint64 started;
+	guint64 resumed;
+} PacmanTransfer;
+
+static const gchar *pacman_transfer_days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const gchar *pacman_transfer_months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static gchar *pacman_transfer_format_date (time_t time) {
+	struct tm date;
+	
+	/* strftime would use the names from the current locale */
+	gmtime_r (&time, &date);
+	return g_strdup_printf ("%s, %02d %s %04d %02d:%02d:%02d GMT", pacman_transfer_days[date.tm_wday], date.tm_mday, pacman_transfer_months[date.tm_mon], date.tm_year + 1900, date.tm_hour, date.tm_min, date.tm_sec);
+}
+
+static time_t pacman_transfer_parse_date (const gchar *string) {
+	struct tm date = { 0 };
+	gchar month[4];
+	gint i;
+	
+	g_return_val_if_fail (string != NULL, 0);
+	
+	if (sscanf (string, "%*3s, %d %3s %d %d:%d:%d", &date.tm_mday, month, &date.tm_year, &date.tm_hour, &date.tm_min, &date.tm_sec) != 6) {
+		return 0;
+	}
+	
+	for (i = 0; i < 12; ++i) {
+		if (g_ascii_strcasecmp (month, pacman_transfer_months[i]) == 0) {
+			date.tm_mon = i;
+			date.tm_year -= 1900;
+			return timegm (&date);
+		}
+	}
+	
+	return 0;
+}
+
+static gchar *pacman_transfer_get_etag (const gchar *filename) {
+	GFile *file;
+	GFileInfo *info;
+	gchar *result = NULL;
+	
+	g_return_val_if_fail (filename != NULL, NULL);
+	
+	file = g_file_new_for_path (filename);
+	info = g_file_query_info (file, PACMAN_TRANSFER_ETAG_ATTRIBUTE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if (info != NULL) {
+		result = g_strdup (g_file_info_get_attribute_string (info, PACMAN_TRANSFER_ETAG_ATTRIBUTE));
+		g_object_unref (info);
+	}
+	
+	g_object_unref (file);
+	return result;
+}
+
+static void pacman_transfer_set_etag (const gchar *filename, const gchar *etag) {
+	GFile *file;
+	
+	g_return_if_fail (filename != NULL);
+	g_return_if_fail (etag != NULL);
+	
+	/* not every file system supports this, in which case only the modification time is used */
+	file = g_file_new_for_path (filename);
+	g_file_set_attribute_string (file, PACMAN_TRANSFER_ETAG_ATTRIBUTE, etag, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	g_object_unref (file);
+}
+
+static void pacman_transfer_progress (PacmanTransfer *transfer) {
+	g_return_if_fail (transfer != NULL);
+	
+	if (transfer->func != NULL) {
+		transfer->func (transfer->name, transfer->complete, transfer->total, transfer->user_data);
+	}
+}
+
+static gboolean pacman_transfer_open (PacmanTransfer *transfer, gboolean resume, GError **error) {
+	g_return_val_if_fail (transfer != NULL, FALSE);
+	
+	if (transfer->fd >= 0) {
+		close (transfer->fd);
+	}
+	
+	/* segments are written into a file that has already been created at its full size */
+	if (transfer->length > 0) {
+		transfer->fd = g_open (transfer->partname, O_WRONLY | O_CLOEXEC, 0644);
+	} else {
+		transfer->fd = g_open (transfer->partname, O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+	}
+	
+	if (transfer->fd < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not open %s: %s"), transfer->partname, g_strerror (errno));
+		return FALSE;
+	}
+	
+	transfer->complete = 0;
+	transfer->started = g_get_monotonic_time ();
+	if (transfer->checksum != NULL) {
+		g_checksum_reset (transfer->checksum);
+	}
+	
+	/* so that a later attempt only carries on from this one if the file has not changed */
+	if (!resume && transfer->length == 0 && transfer->etag != NULL) {
+		pacman_transfer_set_etag (transfer->partname, transfer->etag);
+	}
+	
+	/* the part downloaded earlier has to be hashed once, which also seeks to the end */
+	if (resume) {
+		gssize length;
+		
+		while ((length = read (transfer->fd, transfer->buffer, PACMAN_TRANSFER_BUFFER_SIZE)) != 0) {
+			if (length > 0) {
+				g_checksum_update (transfer->checksum, transfer->buffer, length);
+				transfer->complete += length;
+			} else if (errno != EINTR) {
+				g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not read %s: %s"), transfer->partname, g_strerror (errno));
+				return FALSE;
+			}
+		}
+	}
+	
+	transfer->resumed = transfer->complete;
+	return TRUE;
+}
+
+static gboolean pacman_transfer_write (PacmanTransfer *transfer, gsize length, GError **error) {
+	gsize written = 0;
+	
+	g_return_val_if_fail (transfer != NULL, FALSE);
+	
+	/* hash the data while it is still in memory, rather than reading the whole file back later */
+	if (transfer->checksum != NULL) {
+		g_checksum_update (transfer->checksum, transfer->buffer, length);
+	}
+	
+	while (written < length) {
+		gssize result;
+		
+		if (transfer->length > 0) {
+			result = pwrite (transfer->fd, transfer->buffer + written, length - written, (off_t) (transfer->offset + transfer->complete + written));
+		} else {
+			result = write (transfer->fd, transfer->buffer + written, length - written);
+		}
+		
+		if (result >= 0) {
+			written += result;
+		} else if (errno != EINTR) {
+			g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), transfer->partname, g_strerror (errno));
+			return FALSE;
+		}
+	}
+	
+	transfer->complete += length;
+	pacman_transfer_progress (transfer);
+	return TRUE;
+}
+
+static gboolean pacman_transfer_copy (PacmanTransfer *transfer, GInputStream *stream, gint64 length, GError **error) {
+	g_return_val_if_fail (transfer != NULL, FALSE);
+	g_return_val_if_fail (stream != NULL, FALSE);
+	
+	/* a negative length means read until the connection is closed */
+	while (length != 0) {
+		gsize size = PACMAN_TRANSFER_BUFFER_SIZE;
+		gssize result;
+		
+		if (length > 0 && length < (gint64) size) {
+			size = (gsize) length;
+		}
+		
+		result = g_input_stream_read (stream, transfer->buffer, size, transfer->cancellable, error);
+		if (result < 0) {
+			return FALSE;
+		} else if (result == 0) {
+			if (length > 0) {
+				g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), transfer->name, _("The connection was closed early"));
+				return FALSE;
+			}
+			
+			break;
+		}
+		
+		if (!pacman_transfer_write (transfer, (gsize) result, error)) {
+			return FALSE;
+		}
+		
+		if (length > 0) {
+			length -= result;
+		}
+	}
+	
+	return TRUE;
+}
+
+static gboolean pacman_transfer_copy_chunked (PacmanTransfer *transfer, GDataInputStream *stream, GError **error) {
+	g_return_val_if_fail (transfer != NULL, FALSE);
+	g_return_val_if_fail (stream != NULL, FALSE);
+	
+	for (;;) {
+		GError *e = NULL;
+		gchar *line = g_data_input_stream_read_line (stream, NULL, transfer->cancellable, &e);
+		guint64 size;
+		
+		if (line == NULL) {
+			if (e != NULL) {
+				g_propagate_error (error, e);
+			} else {
+				g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), transfer->name, _("The connection was closed early"));
+			}
+			return FALSE;
+		}
+		
+		size = g_ascii_strtoull (line, NULL, 16);
+		g_free (line);
+		
+		/* the connection is closed afterwards, so any trailers can be ignored */
+		if (size == 0) {
+			return TRUE;
+		}
+		
+		if (!pacman_transfer_copy (transfer, G_INPUT_STREAM (stream), (gint64) size, error)) {
+			return FALSE;
+		}
+		
+		/* the line break after each chunk */
+		g_free (g_data_input_stream_read_line (stream, NULL, transfer->cancellable, NULL));
+	}
+}
+
+static gchar *pacman_transfer_resolve (const gchar *url, const gchar *location) {
+	const gchar *authority, *resource, *directory;
+	
+	g_return_val_if_fail (url != NULL, NULL);
+	g_return_val_if_fail (location != NULL, NULL);
+	
+	authority = strstr (url, "://");
+	if (strstr (location, "://") != NULL || authority == NULL) {
+		return g_strdup (location);
+	} else if (g_str_has_prefix (location, "//")) {
+		return g_strdup_printf ("%.*s%s", (gint) (authority - url + 1), url, location);
+	}
+	
+	resource = authority + 3 + strcspn (authority + 3, "/?#");
+	if (location[0] == '/') {
+		return g_strdup_printf ("%.*s%s", (gint) (resource - url), url, location);
+	}
+	
+	directory = strrchr (resource, '/');
+	if (directory == NULL) {
+		return g_strdup_printf ("%.*s/%s", (gint) (resource - url), url, location);
+	} else {
+		return g_strdup_printf ("%.*s%s", (gint) (directory - url + 1), url, location);
+	}
+}
+
+static gint pacman_transfer_fetch (PacmanTransfer *transfer, const gchar *url, guint redirects, GError **error);
+
+static gchar *pacman_transfer_split_credentials (gchar *host) {
+	gchar *at, *user, *plain, *result = NULL;
+	
+	g_return_val_if_fail (host != NULL, NULL);
+	
+	at = strrchr (host, '@');
+	if (at == NULL) {
+		return NULL;
+	}
+	
+	user = g_strndup (host, at - host);
+	plain = g_uri_unescape_string (user, NULL);
+	if (plain != NULL) {
+		result = g_base64_encode ((const guchar *) plain, strlen (plain));
+	}
+	
+	memmove (host, at + 1, strlen (at + 1) + 1);
+	g_free (plain);
+	g_free (user);
+	return result;
+}
+
+static gboolean pacman_transfer_is_direct (const gchar *url, const gchar *exceptions) {
+	const gchar *authority;
+	gchar *host, *end, **entries, **i;
+	gboolean result = FALSE;
+	
+	g_return_val_if_fail (url != NULL, TRUE);
+	g_return_val_if_fail (exceptions != NULL, TRUE);
+	
+	authority = strstr (url, "://") + 3;
+	host = g_ascii_strdown (authority, strcspn (authority, "/?#"));
+	g_free (pacman_transfer_split_credentials (host));
+	
+	/* compare the host name alone */
+	end = (host[0] == '[') ? strchr (host, ']') : strchr (host, ':');
+	if (end != NULL) {
+		end[host[0] == '[' ? 1 : 0] = '\0';
+	}
+	
+	entries = g_strsplit_set (exceptions, ", ", -1);
+	for (i = entries; *i != NULL && !result; ++i) {
+		gchar *entry = g_ascii_strdown (g_strstrip (*i), -1), *suffix = (entry[0] == '.') ? entry + 1 : entry;
+		gsize length = strlen (host), suffix_length = strlen (suffix);
+		
+		if (g_strcmp0 (entry, "*") == 0) {
+			result = TRUE;
+		} else if (suffix_length > 0 && g_str_has_suffix (host, suffix)) {
+			result = (length == suffix_length || host[length - suffix_length - 1] == '.');
+		}
+		
+		g_free (entry);
+	}
+	
+	g_strfreev (entries);
+	g_free (host);
+	return result;
+}
+
+static gchar *pacman_transfer_get_proxy (const gchar *url) {
+	const gchar *proxy, *exceptions;
+	
+	g_return_val_if_fail (url != NULL, NULL);
+	
+	/* the same variables libfetch reads */
+	proxy = g_getenv ("HTTP_PROXY");
+	if (proxy == NULL) {
+		proxy = g_getenv ("http_proxy");
+	}
+	if (proxy == NULL || proxy[0] == '\0') {
+		return NULL;
+	}
+	
+	exceptions = g_getenv ("NO_PROXY");
+	if (exceptions == NULL) {
+		exceptions = g_getenv ("no_proxy");
+	}
+	if (exceptions != NULL && pacman_transfer_is_direct (url, exceptions)) {
+		return NULL;
+	}
+	
+	if (strstr (proxy, "://") == NULL) {
+		return g_strconcat ("http://", proxy, NULL);
+	} else {
+		return g_strdup (proxy);
+	}
+}
+
+static GString *pacman_transfer_request (PacmanTransfer *transfer, const gchar *url, const gchar *proxy, guint64 offset) {
+	const gchar *authority, *resource, *user_agent;
+	gchar *host, *credentials, *proxy_credentials = NULL;
+	GString *request;
+	struct stat info;
+	
+	g_return_val_if_fail (transfer != NULL, NULL);
+	g_return_val_if_fail (url != NULL, NULL);
+	
+	authority = strstr (url, "://") + 3;
+	resource = authority + strcspn (authority, "/?#");
+	host = g_strndup (authority, resource - authority);
+	credentials = pacman_transfer_split_credentials (host);
+	
+	request = g_string_new ("GET ");
+	if (proxy != NULL) {
+		const gchar *proxy_authority = strstr (proxy, "://") + 3;
+		gchar *proxy_host = g_strndup (proxy_authority, strcspn (proxy_authority, "/?#"));
+		
+		/* proxies are sent the whole URL, without the credentials */
+		proxy_credentials = pacman_transfer_split_credentials (proxy_host);
+		g_string_append_printf (request, "http://%s", host);
+		g_free (proxy_host);
+	}
+	
+	if (resource[0] == '/') {
+		g_string_append_len (request, resource, strcspn (resource, "#"));
+	} else {
+		g_string_append_c (request, '/');
+		g_string_append_len (request, resource, strcspn (resource, "#"));
+	}
+	
+	user_agent = g_getenv ("HTTP_USER_AGENT");
+	if (user_agent == NULL) {
+		user_agent = PACKAGE_TARNAME "/" PACKAGE_VERSION;
+	}
+	
+	g_string_append_printf (request, " HTTP/1.1\r\nHost: %s\r\nUser-Agent: %s\r\nAccept-Encoding: identity\r\nConnection: close\r\n", host, user_agent);
+	if (credentials != NULL) {
+		g_string_append_printf (request, "Authorization: Basic %s\r\n", credentials);
+	}
+	if (proxy_credentials != NULL) {
+		g_string_append_printf (request, "Proxy-Authorization: Basic %s\r\n", proxy_credentials);
+	}
+	if (transfer->length > 0) {
+		g_string_append_printf (request, "Range: bytes=%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "\r\n", transfer->offset, transfer->offset + transfer->length - 1);
+	} else if (offset > 0) {
+		gchar *etag = pacman_transfer_get_etag (transfer->partname);
+		
+		/* the whole file is sent instead if it changed since the earlier attempt */
+		g_string_append_printf (request, "Range: bytes=%" G_GUINT64_FORMAT "-\r\n", offset);
+		if (etag != NULL && !g_str_has_prefix (etag, "W/")) {
+			g_string_append_printf (request, "If-Range: %s\r\n", etag);
+		}
+		
+		g_free (etag);
+	}
+	
+	/* the same as libalpm, which only downloads databases that have changed */
+	if (!transfer->force && transfer->length == 0 && g_stat (transfer->filename, &info) == 0) {
+		gchar *date = pacman_transfer_format_date (info.st_mtime), *etag = pacman_transfer_get_etag (transfer->filename);
+		
+		g_string_append_printf (request, "If-Modified-Since: %s\r\n", date);
+		if (etag != NULL) {
+			g_string_append_printf (request, "If-None-Match: %s\r\n", etag);
+		}
+		
+		g_free (etag);
+		g_free (date);
+	}
+	
+	g_string_append (request, "\r\n");
+	
+	g_free (proxy_credentials);
+	g_free (credentials);
+	g_free (host);
+	return request;
+}
+
+static gint pacman_transfer_http (PacmanTransfer *transfer, const gchar *url, gboolean secure, guint redirects, GError **error) {
+	GSocketClient *client;
+	GSocketConnection *connection;
+	GDataInputStream *input;
+	GString *request;
+	gchar *proxy, *line, *location = NULL;
+	gboolean chunked = FALSE;
+	gint64 length = -1;
+	guint64 offset = 0;
+	guint status = 0;
+	gint result = -1;
+	struct stat info;
+	
+	g_return_val_if_fail (transfer != NULL, -1);
+	g_return_val_if_fail (url != NULL, -1);
+	
+	/* carry on from an earlier attempt, like libalpm does */
+	if (transfer->length == 0 && g_stat (transfer->partname, &info) == 0 && info.st_size > 0) {
+		offset = (guint64) info.st_size;
+	}
+	
+	client = g_socket_client_new ();
+	g_socket_client_set_timeout (client, PACMAN_TRANSFER_TIMEOUT);
+	g_socket_client_set_tls (client, secure);
+	
+	/* HTTPS is left to whatever proxy resolver GIO has */
+	proxy = secure ? NULL : pacman_transfer_get_proxy (url);
+	if (proxy != NULL) {
+		g_socket_client_set_enable_proxy (client, FALSE);
+	}
+	
+	transfer->latency = g_get_monotonic_time ();
+	if (proxy != NULL) {
+		connection = g_socket_client_connect_to_uri (client, proxy, PACMAN_TRANSFER_PROXY_PORT, transfer->cancellable, error);
+	} else {
+		connection = g_socket_client_connect_to_uri (client, url, secure ? 443 : 80, transfer->cancellable, error);
+	}
+	transfer->latency = g_get_monotonic_time () - transfer->latency;
+	
+	g_object_unref (client);
+	if (connection == NULL) {
+		g_free (proxy);
+		return -1;
+	}
+	
+	request = pacman_transfer_request (transfer, url, proxy, offset);
+	g_free (proxy);
+	if (!g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (connection)), request->str, request->len, NULL, transfer->cancellable, error)) {
+		g_string_free (request, TRUE);
+		g_object_unref (connection);
+		return -1;
+	}
+	
+	g_string_free (request, TRUE);
+	input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	g_data_input_stream_set_newline_type (input, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+	
+	line = g_data_input_stream_read_line (input, NULL, transfer->cancellable, NULL);
+	if (line == NULL || sscanf (line, "HTTP/%*u.%*u %u", &status) != 1) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), transfer->name, _("The server sent an invalid response"));
+		g_free (line);
+		g_object_unref (input);
+		g_object_unref (connection);
+		return -1;
+	}
+	
+	g_free (line);
+	g_free (transfer->etag);
+	transfer->etag = NULL;
+	
+	while ((line = g_data_input_stream_read_line (input, NULL, transfer->cancellable, NULL)) != NULL && line[0] != '\0') {
+		gchar *value = strchr (line, ':');
+		
+		if (value != NULL) {
+			*value++ = '\0';
+			value = g_strstrip (value);
+			
+			if (g_ascii_strcasecmp (line, "Content-Length") == 0) {
+				length = g_ascii_strtoll (value, NULL, 10);
+			} else if (g_ascii_strcasecmp (line, "Transfer-Encoding") == 0) {
+				chunked = (g_ascii_strcasecmp (value, "chunked") == 0);
+			} else if (g_ascii_strcasecmp (line, "Location") == 0) {
+				g_free (location);
+				location = g_strdup (value);
+			} else if (g_ascii_strcasecmp (line, "Last-Modified") == 0) {
+				transfer->modified = pacman_transfer_parse_date (value);
+			} else if (g_ascii_strcasecmp (line, "ETag") == 0) {
+				g_free (transfer->etag);
+				transfer->etag = g_strdup (value);
+			}
+		}
+		
+		g_free (line);
+	}
+	
+	if (line == NULL) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), transfer->name, _("The server sent an invalid response"));
+	} else if (transfer->length > 0 && status / 100 == 2 && (status != 206 || chunked || length != (gint64) transfer->length)) {
+		/* anything else would have to be read in full and most of it thrown away */
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), url, _("The server does not support partial downloads"));
+	} else if (status == 200 || status == 206) {
+		if (pacman_transfer_open (transfer, status == 206 && offset > 0, error)) {
+			transfer->total = (length >= 0) ? transfer->complete + (guint64) length : 0;
+			pacman_transfer_progress (transfer);
+			
+			if (chunked) {
+				result = pacman_transfer_copy_chunked (transfer, input, error) ? 0 : -1;
+			} else {
+				result = pacman_transfer_copy (transfer, G_INPUT_STREAM (input), length, error) ? 0 : -1;
+			}
+		}
+	} else if (status == 304) {
+		result = 1;
+	} else if (status == 416 && offset > 0 && redirects > 0) {
+		/* the part downloaded earlier is no use */
+		g_unlink (transfer->partname);
+		result = pacman_transfer_http (transfer, url, secure, redirects - 1, error);
+	} else if (status / 100 == 3 && location != NULL && redirects > 0) {
+		gchar *target = pacman_transfer_resolve (url, location);
+		result = pacman_transfer_fetch (transfer, target, redirects - 1, error);
+		g_free (target);
+	} else {
+		gchar *reason = g_strdup_printf (_("The server returned status %u"), status);
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), url, reason);
+		g_free (reason);
+	}
+	
+	g_free (line);
+	g_free (location);
+	g_object_unref (input);
+	g_object_unref (connection);
+	return result;
+}
+
+static gint pacman_transfer_file (PacmanTransfer *transfer, const gchar *url, GError **error) {
+	GFile *file;
+	GFileInfo *info;
+	GFileInputStream *input;
+	struct stat existing;
+	gint result = -1;
+	
+	g_return_val_if_fail (transfer != NULL, -1);
+	g_return_val_if_fail (url != NULL, -1);
+	
+	/* local files, or anything else GIO knows how to read */
+	file = g_file_new_for_uri (url);
+	info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, transfer->cancellable, error);
+	if (info == NULL) {
+		g_object_unref (file);
+		return -1;
+	}
+	
+	transfer->modified = (time_t) g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	transfer->total = (guint64) g_file_info_get_size (info);
+	g_object_unref (info);
+	
+	if (!transfer->force && transfer->modified > 0 && g_stat (transfer->filename, &existing) == 0 && existing.st_mtime >= transfer->modified) {
+		g_object_unref (file);
+		return 1;
+	}
+	
+	input = g_file_read (file, transfer->cancellable, error);
+	if (input != NULL) {
+		if (pacman_transfer_open (transfer, FALSE, error)) {
+			pacman_transfer_progress (transfer);
+			result = pacman_transfer_copy (transfer, G_INPUT_STREAM (input), -1, error) ? 0 : -1;
+		}
+		
+		g_object_unref (input);
+	}
+	
+	g_object_unref (file);
+	return result;
+}
+
+static gint pacman_transfer_fetch (PacmanTransfer *transfer, const gchar *url, guint redirects, GError **error) {
+	gchar *scheme;
+	gint result;
+	
+	g_return_val_if_fail (transfer != NULL, -1);
+	g_return_val_if_fail (url != NULL, -1);
+	
+	scheme = g_uri_parse_scheme (url);
+	if (scheme == NULL) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SERVER_INVALID_URL, _("Could not download %s: %s"), url, alpm_strerror (PACMAN_ERROR_SERVER_INVALID_URL));
+		return -1;
+	}
+	
+	if (g_ascii_strcasecmp (scheme, "http") == 0) {
+		result = pacman_transfer_http (transfer, url, FALSE, redirects, error);
+	} else if (g_ascii_strcasecmp (scheme, "https") == 0) {
+		result = pacman_transfer_http (transfer, url, TRUE, redirects, error);
+	} else if (transfer->length > 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_FAILED, _("Could not download %s: %s"), url, _("The server does not support partial downloads"));
+		result = -1;
+	} else {
+		result = pacman_transfer_file (transfer, url, error);
+	}
+	
+	g_free (scheme);
+	return result;
+}
+
+static gboolean pacman_transfer_finish (PacmanTransfer *transfer, GError **error) {
+	g_return_val_if_fail (transfer != NULL, FALSE);
+	
+	if (close (transfer->fd) < 0) {
+		transfer->fd = -1;
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), transfer->partname, g_strerror (errno));
+		return FALSE;
+	}
+	
+	transfer->fd = -1;
+	if (transfer->modified > 0) {
+		struct timeval times[2] = { { transfer->modified, 0 }, { transfer->modified, 0 } };
+		utimes (transfer->partname, times);
+	}
+	
+	if (g_rename (transfer->partname, transfer->filename) < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not rename %s: %s"), transfer->partname, g_strerror (errno));
+		return FALSE;
+	}
+	
+	/* the integrity check can look this up instead of reading the file again */
+	pacman_checksum_remember (transfer->filename, g_checksum_get_string (transfer->checksum));
+	return TRUE;
+}
+
+gint pacman_transfer_download (const gchar *url, const gchar *path, gboolean force, PacmanTransferProgressFunc func, gpointer user_data, GCancellable *cancellable, GError **error) {
+	PacmanTransfer transfer = { 0 };
+	const gchar *name;
+	gint result;
+	
+	g_return_val_if_fail (url != NULL, -1);
+	g_return_val_if_fail (path != NULL, -1);
+	
+	name = strrchr (url, '/');
+	if (name == NULL || name[1] == '\0') {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SERVER_INVALID_URL, _("Could not download %s: %s"), url, alpm_strerror (PACMAN_ERROR_SERVER_INVALID_URL));
+		return -1;
+	}
+	
+	transfer.name = name + 1;
+	transfer.filename = g_build_filename (path, transfer.name, NULL);
+	transfer.partname = g_strconcat (transfer.filename, ".part", NULL);
+	transfer.force = force;
+	
+	transfer.func = func;
+	transfer.user_data = user_data;
+	transfer.cancellable = cancellable;
+	
+	transfer.fd = -1;
+	transfer.buffer = (guchar *) g_malloc (PACMAN_TRANSFER_BUFFER_SIZE);
+	transfer.checksum = g_checksum_new (G_CHECKSUM_MD5);
+	transfer.latency = -1;
+	
+	result = pacman_transfer_fetch (&transfer, url, PACMAN_TRANSFER_REDIRECTS, error);
+	if (result == 0) {
+		pacman_mirror_record_success (url, transfer.latency, transfer.complete - transfer.resumed, g_get_monotonic_time () - transfer.started);
+		if (!pacman_transfer_finish (&transfer, error)) {
+			result = -1;
+		}
+	} else if (result > 0) {
+		pacman_mirror_record_success (url, transfer.latency, 0, 0);
+	} else if (!g_cancellable_is_cancelled (cancellable)) {
+		pacman_mirror_record_failure (url);
+	}
+	
+	/* the part file is kept so the next attempt can carry on from it */
+	if (transfer.fd >= 0) {
+		close (transfer.fd);
+	}
+	
+	g_checksum_free (transfer.checksum);
+	g_free (transfer.etag);
+	g_free (transfer.buffer);
+	g_free (transfer.partname);
+	g_free (transfer.filename);
+	return result;
+}
+
+static gint pacman_transfer_download_range (const gchar *url, const gchar *partname, guint64 offset, guint64 length, PacmanTransferProgressFunc func, gpointer user_data, GCancellable *cancellable, GError **error) {
+	PacmanTransfer transfer = { 0 };
+	gint result;
+	
+	g_return_val_if_fail (url != NULL, -1);
+	g_return_val_if_fail (partname != NULL, -1);
+	g_return_val_if_fail (length > 0, -1);
+	
+	transfer.name = strrchr (url, '/') != NULL ? strrchr (url, '/') + 1 : url;
+	transfer.partname = (gchar *) partname;
+	transfer.force = TRUE;
+	transfer.offset = offset;
+	transfer.length = length;
+	
+	transfer.func = func;
+	transfer.user_data = user_data;
+	transfer.cancellable = cancellable;
+	
+	/* segments arrive out of order, so the file is hashed once they have all been written */
+	transfer.fd = -1;
+	transfer.buffer = (guchar *) g_malloc (PACMAN_TRANSFER_BUFFER_SIZE);
+	transfer.latency = -1;
+	
+	result = pacman_transfer_fetch (&transfer, url, PACMAN_TRANSFER_REDIRECTS, error);
+	if (transfer.fd >= 0 && close (transfer.fd) < 0 && result == 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not write to %s: %s"), partname, g_strerror (errno));
+		result = -1;
+	}
+	
+	if (result == 0) {
+		pacman_mirror_record_success (url, transfer.latency, transfer.complete, g_get_monotonic_time () - transfer.started);
+	} else if (!g_cancellable_is_cancelled (cancellable)) {
+		pacman_mirror_record_failure (url);
+	}
+	
+	g_free (transfer.etag);
+	g_free (transfer.buffer);
+	return result;
+}
+
+struct _PacmanTransferCommand {
+	gchar **argv;
+	
+	/* arguments that contain %u or %o */
+	gboolean *expand;
+	gboolean output;
+};
+
+PacmanTransferCommand *pacman_transfer_command_new (const gchar *command, GError **error) {
+	PacmanTransferCommand *result;
+	gchar **argv;
+	gint argc, i;
+	
+	g_return_val_if_fail (command != NULL, NULL);
+	
+	/* split like a shell would, without running one for every download */
+	if (!g_shell_parse_argv (command, &argc, &argv, error)) {
+		return NULL;
+	}
+	
+	result = g_slice_new0 (PacmanTransferCommand);
+	result->argv = argv;
+	result->expand = g_new0 (gboolean, argc);
+	
+	for (i = 0; i < argc; ++i) {
+		result->expand[i] = (strstr (argv[i], "%u") != NULL || strstr (argv[i], "%o") != NULL);
+		if (strstr (argv[i], "%o") != NULL) {
+			result->output = TRUE;
+		}
+	}
+	
+	return result;
+}
+
+void pacman_transfer_command_free (PacmanTransferCommand *command) {
+	g_return_if_fail (command != NULL);
+	
+	g_strfreev (command->argv);
+	g_free (command->expand);
+	g_slice_free (PacmanTransferCommand, command);
+}
+
+static gchar *pacman_transfer_command_expand (const gchar *argument, const gchar *url, const gchar *output) {
+	GString *result = g_string_new (NULL);
+	
+	g_return_val_if_fail (argument != NULL, NULL);
+	
+	for (; *argument != '\0'; ++argument) {
+		if (argument[0] == '%' && argument[1] == 'u') {
+			g_string_append (result, url);
+			++argument;
+		} else if (argument[0] == '%' && argument[1] == 'o') {
+			g_string_append (result, output);
+			++argument;
+		} else {
+			g_string_append_c (result, *argument);
+		}
+	}
+	
+	return g_string_free (result, FALSE);
+}
+
+gint pacman_transfer_command_run (PacmanTransferCommand *command, const gchar *url, const gchar *path, gboolean force, GError **error) {
+	gchar **argv, *basename, *filename, *tempname;
+	gint status = -1, i, argc;
+	
+	g_return_val_if_fail (command != NULL, -1);
+	g_return_val_if_fail (url != NULL, -1);
+	g_return_val_if_fail (path != NULL, -1);
+	
+	basename = g_path_get_basename (url);
+	filename = g_build_filename (path, basename, NULL);
+	tempname = g_strconcat (filename, ".part", NULL);
+	
+	if (force) {
+		g_unlink (tempname);
+		g_unlink (filename);
+	}
+	
+	argc = (gint) g_strv_length (command->argv);
+	argv = g_new0 (gchar *, argc + 1);
+	for (i = 0; i < argc; ++i) {
+		argv[i] = command->expand[i] ? pacman_transfer_command_expand (command->argv[i], url, tempname) : g_strdup (command->argv[i]);
+	}
+	
+	/* the child changes directory, so this is safe to run from several threads at once */
+	if (!g_spawn_sync (path, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, &status, error)) {
+		status = -1;
+	} else if (WIFEXITED (status) == 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_HANDLER, _("Transfer command did not terminate correctly"));
+		status = -1;
+	} else if (WEXITSTATUS (status) != EXIT_SUCCESS) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_HANDLER, _("Transfer command returned error code %d"), WEXITSTATUS (status));
+		status = -1;
+	} else if (command->output && g_rename (tempname, filename) < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_DOWNLOAD_HANDLER, _("Could not rename resulting file %s"), tempname);
+		status = -1;
+	} else {
+		status = 0;
+	}
+	
+	g_strfreev (argv);
+	g_free (tempname);
+	g_free (filename);
+	g_free (basename);
+	return status;
+}
+
+/* how often progress is reported for downloads that are running, in microseconds */
+#define PACMAN_TRANSFER_PROGRESS_INTERVAL (100 * 1000)
+
+/* large files are fetched in pieces of this size, from whichever mirrors are free */
+#define PACMAN_TRANSFER_SEGMENT_SIZE (8 * 1024 * 1024)
+#define PACMAN_TRANSFER_SEGMENT_THRESHOLD (4 * PACMAN_TRANSFER_SEGMENT_SIZE)
+
+typedef enum {
+	PACMAN_TRANSFER_TASK_WAITING,
+	PACMAN_TRANSFER_TASK_RUNNING,
+	PACMAN_TRANSFER_TASK_FINISHED
+} PacmanTransferTaskState;
+
+typedef struct {
+	GMutex mutex;
+	GAsyncQueue *finished;
+	PacmanTransferCommand *command;
+	GCancellable *cancellable;
+} PacmanTransferScheduler;
+
+typedef struct _PacmanTransferTask PacmanTransferTask;
+
+typedef struct {
+	gchar *filename;
+	gchar *partname;
+	
+	/* the segments are next to each other in the list of tasks */
+	PacmanTransferTask *segments;
+	guint count;
+	guint remaining;
+	gboolean failed;
+} PacmanTransferAssembly;
+
+struct _PacmanTransferTask {
+	PacmanTransferJob *job;
+	PacmanTransferScheduler *scheduler;
+	PacmanTransferTaskState state;
+	
+	/* the mirror being tried */
+	const PacmanList *url;
+	const gchar *name;
+	
+	/* for segments, the part of the file to fetch and the mirror that failed last */
+	PacmanTransferAssembly *assembly;
+	guint64 offset;
+	guint64 length;
+	const PacmanList *failed;
+	guint attempts;
+	
+	/* updated by the worker, under the scheduler mutex */
+	guint64 complete;
+	guint64 total;
+	
+	gint result;
+	GError *error;
+};
+
+PacmanTransferJob *pacman_transfer_job_new (const gchar *path, gboolean force) {
+	PacmanTransferJob *result;
+	
+	g_return_val_if_fail (path != NULL, NULL);
+	
+	result = g_slice_new0 (PacmanTransferJob);
+	result->path = g_strdup (path);
+	result->force = force;
+	result->result = -1;
+	return result;
+}
+
+void pacman_transfer_job_free (PacmanTransferJob *job) {
+	g_return_if_fail (job != NULL);
+	
+	pacman_list_free_full (job->urls, g_free);
+	g_free (job->md5sum);
+	g_free (job->path);
+	if (job->error != NULL) {
+		g_error_free (job->error);
+	}
+	g_slice_free (PacmanTransferJob, job);
+}
+
+static const gchar *pacman_transfer_job_get_name (PacmanTransferJob *job) {
+	const gchar *url;
+	
+	g_return_val_if_fail (job != NULL, NULL);
+	
+	url = (const gchar *) pacman_list_get (job->urls);
+	return (url != NULL && strrchr (url, '/') != NULL) ? strrchr (url, '/') + 1 : url;
+}
+
+static PacmanTransferAssembly *pacman_transfer_assembly_new (PacmanTransferJob *job, PacmanTransferCommand *command) {
+	PacmanTransferAssembly *result;
+	const PacmanList *i;
+	gchar *filename, *partname;
+	guint mirrors = 0;
+	gint fd;
+	
+	g_return_val_if_fail (job != NULL, NULL);
+	
+	/* transfer commands only fetch whole files */
+	if (command != NULL || job->size < PACMAN_TRANSFER_SEGMENT_THRESHOLD) {
+		return NULL;
+	}
+	
+	for (i = job->urls; i != NULL; i = pacman_list_next (i), ++mirrors) {
+		const gchar *url = (const gchar *) pacman_list_get (i);
+		
+		if (g_ascii_strncasecmp (url, "http://", 7) != 0 && g_ascii_strncasecmp (url, "https://", 8) != 0) {
+			return NULL;
+		}
+	}
+	
+	if (mirrors < 2) {
+		return NULL;
+	}
+	
+	/* an existing file is checked for changes, and an earlier attempt is carried on from, by a single download instead */
+	filename = g_build_filename (job->path, pacman_transfer_job_get_name (job), NULL);
+	partname = g_strconcat (filename, ".part", NULL);
+	if ((!job->force && g_file_test (filename, G_FILE_TEST_EXISTS)) || g_file_test (partname, G_FILE_TEST_EXISTS)) {
+		g_free (partname);
+		g_free (filename);
+		return NULL;
+	}
+	
+	/* each segment is written at its own offset */
+	fd = g_open (partname, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate (fd, (off_t) job->size) < 0) {
+		if (fd >= 0) {
+			close (fd);
+			g_unlink (partname);
+		}
+		
+		g_free (partname);
+		g_free (filename);
+		return NULL;
+	}
+	
+	close (fd);
+	
+	result = g_slice_new0 (PacmanTransferAssembly);
+	result->filename = filename;
+	result->partname = partname;
+	result->count = (guint) ((job->size + PACMAN_TRANSFER_SEGMENT_SIZE - 1) / PACMAN_TRANSFER_SEGMENT_SIZE);
+	result->remaining = result->count;
+	return result;
+}
+
+static void pacman_transfer_assembly_free (PacmanTransferAssembly *assembly) {
+	g_return_if_fail (assembly != NULL);
+	
+	g_free (assembly->partname);
+	g_free (assembly->filename);
+	g_slice_free (PacmanTransferAssembly, assembly);
+}
+
+static gint pacman_transfer_assemble (PacmanTransferJob *job, PacmanTransferAssembly *assembly, GError **error) {
+	gchar *md5sum;
+	
+	g_return_val_if_fail (job != NULL, -1);
+	g_return_val_if_fail (assembly != NULL, -1);
+	
+	if (assembly->failed) {
+		g_unlink (assembly->partname);
+		return -1;
+	}
+	
+	/* the segments were written out of order, so the file can only be hashed now */
+	md5sum = pacman_checksum_file (assembly->partname, error);
+	if (md5sum == NULL) {
+		g_unlink (assembly->partname);
+		return -1;
+	}
+	
+	if (job->md5sum != NULL && g_ascii_strcasecmp (md5sum, job->md5sum) != 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_PACKAGE_INVALID, _("Could not download %s: %s"), pacman_transfer_job_get_name (job), _("The MD5 sum does not match"));
+		g_unlink (assembly->partname);
+		g_free (md5sum);
+		return -1;
+	}
+	
+	if (g_rename (assembly->partname, assembly->filename) < 0) {
+		g_set_error (error, PACMAN_ERROR, PACMAN_ERROR_SYSTEM, _("Could not rename %s: %s"), assembly->partname, g_strerror (errno));
+		g_free (md5sum);
+		return -1;
+	}
+	
+	pacman_checksum_remember (assembly->filename, md5sum);
+	g_free (md5sum);
+	return 0;
+}
+
+static void pacman_transfer_task_progress (const gchar *filename, guint64 complete, guint64 total, gpointer user_data) {
+	PacmanTransferTask *task = (PacmanTransferTask *) user_data;
+	
+	g_mutex_lock (&task->scheduler->mutex);
+	task->complete = complete;
+	task->total = total;
+	g_mutex_unlock (&task->scheduler->mutex);
+}
+
+static void pacman_transfer_task_run (gpointer data, gpointer user_data) {
+	PacmanTransferTask *task = (PacmanTransferTask *) data;
+	PacmanTransferScheduler *scheduler = (PacmanTransferScheduler *) user_data;
+	const gchar *url = (const gchar *) pacman_list_get (task->url);
+	
+	if (task->assembly != NULL) {
+		task->result = pacman_transfer_download_range (url, task->assembly->partname, task->offset, task->length, pacman_transfer_task_progress, task, scheduler->cancellable, &task->error);
+	} else if (scheduler->command == NULL) {
+		task->result = pacman_transfer_download (url, task->job->path, task->job->force, pacman_transfer_task_progress, task, scheduler->cancellable, &task->error);
+	} else {
+		gint64 started = g_get_monotonic_time ();
+		
+		task->result = pacman_transfer_command_run (scheduler->command, url, task->job->path, task->job->force, &task->error);
+		if (task->result == 0) {
+			gchar *filename = g_build_filename (task->job->path, task->name, NULL);
+			struct stat info;
+			
+			/* the command does not report progress, so only the end is known */
+			if (g_stat (filename, &info) == 0) {
+				pacman_transfer_task_progress (task->name, (guint64) info.st_size, (guint64) info.st_size, task);
+				pacman_mirror_record_success (url, -1, (guint64) info.st_size, g_get_monotonic_time () - started);
+			}
+			
+			pacman_checksum_prefetch (filename);
+			g_free (filename);
+		} else {
+			pacman_mirror_record_failure (url);
+		}
+	}
+	
+	g_async_queue_push (scheduler->finished, task);
+}
+
+static const PacmanList *pacman_transfer_task_pick_mirror (PacmanTransferTask *task, GHashTable *servers, guint connections) {
+	const PacmanList *i, *result = NULL;
+	gboolean healthy = FALSE;
+	
+	g_return_val_if_fail (task != NULL, NULL);
+	
+	/* the mirrors are already sorted, so the first one with a connection to spare is the best */
+	for (i = task->job->urls; i != NULL; i = pacman_list_next (i)) {
+		const gchar *url = (const gchar *) pacman_list_get (i);
+		gchar *server;
+		guint count;
+		
+		if (i == task->failed) {
+			continue;
+		}
+		
+		server = pacman_mirror_get_host (url);
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (servers, server));
+		g_free (server);
+		
+		if (pacman_mirror_is_backing_off (url)) {
+			if (result == NULL && count < connections) {
+				result = i;
+			}
+		} else if (count < connections) {
+			return i;
+		} else {
+			healthy = TRUE;
+		}
+	}
+	
+	/* wait for a mirror that works, unless there are none */
+	return healthy ? NULL : result;
+}
+
+static void pacman_transfer_report (PacmanTransferTask *task, PacmanTransferProgressFunc func, gpointer user_data) {
+	guint64 complete, total;
+	
+	g_return_if_fail (task != NULL);
+	
+	g_mutex_lock (&task->scheduler->mutex);
+	complete = task->complete;
+	total = task->total;
+	g_mutex_unlock (&task->scheduler->mutex);
+	
+	if (func != NULL && total > 0) {
+		func (task->name, complete, total, user_data);
+	}
+}
+
+static void pacman_transfer_report_assembly (PacmanTransferAssembly *assembly, PacmanTransferProgressFunc func, gpointer user_data) {
+	PacmanTransferTask *first;
+	guint64 complete = 0;
+	guint n;
+	
+	g_return_if_fail (assembly != NULL);
+	
+	first = assembly->segments;
+	g_mutex_lock (&first->scheduler->mutex);
+	for (n = 0; n < assembly->count; ++n) {
+		PacmanTransferTask *task = &assembly->segments[n];
+		
+		if (task->state == PACMAN_TRANSFER_TASK_FINISHED && task->result == 0) {
+			complete += task->length;
+		} else if (task->state == PACMAN_TRANSFER_TASK_RUNNING) {
+			complete += task->complete;
+		}
+	}
+	g_mutex_unlock (&first->scheduler->mutex);
+	
+	if (func != NULL) {
+		func (first->name, complete, first->job->size, user_data);
+	}
+}
+
+void pacman_transfer_download_all (const PacmanList *jobs, guint parallel, guint connections, PacmanTransferCommand *command, PacmanTransferProgressFunc func, gpointer user_data, GCancellable *cancellable) {
+	PacmanTransferScheduler scheduler;
+	PacmanTransferAssembly **assemblies;
+	PacmanTransferTask *tasks;
+	GHashTable *servers;
+	GThreadPool *pool;
+	const PacmanList *i;
+	guint length, total, remaining, running = 0, n, m;
+	
+	length = pacman_list_length (jobs);
+	if (length == 0) {
+		return;
+	}
+	
+	parallel = MAX (parallel, 1);
+	connections = MAX (connections, 1);
+	
+	g_mutex_init (&scheduler.mutex);
+	scheduler.finished = g_async_queue_new ();
+	scheduler.command = command;
+	scheduler.cancellable = cancellable;
+	
+	/* large files become several tasks, one for each segment */
+	assemblies = g_new0 (PacmanTransferAssembly *, length);
+	for (i = jobs, n = 0, total = 0; i != NULL; i = pacman_list_next (i), ++n) {
+		assemblies[n] = pacman_transfer_assembly_new ((PacmanTransferJob *) pacman_list_get (i), command);
+		total += (assemblies[n] != NULL) ? assemblies[n]->count : 1;
+	}
+	
+	tasks = g_new0 (PacmanTransferTask, total);
+	for (i = jobs, n = 0, m = 0; i != NULL; i = pacman_list_next (i), ++n) {
+		PacmanTransferJob *job = (PacmanTransferJob *) pacman_list_get (i);
+		PacmanTransferAssembly *assembly = assemblies[n];
+		guint k, count = (assembly != NULL) ? assembly->count : 1;
+		
+		if (assembly != NULL) {
+			assembly->segments = &tasks[m];
+		}
+		
+		for (k = 0; k < count; ++k, ++m) {
+			tasks[m].job = job;
+			tasks[m].scheduler = &scheduler;
+			tasks[m].url = job->urls;
+			tasks[m].name = pacman_transfer_job_get_name (job);
+			tasks[m].state = (job->urls != NULL) ? PACMAN_TRANSFER_TASK_WAITING : PACMAN_TRANSFER_TASK_FINISHED;
+			
+			if (assembly != NULL) {
+				tasks[m].assembly = assembly;
+				tasks[m].offset = (guint64) k * PACMAN_TRANSFER_SEGMENT_SIZE;
+				tasks[m].length = MIN (PACMAN_TRANSFER_SEGMENT_SIZE, job->size - tasks[m].offset);
+			}
+		}
+	}
+	
+	/* number of downloads currently using each server */
+	servers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	pool = g_thread_pool_new (pacman_transfer_task_run, &scheduler, (gint) parallel, FALSE, NULL);
+	
+	for (n = 0, remaining = 0; n < total; ++n) {
+		if (tasks[n].state == PACMAN_TRANSFER_TASK_WAITING) {
+			++remaining;
+		}
+	}
+	
+	while (remaining > 0) {
+		PacmanTransferTask *task;
+		PacmanTransferAssembly *assembly;
+		gchar *server;
+		guint count;
+		
+		/* start downloads in order, as far as the limits allow */
+		for (n = 0; n < total && running < parallel; ++n) {
+			task = &tasks[n];
+			if (task->state != PACMAN_TRANSFER_TASK_WAITING) {
+				continue;
+			}
+			
+			if (task->assembly != NULL) {
+				/* segments go to whichever mirror is free, so faster mirrors end up fetching more of them */
+				const PacmanList *url = pacman_transfer_task_pick_mirror (task, servers, connections);
+				
+				if (url == NULL) {
+					continue;
+				}
+				
+				task->url = url;
+			} else {
+				/* fail over straight away from mirrors that failed recently, unless there is nothing left */
+				while (pacman_list_next (task->url) != NULL && pacman_mirror_is_backing_off ((const gchar *) pacman_list_get (task->url))) {
+					task->url = pacman_list_next (task->url);
+				}
+			}
+			
+			server = pacman_mirror_get_host ((const gchar *) pacman_list_get (task->url));
+			count = GPOINTER_TO_UINT (g_hash_table_lookup (servers, server));
+			if (count >= connections) {
+				g_free (server);
+				continue;
+			}
+			
+			g_hash_table_insert (servers, server, GUINT_TO_POINTER (count + 1));
+			task->state = PACMAN_TRANSFER_TASK_RUNNING;
+			task->complete = task->total = 0;
+			++running;
+			
+			g_thread_pool_push (pool, task, NULL);
+		}
+		
+		task = (PacmanTransferTask *) g_async_queue_timeout_pop (scheduler.finished, PACMAN_TRANSFER_PROGRESS_INTERVAL);
+		if (task == NULL) {
+			for (n = 0; n < total; ++n) {
+				assembly = tasks[n].assembly;
+				if (assembly == NULL && tasks[n].state == PACMAN_TRANSFER_TASK_RUNNING) {
+					pacman_transfer_report (&tasks[n], func, user_data);
+				} else if (assembly != NULL && assembly->segments == &tasks[n] && assembly->remaining > 0 && !assembly->failed) {
+					pacman_transfer_report_assembly (assembly, func, user_data);
+				}
+			}
+			
+			continue;
+		}
+		
+		--running;
+		server = pacman_mirror_get_host ((const gchar *) pacman_list_get (task->url));
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (servers, server));
+		g_hash_table_insert (servers, server, GUINT_TO_POINTER (count - 1));
+		
+		assembly = task->assembly;
+		if (assembly != NULL) {
+			if (task->result < 0 && !assembly->failed && ++task->attempts < pacman_list_length (task->job->urls) && !g_cancellable_is_cancelled (cancellable)) {
+				/* try the segment again from another mirror */
+				if (task->error != NULL) {
+					g_debug ("%s\n", task->error->message);
+					g_clear_error (&task->error);
+				}
+				
+				task->failed = task->url;
+				task->state = PACMAN_TRANSFER_TASK_WAITING;
+				continue;
+			}
+			
+			task->state = PACMAN_TRANSFER_TASK_FINISHED;
+			--assembly->remaining;
+			--remaining;
+			
+			if (task->result < 0 && !assembly->failed) {
+				/* the rest of the file is no use without this segment */
+				assembly->failed = TRUE;
+				task->job->error = task->error;
+				task->error = NULL;
+				
+				for (n = 0; n < assembly->count; ++n) {
+					if (assembly->segments[n].state == PACMAN_TRANSFER_TASK_WAITING) {
+						assembly->segments[n].state = PACMAN_TRANSFER_TASK_FINISHED;
+						--assembly->remaining;
+						--remaining;
+					}
+				}
+			} else if (task->error != NULL) {
+				g_clear_error (&task->error);
+			}
+			
+			if (assembly->remaining == 0) {
+				task->job->result = pacman_transfer_assemble (task->job, assembly, (task->job->error == NULL) ? &task->job->error : NULL);
+				if (task->job->result == 0) {
+					pacman_transfer_report_assembly (assembly, func, user_data);
+				}
+			}
+			
+			continue;
+		}
+		
+		if (task->result < 0 && pacman_list_next (task->url) != NULL && !g_cancellable_is_cancelled (cancellable)) {
+			/* try the next mirror */
+			if (task->error != NULL) {
+				g_debug ("%s\n", task->error->message);
+				g_clear_error (&task->error);
+			}
+			
+			task->url = pacman_list_next (task->url);
+			task->state = PACMAN_TRANSFER_TASK_WAITING;
+			continue;
+		}
+		
+		if (task->result == 0) {
+			pacman_transfer_report (task, func, user_data);
+		}
+		
+		task->job->result = task->result;
+		task->job->error = task->error;
+		task->state = PACMAN_TRANSFER_TASK_FINISHED;
+		--remaining;
+	}
+	
+	g_thread_pool_free (pool, FALSE, TRUE);
+	g_hash_table_unref (servers);
+	g_async_queue_unref (scheduler.finished);
+	g_mutex_clear (&scheduler.mutex);
+	
+	for (n = 0; n < length; ++n) {
+		if (assemblies[n] != NULL) {
+			pacman_transfer_assembly_free (assemblies[n]);
+		}
+	}
+	
+	g_free (assemblies);
+	g_free (tasks);
+}
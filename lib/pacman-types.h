@@ -29,6 +29,7 @@ G_BEGIN_DECLS
 
 typedef struct __pmconflict_t PacmanConflict;
 typedef struct __pmdb_t PacmanDatabase;
+typedef struct _PacmanDatabaseSnapshot PacmanDatabaseSnapshot;
 typedef struct __pmdelta_t PacmanDelta;
 typedef struct __pmdepend_t PacmanDependency;
 typedef struct __pmfileconflict_t PacmanFileConflict;
@@ -39,6 +40,7 @@ typedef struct _PacmanManager PacmanManager;
 typedef struct __pmdepmissing_t PacmanMissingDependency;
 typedef struct _PacmanModify PacmanModify;
 typedef struct __pmpkg_t PacmanPackage;
+typedef struct _PacmanQueue PacmanQueue;
 typedef struct _PacmanRemove PacmanRemove;
 typedef struct _PacmanSync PacmanSync;
 typedef struct _PacmanTransaction PacmanTransaction;
@@ -16,7 +16,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sys/stat.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <alpm.h>
 #include "pacman-error.h"
 #include "pacman-list.h"
@@ -142,8 +144,69 @@ static gboolean pacman_update_prepare (PacmanTransaction *transaction, const Pac
 	return TRUE;
 }
 
+static PacmanList *pacman_update_download (const PacmanList *databases, gboolean force) {
+	PacmanList *jobs = NULL, *kept = NULL, *unchanged = NULL;
+	const PacmanList *i, *j, *k;
+	gchar *path;
+	
+	g_return_val_if_fail (pacman_manager != NULL, NULL);
+	
+	path = g_build_filename (alpm_option_get_dbpath (), "sync", NULL);
+	for (i = databases; i != NULL; i = pacman_list_next (i)) {
+		PacmanDatabase *database = (PacmanDatabase *) pacman_list_get (i);
+		gchar *basename = g_strdup_printf ("%s.db.tar.gz", pacman_database_get_name (database));
+		gchar *filename = g_build_filename (path, basename, NULL);
+		PacmanTransferJob *job = pacman_transfer_job_new (path, force);
+		
+		for (j = pacman_database_get_servers (database); j != NULL; j = pacman_list_next (j)) {
+			job->urls = pacman_list_add (job->urls, g_strdup_printf ("%s/%s", (const gchar *) pacman_list_get (j), basename));
+		}
+		
+		/* a forced update unpacks the database even if it has not changed */
+		kept = pacman_list_add (kept, (!force && g_file_test (filename, G_FILE_TEST_EXISTS)) ? pacman_checksum_keep (filename) : NULL);
+		jobs = pacman_list_add (jobs, job);
+		
+		g_free (filename);
+		g_free (basename);
+	}
+	
+	/* alpm then finds each database already downloaded, and unpacks the ones that changed */
+	if (pacman_manager_download (pacman_manager, jobs, 0)) {
+		for (i = databases, j = jobs, k = kept; i != NULL; i = pacman_list_next (i), j = pacman_list_next (j), k = pacman_list_next (k)) {
+			PacmanTransferJob *job = (PacmanTransferJob *) pacman_list_get (j);
+			const gchar *before = (const gchar *) pacman_list_get (k);
+			gchar *basename, *filename;
+			gint result = job->result;
+			
+			/* anything that failed is left for alpm to try again and report */
+			if (result < 0) {
+				continue;
+			}
+			
+			basename = g_strdup_printf ("%s.db.tar.gz", pacman_database_get_name ((PacmanDatabase *) pacman_list_get (i)));
+			filename = g_build_filename (path, basename, NULL);
+			if (result == 0 && before != NULL && pacman_checksum_unchanged (before, filename)) {
+				result = 1;
+			}
+			
+			if (result > 0) {
+				unchanged = pacman_list_add (unchanged, pacman_list_get (i));
+			}
+			
+			pacman_manager_remember_fetch (pacman_manager, filename, result);
+			g_free (filename);
+			g_free (basename);
+		}
+	}
+	
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+	pacman_list_free_full (kept, (GDestroyNotify) pacman_checksum_discard);
+	g_free (path);
+	return unchanged;
+}
+
 static gboolean pacman_update_commit (PacmanTransaction *transaction, GError **error) {
-	PacmanList *i, *databases;
+	PacmanList *i, *databases, *unchanged;
 	gboolean force;
 	
 	g_return_val_if_fail (transaction != NULL, FALSE);
@@ -156,25 +219,57 @@ static gboolean pacman_update_commit (PacmanTransaction *transaction, GError **e
 		return FALSE;
 	}
 	
-	g_signal_emit_by_name (transaction, "download", NULL, (guint) 0, (guint) 0);
+	pacman_transaction_download (transaction, NULL, 0, 0);
 	pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DOWNLOAD_START, _("Downloading databases"));
+	unchanged = pacman_update_download (databases, force);
 	
 	for (i = databases; i != NULL; i = pacman_list_next (i)) {
 		PacmanDatabase *database = (PacmanDatabase *) pacman_list_get (i);
-		int result = alpm_db_update ((int) force, database);
+		int result;
+		
+		/* readers only wait once the new database has been downloaded, see pacman_database_begin_update() */
+		if (pacman_list_find_direct (unchanged, database) == NULL) {
+			pacman_database_expect_update (database);
+		}
+		
+		pacman_transaction_set_repository (transaction, pacman_database_get_name (database));
+		PACMAN_PROBE2 (database__update__start, pacman_database_get_name (database), force);
+		result = alpm_db_update ((int) force, database);
+		pacman_database_end_update (result == 0);
+		PACMAN_PROBE2 (database__update__done, pacman_database_get_name (database), result);
+		
+		if (result == 0) {
+			/* the old package cache is gone, and cached dependency results with it */
+			pacman_dependency_invalidate ();
+			pacman_statistics_forget_databases ();
+		}
 		
 		if (result > 0) {
 			gchar *filename = g_strdup_printf ("%s.db.tar.gz", pacman_database_get_name (database));
-			g_signal_emit_by_name (transaction, "download", filename, (guint) 0, (guint) 0);
+			gchar *path = g_build_filename (alpm_option_get_dbpath (), "sync", filename, NULL);
+			struct stat info;
+			guint saved = 0;
+			
+			/* the database was already up to date, so none of it had to be downloaded */
+			if (g_stat (path, &info) == 0) {
+				saved = (guint) info.st_size;
+			}
+			
+			pacman_transaction_download (transaction, filename, saved, saved);
+			g_free (path);
 			g_free (filename);
 		} else if (result < 0) {
 			g_set_error (error, PACMAN_ERROR, pm_errno, _("Could not update database named [%s]: %s"), pacman_database_get_name (database), alpm_strerrorlast ());
+			pacman_manager_forget_fetches (pacman_manager);
+			pacman_list_free (unchanged);
 			return FALSE;
 		}
 	}
 	
-	g_signal_emit_by_name (transaction, "download", NULL, (guint) 0, (guint) 0);
-	pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DOWNLOAD_START, _("Finished downloading databases"));
+	pacman_manager_forget_fetches (pacman_manager);
+	pacman_list_free (unchanged);
+	pacman_transaction_download (transaction, NULL, 0, 0);
+	pacman_transaction_tell (transaction, PACMAN_TRANSACTION_STATUS_DOWNLOAD_END, _("Finished downloading databases"));
 	
 	return TRUE;
 }
@@ -34,7 +34,9 @@
 #include <pacman-missing-dependency.h>
 #include <pacman-modify.h>
 #include <pacman-package.h>
+#include <pacman-queue.h>
 #include <pacman-remove.h>
+#include <pacman-statistics.h>
 #include <pacman-sync.h>
 #include <pacman-transaction.h>
 #include <pacman-types.h>
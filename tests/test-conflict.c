@@ -0,0 +1,130 @@
+/* test-conflict.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "pacman-list.h"
+#include "pacman-conflict.h"
+#include "pacman-database.h"
+#include "pacman-manager.h"
+#include "pacman-private.h"
+#include "test-server.h"
+
+static PacmanManager *test_manager = NULL;
+
+static PacmanList *test_find_packages (TestDatabase *database, ...) {
+	PacmanDatabase *local;
+	PacmanList *result = NULL;
+	const gchar *name;
+	va_list args;
+	
+	local = pacman_manager_register_local_database (test_manager, NULL);
+	g_assert (local != NULL);
+	
+	va_start (args, database);
+	while ((name = va_arg (args, const gchar *)) != NULL) {
+		PacmanPackage *package = pacman_database_find_package (local, name);
+		
+		g_assert (package != NULL);
+		result = pacman_list_add (result, package);
+	}
+	va_end (args);
+	
+	return result;
+}
+
+static void test_assert_conflict (const PacmanList *entry, const gchar *first, const gchar *second, const gchar *reason) {
+	PacmanConflict *conflict;
+	
+	g_assert (entry != NULL);
+	conflict = (PacmanConflict *) pacman_list_get (entry);
+	
+	g_assert_cmpstr (pacman_conflict_get_first_package (conflict), ==, first);
+	g_assert_cmpstr (pacman_conflict_get_second_package (conflict), ==, second);
+	g_assert_cmpstr (pacman_conflict_get_reason (conflict), ==, reason);
+}
+
+static void test_conflict_teardown (TestDatabase *database, gconstpointer user_data) {
+	g_assert (pacman_manager_unregister_all_databases (test_manager, NULL));
+	test_database_teardown (database, user_data);
+}
+
+static void test_conflict_names (TestDatabase *database, gconstpointer user_data) {
+	PacmanList *packages, *conflicts;
+	
+	test_database_add_package (database, "foo", "1.0-1", "%CONFLICTS%\nbar\n\n");
+	test_database_add_package (database, "bar", "1.0-1", "%CONFLICTS%\nfoo\n\n");
+	test_database_add_package (database, "baz", "1.0-1", NULL);
+	
+	packages = test_find_packages (database, "foo", "bar", "baz", NULL);
+	conflicts = pacman_conflict_check_packages (packages);
+	
+	/* a pair that conflicts both ways is only reported once */
+	g_assert_cmpuint (pacman_list_length (conflicts), ==, 1);
+	test_assert_conflict (conflicts, "foo", "bar", "bar");
+	
+	pacman_list_free_full (conflicts, (GDestroyNotify) pacman_conflict_free);
+	pacman_list_free (packages);
+}
+
+static void test_conflict_provisions (TestDatabase *database, gconstpointer user_data) {
+	PacmanList *packages, *conflicts;
+	
+	test_database_add_package (database, "foo", "1.0-1", "%CONFLICTS%\nbar\n\n");
+	test_database_add_package (database, "bar", "1.0-1", NULL);
+	test_database_add_package (database, "baz", "1.0-1", "%PROVIDES%\nbar=2.0\n\n");
+	test_database_add_package (database, "qux", "1.0-1", "%CONFLICTS%\nbar<2.0\n\n");
+	
+	packages = test_find_packages (database, "foo", "bar", "baz", "qux", NULL);
+	conflicts = pacman_conflict_check_packages (packages);
+	
+	/* the provision of baz only matches when the version is not ruled out */
+	g_assert_cmpuint (pacman_list_length (conflicts), ==, 3);
+	test_assert_conflict (conflicts, "foo", "bar", "bar");
+	test_assert_conflict (pacman_list_nth (conflicts, 1), "foo", "baz", "bar");
+	test_assert_conflict (pacman_list_nth (conflicts, 2), "qux", "bar", "bar<2.0");
+	
+	pacman_list_free_full (conflicts, (GDestroyNotify) pacman_conflict_free);
+	pacman_list_free (packages);
+}
+
+static void test_conflict_self (TestDatabase *database, gconstpointer user_data) {
+	PacmanList *packages, *conflicts;
+	
+	/* the usual way of replacing another package */
+	test_database_add_package (database, "foo-git", "1.0-1", "%CONFLICTS%\nfoo\n\n%PROVIDES%\nfoo\n\n");
+	test_database_add_package (database, "bar", "1.0-1", NULL);
+	
+	packages = test_find_packages (database, "foo-git", "bar", NULL);
+	conflicts = pacman_conflict_check_packages (packages);
+	
+	g_assert (conflicts == NULL);
+	pacman_list_free (packages);
+}
+
+int main (int argc, char **argv) {
+	g_test_init (&argc, &argv, NULL);
+	
+	test_manager = pacman_manager_get (NULL);
+	g_assert (test_manager != NULL);
+	
+	g_test_add ("/conflict/names", TestDatabase, NULL, test_database_setup, test_conflict_names, test_conflict_teardown);
+	g_test_add ("/conflict/provisions", TestDatabase, NULL, test_database_setup, test_conflict_provisions, test_conflict_teardown);
+	g_test_add ("/conflict/self", TestDatabase, NULL, test_database_setup, test_conflict_self, test_conflict_teardown);
+	
+	return g_test_run ();
+}
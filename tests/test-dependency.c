@@ -0,0 +1,101 @@
+/* test-dependency.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "pacman-list.h"
+#include "pacman-database.h"
+#include "pacman-manager.h"
+#include "pacman-statistics.h"
+#include "pacman-private.h"
+#include "test-server.h"
+
+static PacmanManager *test_manager = NULL;
+
+static PacmanDatabase *test_register (void) {
+	PacmanDatabase *result = pacman_manager_register_local_database (test_manager, NULL);
+	
+	g_assert (result != NULL);
+	return result;
+}
+
+static guint64 test_cache_hits (void) {
+	PacmanStatistics *statistics = pacman_manager_get_statistics (test_manager);
+	guint64 result = statistics->dependency_cache_hits;
+	
+	pacman_statistics_free (statistics);
+	return result;
+}
+
+static void test_dependency_teardown (TestDatabase *database, gconstpointer user_data) {
+	g_assert (pacman_manager_unregister_all_databases (test_manager, NULL));
+	test_database_teardown (database, user_data);
+}
+
+static void test_dependency_satisfier (TestDatabase *database, gconstpointer user_data) {
+	PacmanDatabase *local;
+	PacmanPackage *foo;
+	guint64 hits;
+	
+	test_database_add_package (database, "foo", "1.0-1", "%PROVIDES%\nlibfoo=1.0\n\n");
+	test_database_add_package (database, "bar", "1.0-1", NULL);
+	
+	local = test_register ();
+	foo = pacman_database_find_package (local, "foo");
+	g_assert (foo != NULL);
+	
+	g_assert (pacman_dependency_find_satisfier (local, "foo") == foo);
+	g_assert (pacman_dependency_find_satisfier (local, "libfoo>=1.0") == foo);
+	g_assert (pacman_dependency_find_satisfier (local, "libfoo>1.0") == NULL);
+	
+	/* the same answers again, this time from the cache */
+	hits = test_cache_hits ();
+	g_assert (pacman_dependency_find_satisfier (local, "libfoo>=1.0") == foo);
+	g_assert (pacman_dependency_find_satisfier (local, "libfoo>1.0") == NULL);
+	g_assert_cmpuint (test_cache_hits (), ==, hits + 2);
+}
+
+static void test_dependency_invalidate (TestDatabase *database, gconstpointer user_data) {
+	PacmanDatabase *local;
+	PacmanPackage *bar;
+	
+	test_database_add_package (database, "foo", "1.0-1", NULL);
+	
+	local = test_register ();
+	g_assert (pacman_dependency_find_satisfier (local, "bar") == NULL);
+	
+	/* the new database may well be allocated where the old one was, so a stale answer would be found */
+	test_database_add_package (database, "bar", "1.0-1", NULL);
+	g_assert (pacman_manager_unregister_database (test_manager, local, NULL));
+	
+	local = test_register ();
+	bar = pacman_database_find_package (local, "bar");
+	g_assert (bar != NULL);
+	g_assert (pacman_dependency_find_satisfier (local, "bar") == bar);
+}
+
+int main (int argc, char **argv) {
+	g_test_init (&argc, &argv, NULL);
+	
+	test_manager = pacman_manager_get (NULL);
+	g_assert (test_manager != NULL);
+	
+	g_test_add ("/dependency/satisfier", TestDatabase, NULL, test_database_setup, test_dependency_satisfier, test_dependency_teardown);
+	g_test_add ("/dependency/invalidate", TestDatabase, NULL, test_database_setup, test_dependency_invalidate, test_dependency_teardown);
+	
+	return g_test_run ();
+}
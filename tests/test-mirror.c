@@ -0,0 +1,133 @@
+/* test-mirror.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <alpm.h>
+#include "pacman-list.h"
+#include "pacman-private.h"
+#include "test-server.h"
+
+#define TEST_SORTS 500
+
+static const gchar *test_list_nth (const PacmanList *list, guint n) {
+	return (const gchar *) pacman_list_get (pacman_list_nth (list, n));
+}
+
+static void test_mirror_host (TestDatabase *database, gconstpointer user_data) {
+	gchar *host;
+	
+	host = pacman_mirror_get_host ("HTTP://Mirror.Example.com:8080/core/os/i686");
+	g_assert_cmpstr (host, ==, "http://mirror.example.com:8080");
+	g_free (host);
+	
+	host = pacman_mirror_get_host ("http://[::1]:8080/core/os/i686");
+	g_assert_cmpstr (host, ==, "http://[::1]:8080");
+	g_free (host);
+}
+
+static void test_mirror_sort (TestDatabase *database, gconstpointer user_data) {
+	guint n, fastest = 0, untried = 0;
+	
+	pacman_mirror_record_failure ("http://failed.invalid/core");
+	pacman_mirror_record_success ("http://slow.invalid/core", G_USEC_PER_SEC / 2, 0, 0);
+	pacman_mirror_record_success ("http://fast.invalid/core", G_USEC_PER_SEC / 10, 0, 0);
+	
+	for (n = 0; n < TEST_SORTS; ++n) {
+		PacmanList *urls = NULL;
+		const gchar *first;
+		
+		urls = pacman_list_add (urls, (gpointer) "http://failed.invalid/core");
+		urls = pacman_list_add (urls, (gpointer) "http://slow.invalid/core");
+		urls = pacman_list_add (urls, (gpointer) "http://untried.invalid/core");
+		urls = pacman_list_add (urls, (gpointer) "http://fast.invalid/core");
+		urls = pacman_mirror_sort (urls);
+		
+		/* a mirror that has just failed always comes last */
+		g_assert_cmpstr (test_list_nth (urls, 3), ==, "http://failed.invalid/core");
+		
+		first = (const gchar *) pacman_list_get (urls);
+		if (g_strcmp0 (first, "http://fast.invalid/core") == 0) {
+			++fastest;
+			g_assert_cmpstr (test_list_nth (urls, 1), ==, "http://slow.invalid/core");
+			g_assert_cmpstr (test_list_nth (urls, 2), ==, "http://untried.invalid/core");
+		} else {
+			++untried;
+			g_assert_cmpstr (first, ==, "http://untried.invalid/core");
+			g_assert_cmpstr (test_list_nth (urls, 1), ==, "http://fast.invalid/core");
+		}
+		
+		pacman_list_free (urls);
+	}
+	
+	/* mostly the best mirror, but sometimes one that has never been measured */
+	g_assert_cmpuint (fastest, >, untried);
+	g_assert_cmpuint (untried, >, 0);
+}
+
+static void test_mirror_unmeasured (TestDatabase *database, gconstpointer user_data) {
+	guint n;
+	
+	/* with nothing measured there is nothing to explore away from, so the configured order is kept */
+	for (n = 0; n < TEST_SORTS; ++n) {
+		PacmanList *urls = NULL;
+		
+		urls = pacman_list_add (urls, (gpointer) "http://first.invalid/core");
+		urls = pacman_list_add (urls, (gpointer) "http://second.invalid/core");
+		urls = pacman_mirror_sort (urls);
+		
+		g_assert_cmpstr ((const gchar *) pacman_list_get (urls), ==, "http://first.invalid/core");
+		pacman_list_free (urls);
+	}
+}
+
+static void test_mirror_persist (TestDatabase *database, gconstpointer user_data) {
+	GKeyFile *file;
+	gchar *filename, *other;
+	
+	pacman_mirror_record_failure ("http://[::1]:8080/core/os/i686");
+	pacman_mirror_save ();
+	
+	filename = g_build_filename (database->directory, "mirrors", NULL);
+	file = g_key_file_new ();
+	g_assert (g_key_file_load_from_file (file, filename, G_KEY_FILE_NONE, NULL));
+	g_key_file_free (file);
+	
+	/* statistics are only read again when the database path changes */
+	other = test_make_directory ();
+	alpm_option_set_dbpath (other);
+	g_assert (!pacman_mirror_is_backing_off ("http://[::1]:8080/core/os/i686"));
+	
+	alpm_option_set_dbpath (database->directory);
+	g_assert (pacman_mirror_is_backing_off ("http://[::1]:8080/core/os/i686"));
+	
+	test_remove_directory (other);
+	g_free (other);
+	g_free (filename);
+}
+
+int main (int argc, char **argv) {
+	g_test_init (&argc, &argv, NULL);
+	g_assert (alpm_initialize () == 0);
+	
+	g_test_add ("/mirror/host", TestDatabase, NULL, test_database_setup, test_mirror_host, test_database_teardown);
+	g_test_add ("/mirror/sort", TestDatabase, NULL, test_database_setup, test_mirror_sort, test_database_teardown);
+	g_test_add ("/mirror/unmeasured", TestDatabase, NULL, test_database_setup, test_mirror_unmeasured, test_database_teardown);
+	g_test_add ("/mirror/persist", TestDatabase, NULL, test_database_setup, test_mirror_persist, test_database_teardown);
+	
+	return g_test_run ();
+}
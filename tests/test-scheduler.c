@@ -0,0 +1,292 @@
+/* test-scheduler.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <alpm.h>
+#include "pacman-list.h"
+#include "pacman-private.h"
+#include "test-server.h"
+
+#define TEST_FILE_SIZE (256 * 1024)
+#define TEST_FILE_COUNT 4
+
+/* large enough to be split into segments */
+#define TEST_SEGMENTED_SIZE (32 * 1024 * 1024)
+
+typedef struct {
+	TestServer *server;
+	TestServer *broken;
+	TestDatabase database;
+	gchar *data[TEST_FILE_COUNT];
+	GHashTable *progress;
+} TestFixture;
+
+static gchar *test_file_name (guint n) {
+	return g_strdup_printf ("foo%u-1.0-1-i686.pkg.tar.xz", n);
+}
+
+static gchar *test_file_path (guint n) {
+	gchar *name, *result;
+	
+	name = test_file_name (n);
+	result = g_strconcat ("/core/os/i686/", name, NULL);
+	g_free (name);
+	
+	return result;
+}
+
+static void test_fixture_setup (TestFixture *fixture, gconstpointer user_data) {
+	guint n;
+	
+	/* the broken server has no files, so every request to it fails */
+	fixture->server = test_server_new ();
+	fixture->broken = test_server_new ();
+	fixture->progress = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	test_database_setup (&fixture->database, user_data);
+	
+	for (n = 0; n < TEST_FILE_COUNT; ++n) {
+		gchar *path = test_file_path (n);
+		
+		fixture->data[n] = test_make_data (TEST_FILE_SIZE);
+		test_server_add_file (fixture->server, path, fixture->data[n], TEST_FILE_SIZE);
+		g_free (path);
+	}
+}
+
+static void test_fixture_teardown (TestFixture *fixture, gconstpointer user_data) {
+	guint n;
+	
+	test_server_free (fixture->server);
+	test_server_free (fixture->broken);
+	test_database_teardown (&fixture->database, user_data);
+	g_hash_table_unref (fixture->progress);
+	
+	for (n = 0; n < TEST_FILE_COUNT; ++n) {
+		g_free (fixture->data[n]);
+	}
+}
+
+static void test_progress (const gchar *filename, guint64 complete, guint64 total, gpointer user_data) {
+	TestFixture *fixture = (TestFixture *) user_data;
+	
+	/* only ever called from the thread that called pacman_transfer_download_all() */
+	g_assert (complete <= total);
+	if (complete == total) {
+		g_hash_table_insert (fixture->progress, g_strdup (filename), GUINT_TO_POINTER (TRUE));
+	}
+}
+
+static PacmanTransferJob *test_job_new (TestFixture *fixture, guint n, TestServer *first, ...) {
+	PacmanTransferJob *result;
+	TestServer *server;
+	va_list args;
+	gchar *path;
+	
+	result = pacman_transfer_job_new (fixture->database.directory, FALSE);
+	path = test_file_path (n);
+	
+	va_start (args, first);
+	for (server = first; server != NULL; server = va_arg (args, TestServer *)) {
+		result->urls = pacman_list_add (result->urls, test_server_get_url (server, path));
+	}
+	va_end (args);
+	
+	g_free (path);
+	return result;
+}
+
+static void test_assert_file (TestFixture *fixture, const gchar *name, const gchar *data, gsize length) {
+	gchar *filename, *contents;
+	gsize size;
+	
+	filename = g_build_filename (fixture->database.directory, name, NULL);
+	g_assert (g_file_get_contents (filename, &contents, &size, NULL));
+	g_assert_cmpuint (size, ==, length);
+	g_assert (memcmp (contents, data, length) == 0);
+	
+	g_free (contents);
+	g_free (filename);
+}
+
+static void test_scheduler_parallel (TestFixture *fixture, gconstpointer user_data) {
+	PacmanList *jobs = NULL, *i;
+	guint n;
+	
+	for (n = 0; n < TEST_FILE_COUNT; ++n) {
+		jobs = pacman_list_add (jobs, test_job_new (fixture, n, fixture->server, NULL));
+	}
+	
+	pacman_transfer_download_all (jobs, 2, 2, NULL, test_progress, fixture, NULL);
+	
+	for (i = jobs, n = 0; i != NULL; i = pacman_list_next (i), ++n) {
+		PacmanTransferJob *job = (PacmanTransferJob *) pacman_list_get (i);
+		gchar *name = test_file_name (n);
+		
+		g_assert_no_error (job->error);
+		g_assert_cmpint (job->result, ==, 0);
+		test_assert_file (fixture, name, fixture->data[n], TEST_FILE_SIZE);
+		g_assert (g_hash_table_lookup (fixture->progress, name) != NULL);
+		
+		g_free (name);
+	}
+	
+	g_assert_cmpuint (test_server_get_requests (fixture->server), ==, TEST_FILE_COUNT);
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+}
+
+static void test_scheduler_failover (TestFixture *fixture, gconstpointer user_data) {
+	PacmanTransferJob *job;
+	PacmanList *jobs;
+	gchar *name, *url;
+	
+	job = test_job_new (fixture, 0, fixture->broken, fixture->server, NULL);
+	jobs = pacman_list_add (NULL, job);
+	pacman_transfer_download_all (jobs, 2, 2, NULL, NULL, NULL, NULL);
+	
+	name = test_file_name (0);
+	g_assert_no_error (job->error);
+	g_assert_cmpint (job->result, ==, 0);
+	test_assert_file (fixture, name, fixture->data[0], TEST_FILE_SIZE);
+	
+	/* the broken mirror is skipped for a while */
+	url = g_strdup ((const gchar *) pacman_list_get (job->urls));
+	g_assert (pacman_mirror_is_backing_off (url));
+	g_assert_cmpuint (test_server_get_requests (fixture->broken), ==, 1);
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+	
+	/* so the next download goes straight to the mirror that works */
+	job = test_job_new (fixture, 1, fixture->broken, fixture->server, NULL);
+	jobs = pacman_list_add (NULL, job);
+	pacman_transfer_download_all (jobs, 2, 2, NULL, NULL, NULL, NULL);
+	
+	g_assert_cmpint (job->result, ==, 0);
+	g_assert_cmpuint (test_server_get_requests (fixture->broken), ==, 1);
+	
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+	g_free (url);
+	g_free (name);
+}
+
+static void test_scheduler_missing (TestFixture *fixture, gconstpointer user_data) {
+	PacmanTransferJob *job;
+	PacmanList *jobs;
+	gchar *filename;
+	
+	/* the file is on neither mirror */
+	job = pacman_transfer_job_new (fixture->database.directory, FALSE);
+	job->urls = pacman_list_add (job->urls, test_server_get_url (fixture->broken, "/core/os/i686/bar-1.0-1-i686.pkg.tar.xz"));
+	job->urls = pacman_list_add (job->urls, test_server_get_url (fixture->server, "/core/os/i686/bar-1.0-1-i686.pkg.tar.xz"));
+	jobs = pacman_list_add (NULL, job);
+	
+	pacman_transfer_download_all (jobs, 2, 2, NULL, NULL, NULL, NULL);
+	g_assert_cmpint (job->result, ==, -1);
+	g_assert (job->error != NULL);
+	
+	filename = g_build_filename (fixture->database.directory, "bar-1.0-1-i686.pkg.tar.xz", NULL);
+	g_assert (!g_file_test (filename, G_FILE_TEST_EXISTS));
+	
+	g_free (filename);
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+}
+
+static void test_scheduler_segments (TestFixture *fixture, gconstpointer user_data) {
+	PacmanTransferJob *job;
+	TestServer *other;
+	PacmanList *jobs;
+	gchar *data, *partname;
+	const gchar *path = "/core/os/i686/big-1.0-1-i686.pkg.tar.xz";
+	
+	/* two mirrors with the file and one without, so some segments have to be fetched again */
+	data = test_make_data (TEST_SEGMENTED_SIZE);
+	other = test_server_new ();
+	test_server_add_file (fixture->server, path, data, TEST_SEGMENTED_SIZE);
+	test_server_add_file (other, path, data, TEST_SEGMENTED_SIZE);
+	
+	job = pacman_transfer_job_new (fixture->database.directory, FALSE);
+	job->urls = pacman_list_add (job->urls, test_server_get_url (fixture->broken, path));
+	job->urls = pacman_list_add (job->urls, test_server_get_url (fixture->server, path));
+	job->urls = pacman_list_add (job->urls, test_server_get_url (other, path));
+	job->size = TEST_SEGMENTED_SIZE;
+	job->md5sum = g_compute_checksum_for_data (G_CHECKSUM_MD5, (const guchar *) data, TEST_SEGMENTED_SIZE);
+	jobs = pacman_list_add (NULL, job);
+	
+	pacman_transfer_download_all (jobs, 4, 2, NULL, test_progress, fixture, NULL);
+	
+	g_assert_no_error (job->error);
+	g_assert_cmpint (job->result, ==, 0);
+	test_assert_file (fixture, "big-1.0-1-i686.pkg.tar.xz", data, TEST_SEGMENTED_SIZE);
+	g_assert (g_hash_table_lookup (fixture->progress, "big-1.0-1-i686.pkg.tar.xz") != NULL);
+	
+	/* the segments sent to the broken mirror were fetched again from the others */
+	g_assert_cmpuint (test_server_get_requests (fixture->broken), >, 0);
+	g_assert_cmpuint (test_server_get_requests (fixture->server) + test_server_get_requests (other), ==, TEST_SEGMENTED_SIZE / (8 * 1024 * 1024));
+	
+	partname = g_build_filename (fixture->database.directory, "big-1.0-1-i686.pkg.tar.xz.part", NULL);
+	g_assert (!g_file_test (partname, G_FILE_TEST_EXISTS));
+	
+	g_free (partname);
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+	test_server_free (other);
+	g_free (data);
+}
+
+static void test_scheduler_corrupt (TestFixture *fixture, gconstpointer user_data) {
+	PacmanTransferJob *job;
+	PacmanList *jobs;
+	gchar *data, *filename, *partname;
+	const gchar *path = "/core/os/i686/big-1.0-1-i686.pkg.tar.xz";
+	
+	data = test_make_data (TEST_SEGMENTED_SIZE);
+	test_server_add_file (fixture->server, path, data, TEST_SEGMENTED_SIZE);
+	
+	/* the assembled file does not match, so it is thrown away */
+	job = pacman_transfer_job_new (fixture->database.directory, FALSE);
+	job->urls = pacman_list_add (job->urls, test_server_get_url (fixture->server, path));
+	job->urls = pacman_list_add (job->urls, test_server_get_url (fixture->server, path));
+	job->size = TEST_SEGMENTED_SIZE;
+	job->md5sum = g_strdup ("00000000000000000000000000000000");
+	jobs = pacman_list_add (NULL, job);
+	
+	pacman_transfer_download_all (jobs, 4, 4, NULL, NULL, NULL, NULL);
+	g_assert_cmpint (job->result, ==, -1);
+	g_assert (job->error != NULL);
+	
+	filename = g_build_filename (fixture->database.directory, "big-1.0-1-i686.pkg.tar.xz", NULL);
+	partname = g_strconcat (filename, ".part", NULL);
+	g_assert (!g_file_test (filename, G_FILE_TEST_EXISTS));
+	g_assert (!g_file_test (partname, G_FILE_TEST_EXISTS));
+	
+	g_free (partname);
+	g_free (filename);
+	pacman_list_free_full (jobs, (GDestroyNotify) pacman_transfer_job_free);
+	g_free (data);
+}
+
+int main (int argc, char **argv) {
+	g_test_init (&argc, &argv, NULL);
+	g_assert (alpm_initialize () == 0);
+	
+	g_test_add ("/scheduler/parallel", TestFixture, NULL, test_fixture_setup, test_scheduler_parallel, test_fixture_teardown);
+	g_test_add ("/scheduler/failover", TestFixture, NULL, test_fixture_setup, test_scheduler_failover, test_fixture_teardown);
+	g_test_add ("/scheduler/missing", TestFixture, NULL, test_fixture_setup, test_scheduler_missing, test_fixture_teardown);
+	g_test_add ("/scheduler/segments", TestFixture, NULL, test_fixture_setup, test_scheduler_segments, test_fixture_teardown);
+	g_test_add ("/scheduler/corrupt", TestFixture, NULL, test_fixture_setup, test_scheduler_corrupt, test_fixture_teardown);
+	
+	return g_test_run ();
+}
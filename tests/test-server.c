@@ -0,0 +1,318 @@
+/* test-server.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <alpm.h>
+#include "test-server.h"
+
+/* a minimal HTTP/1.1 server that answers one request at a time, on its own thread */
+struct _TestServer {
+	GSocketListener *listener;
+	GCancellable *cancellable;
+	GThread *thread;
+	guint port;
+	
+	GMutex mutex;
+	GHashTable *files;
+	guint requests;
+	gchar *target;
+	gchar *range;
+};
+
+static void test_server_respond (TestServer *server, GSocketConnection *connection) {
+	GDataInputStream *input;
+	GOutputStream *output;
+	GString *response;
+	GBytes *file = NULL;
+	gchar *line, *target = NULL, *range = NULL, *path;
+	gboolean modified_since = FALSE;
+	gsize offset = 0, end = 0, length = 0;
+	
+	input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	g_data_input_stream_set_newline_type (input, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+	output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+	
+	line = g_data_input_stream_read_line (input, NULL, NULL, NULL);
+	if (line != NULL && g_str_has_prefix (line, "GET ")) {
+		target = g_strndup (line + 4, strcspn (line + 4, " "));
+	}
+	g_free (line);
+	
+	while ((line = g_data_input_stream_read_line (input, NULL, NULL, NULL)) != NULL && line[0] != '\0') {
+		if (g_ascii_strncasecmp (line, "Range: bytes=", 13) == 0) {
+			g_free (range);
+			range = g_strdup (line + 13);
+		} else if (g_ascii_strncasecmp (line, "If-Modified-Since:", 18) == 0) {
+			modified_since = TRUE;
+		}
+		
+		g_free (line);
+	}
+	g_free (line);
+	
+	/* proxies are sent the whole URL */
+	path = target;
+	if (path != NULL && g_str_has_prefix (path, "http://")) {
+		path = strchr (path + 7, '/');
+	}
+	
+	g_mutex_lock (&server->mutex);
+	++server->requests;
+	g_free (server->target);
+	server->target = g_strdup (target);
+	g_free (server->range);
+	server->range = g_strdup (range);
+	if (path != NULL) {
+		file = (GBytes *) g_hash_table_lookup (server->files, path);
+		if (file != NULL) {
+			g_bytes_ref (file);
+		}
+	}
+	g_mutex_unlock (&server->mutex);
+	
+	response = g_string_new (NULL);
+	if (file == NULL) {
+		g_string_append (response, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+	} else if (modified_since) {
+		g_string_append (response, "HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n");
+	} else {
+		length = g_bytes_get_size (file);
+		end = length;
+		
+		if (range != NULL && sscanf (range, "%" G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT, &offset, &end) >= 1) {
+			end = (range[strlen (range) - 1] == '-') ? length : MIN (end + 1, length);
+			g_string_append_printf (response, "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %" G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT "\r\n", offset, end - 1, length);
+		} else {
+			offset = 0;
+			g_string_append (response, "HTTP/1.1 200 OK\r\n");
+		}
+		
+		g_string_append_printf (response, "Content-Length: %" G_GSIZE_FORMAT "\r\nLast-Modified: Sat, 01 Jan 2011 00:00:00 GMT\r\nConnection: close\r\n\r\n", end - offset);
+	}
+	
+	g_output_stream_write_all (output, response->str, response->len, NULL, NULL, NULL);
+	if (file != NULL && !modified_since && end > offset) {
+		g_output_stream_write_all (output, (const guchar *) g_bytes_get_data (file, NULL) + offset, end - offset, NULL, NULL, NULL);
+	}
+	
+	g_string_free (response, TRUE);
+	if (file != NULL) {
+		g_bytes_unref (file);
+	}
+	
+	g_free (range);
+	g_free (target);
+	g_object_unref (input);
+}
+
+static gpointer test_server_run (gpointer data) {
+	TestServer *server = (TestServer *) data;
+	GSocketConnection *connection;
+	
+	while ((connection = g_socket_listener_accept (server->listener, NULL, server->cancellable, NULL)) != NULL) {
+		test_server_respond (server, connection);
+		g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+		g_object_unref (connection);
+	}
+	
+	return NULL;
+}
+
+TestServer *test_server_new (void) {
+	TestServer *server = g_slice_new0 (TestServer);
+	GInetAddress *loopback;
+	GSocketAddress *address, *bound = NULL;
+	
+	loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+	address = g_inet_socket_address_new (loopback, 0);
+	
+	server->listener = g_socket_listener_new ();
+	g_assert (g_socket_listener_add_address (server->listener, address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, &bound, NULL));
+	server->port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (bound));
+	
+	g_object_unref (bound);
+	g_object_unref (address);
+	g_object_unref (loopback);
+	
+	g_mutex_init (&server->mutex);
+	server->files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_bytes_unref);
+	server->cancellable = g_cancellable_new ();
+	server->thread = g_thread_new ("test-server", test_server_run, server);
+	return server;
+}
+
+void test_server_free (TestServer *server) {
+	g_return_if_fail (server != NULL);
+	
+	g_cancellable_cancel (server->cancellable);
+	g_thread_join (server->thread);
+	
+	g_object_unref (server->cancellable);
+	g_socket_listener_close (server->listener);
+	g_object_unref (server->listener);
+	
+	g_hash_table_unref (server->files);
+	g_mutex_clear (&server->mutex);
+	g_free (server->target);
+	g_free (server->range);
+	g_slice_free (TestServer, server);
+}
+
+gchar *test_server_get_url (TestServer *server, const gchar *path) {
+	g_return_val_if_fail (server != NULL, NULL);
+	g_return_val_if_fail (path != NULL, NULL);
+	
+	return g_strdup_printf ("http://127.0.0.1:%u%s", server->port, path);
+}
+
+guint test_server_get_port (TestServer *server) {
+	g_return_val_if_fail (server != NULL, 0);
+	
+	return server->port;
+}
+
+void test_server_add_file (TestServer *server, const gchar *path, const gchar *data, gsize length) {
+	g_return_if_fail (server != NULL);
+	g_return_if_fail (path != NULL);
+	
+	g_mutex_lock (&server->mutex);
+	g_hash_table_insert (server->files, g_strdup (path), g_bytes_new (data, length));
+	g_mutex_unlock (&server->mutex);
+}
+
+guint test_server_get_requests (TestServer *server) {
+	guint result;
+	
+	g_return_val_if_fail (server != NULL, 0);
+	
+	g_mutex_lock (&server->mutex);
+	result = server->requests;
+	g_mutex_unlock (&server->mutex);
+	
+	return result;
+}
+
+gchar *test_server_get_last_target (TestServer *server) {
+	gchar *result;
+	
+	g_return_val_if_fail (server != NULL, NULL);
+	
+	g_mutex_lock (&server->mutex);
+	result = g_strdup (server->target);
+	g_mutex_unlock (&server->mutex);
+	
+	return result;
+}
+
+gchar *test_server_get_last_range (TestServer *server) {
+	gchar *result;
+	
+	g_return_val_if_fail (server != NULL, NULL);
+	
+	g_mutex_lock (&server->mutex);
+	result = g_strdup (server->range);
+	g_mutex_unlock (&server->mutex);
+	
+	return result;
+}
+
+gchar *test_make_data (gsize length) {
+	gchar *result = (gchar *) g_malloc (length);
+	gsize i;
+	
+	/* not compressible, so nothing along the way can shorten it */
+	for (i = 0; i < length; ++i) {
+		result[i] = (gchar) g_random_int_range (0, 256);
+	}
+	
+	return result;
+}
+
+gchar *test_make_directory (void) {
+	gchar *result = g_dir_make_tmp ("pacman-glib-XXXXXX", NULL);
+	
+	g_assert (result != NULL);
+	return result;
+}
+
+void test_remove_directory (const gchar *path) {
+	GDir *dir;
+	const gchar *name;
+	
+	g_return_if_fail (path != NULL);
+	
+	dir = g_dir_open (path, 0, NULL);
+	if (dir != NULL) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			gchar *child = g_build_filename (path, name, NULL);
+			
+			if (g_file_test (child, G_FILE_TEST_IS_DIR)) {
+				test_remove_directory (child);
+			} else {
+				g_unlink (child);
+			}
+			
+			g_free (child);
+		}
+		
+		g_dir_close (dir);
+	}
+	
+	g_rmdir (path);
+}
+
+void test_database_setup (TestDatabase *database, gconstpointer user_data) {
+	database->directory = test_make_directory ();
+	
+	/* mirror statistics are kept next to the databases */
+	alpm_option_set_dbpath (database->directory);
+}
+
+void test_database_teardown (TestDatabase *database, gconstpointer user_data) {
+	test_remove_directory (database->directory);
+	g_free (database->directory);
+}
+
+void test_database_add_package (TestDatabase *database, const gchar *name, const gchar *version, const gchar *depends) {
+	gchar *entry, *path, *filename, *desc;
+	
+	g_return_if_fail (database != NULL);
+	g_return_if_fail (name != NULL);
+	g_return_if_fail (version != NULL);
+	
+	/* laid out the way libalpm reads the local database */
+	entry = g_strdup_printf ("%s-%s", name, version);
+	path = g_build_filename (database->directory, "local", entry, NULL);
+	g_assert (g_mkdir_with_parents (path, 0755) == 0);
+	
+	filename = g_build_filename (path, "desc", NULL);
+	desc = g_strdup_printf ("%%NAME%%\n%s\n\n%%VERSION%%\n%s\n\n%%REASON%%\n0\n\n", name, version);
+	g_assert (g_file_set_contents (filename, desc, -1, NULL));
+	g_free (desc);
+	g_free (filename);
+	
+	filename = g_build_filename (path, "depends", NULL);
+	g_assert (g_file_set_contents (filename, (depends != NULL) ? depends : "", -1, NULL));
+	g_free (filename);
+	
+	g_free (path);
+	g_free (entry);
+}
@@ -0,0 +1,53 @@
+/* test-server.h
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TEST_SERVER_H__
+#define __TEST_SERVER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _TestServer TestServer;
+
+typedef struct {
+	gchar *directory;
+} TestDatabase;
+
+TestServer *test_server_new (void);
+void test_server_free (TestServer *server);
+
+gchar *test_server_get_url (TestServer *server, const gchar *path);
+guint test_server_get_port (TestServer *server);
+void test_server_add_file (TestServer *server, const gchar *path, const gchar *data, gsize length);
+
+guint test_server_get_requests (TestServer *server);
+gchar *test_server_get_last_target (TestServer *server);
+gchar *test_server_get_last_range (TestServer *server);
+
+gchar *test_make_data (gsize length);
+gchar *test_make_directory (void);
+void test_remove_directory (const gchar *path);
+
+void test_database_setup (TestDatabase *database, gconstpointer user_data);
+void test_database_teardown (TestDatabase *database, gconstpointer user_data);
+void test_database_add_package (TestDatabase *database, const gchar *name, const gchar *version, const gchar *depends);
+
+G_END_DECLS
+
+#endif
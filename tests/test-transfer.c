@@ -0,0 +1,183 @@
+/* test-transfer.c
+ *
+ * Copyright (C) 2010 Jonathan Conder <j@skurvy.no-ip.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <alpm.h>
+#include "pacman-private.h"
+#include "test-server.h"
+
+#define TEST_FILE_SIZE (256 * 1024)
+
+typedef struct {
+	TestServer *server;
+	TestDatabase database;
+	gchar *data;
+} TestFixture;
+
+static void test_fixture_setup (TestFixture *fixture, gconstpointer user_data) {
+	fixture->server = test_server_new ();
+	fixture->data = test_make_data (TEST_FILE_SIZE);
+	
+	test_database_setup (&fixture->database, user_data);
+	test_server_add_file (fixture->server, "/core/os/i686/foo-1.0-1-i686.pkg.tar.xz", fixture->data, TEST_FILE_SIZE);
+}
+
+static void test_fixture_teardown (TestFixture *fixture, gconstpointer user_data) {
+	test_server_free (fixture->server);
+	test_database_teardown (&fixture->database, user_data);
+	g_free (fixture->data);
+}
+
+static void test_assert_contents (const gchar *filename, const gchar *data, gsize length) {
+	gchar *contents, *expected, *md5sum;
+	gsize size;
+	
+	g_assert (g_file_get_contents (filename, &contents, &size, NULL));
+	g_assert_cmpuint (size, ==, length);
+	g_assert (memcmp (contents, data, length) == 0);
+	
+	/* the checksum is worked out while the file is written */
+	expected = g_compute_checksum_for_data (G_CHECKSUM_MD5, (const guchar *) data, length);
+	md5sum = pacman_checksum_lookup (filename);
+	g_assert_cmpstr (md5sum, ==, expected);
+	
+	g_free (md5sum);
+	g_free (expected);
+	g_free (contents);
+}
+
+static void test_transfer_http (TestFixture *fixture, gconstpointer user_data) {
+	gchar *url, *filename;
+	GError *error = NULL;
+	
+	url = test_server_get_url (fixture->server, "/core/os/i686/foo-1.0-1-i686.pkg.tar.xz");
+	filename = g_build_filename (fixture->database.directory, "foo-1.0-1-i686.pkg.tar.xz", NULL);
+	
+	g_assert_cmpint (pacman_transfer_download (url, fixture->database.directory, FALSE, NULL, NULL, NULL, &error), ==, 0);
+	g_assert_no_error (error);
+	test_assert_contents (filename, fixture->data, TEST_FILE_SIZE);
+	
+	/* the server says it has not changed */
+	g_assert_cmpint (pacman_transfer_download (url, fixture->database.directory, FALSE, NULL, NULL, NULL, &error), ==, 1);
+	g_assert_no_error (error);
+	g_assert_cmpuint (test_server_get_requests (fixture->server), ==, 2);
+	
+	g_free (filename);
+	g_free (url);
+}
+
+static void test_transfer_resume (TestFixture *fixture, gconstpointer user_data) {
+	gchar *url, *filename, *partname, *range;
+	GError *error = NULL;
+	
+	url = test_server_get_url (fixture->server, "/core/os/i686/foo-1.0-1-i686.pkg.tar.xz");
+	filename = g_build_filename (fixture->database.directory, "foo-1.0-1-i686.pkg.tar.xz", NULL);
+	partname = g_strconcat (filename, ".part", NULL);
+	
+	g_assert (g_file_set_contents (partname, fixture->data, 1000, NULL));
+	g_assert_cmpint (pacman_transfer_download (url, fixture->database.directory, FALSE, NULL, NULL, NULL, &error), ==, 0);
+	g_assert_no_error (error);
+	
+	range = test_server_get_last_range (fixture->server);
+	g_assert_cmpstr (range, ==, "1000-");
+	test_assert_contents (filename, fixture->data, TEST_FILE_SIZE);
+	g_assert (!g_file_test (partname, G_FILE_TEST_EXISTS));
+	
+	g_free (range);
+	g_free (partname);
+	g_free (filename);
+	g_free (url);
+}
+
+static void test_transfer_missing (TestFixture *fixture, gconstpointer user_data) {
+	gchar *url;
+	GError *error = NULL;
+	
+	url = test_server_get_url (fixture->server, "/core/os/i686/bar-1.0-1-i686.pkg.tar.xz");
+	g_assert_cmpint (pacman_transfer_download (url, fixture->database.directory, FALSE, NULL, NULL, NULL, &error), ==, -1);
+	g_assert (error != NULL);
+	g_assert (pacman_mirror_is_backing_off (url));
+	
+	g_error_free (error);
+	g_free (url);
+}
+
+static void test_transfer_proxy (TestFixture *fixture, gconstpointer user_data) {
+	gchar *proxy, *target, *filename;
+	GError *error = NULL;
+	
+	/* the mirror does not exist, so the request only works through the proxy */
+	proxy = g_strdup_printf ("127.0.0.1:%u", test_server_get_port (fixture->server));
+	g_setenv ("http_proxy", proxy, TRUE);
+	g_unsetenv ("no_proxy");
+	
+	g_assert_cmpint (pacman_transfer_download ("http://mirror.invalid/core/os/i686/foo-1.0-1-i686.pkg.tar.xz", fixture->database.directory, FALSE, NULL, NULL, NULL, &error), ==, 0);
+	g_assert_no_error (error);
+	g_unsetenv ("http_proxy");
+	
+	target = test_server_get_last_target (fixture->server);
+	g_assert_cmpstr (target, ==, "http://mirror.invalid/core/os/i686/foo-1.0-1-i686.pkg.tar.xz");
+	
+	filename = g_build_filename (fixture->database.directory, "foo-1.0-1-i686.pkg.tar.xz", NULL);
+	test_assert_contents (filename, fixture->data, TEST_FILE_SIZE);
+	
+	g_free (filename);
+	g_free (target);
+	g_free (proxy);
+}
+
+static void test_transfer_file (TestFixture *fixture, gconstpointer user_data) {
+	gchar *source, *url, *cache, *filename;
+	GError *error = NULL;
+	
+	source = g_build_filename (fixture->database.directory, "foo-1.0-1-i686.pkg.tar.xz", NULL);
+	g_assert (g_file_set_contents (source, fixture->data, TEST_FILE_SIZE, NULL));
+	url = g_filename_to_uri (source, NULL, NULL);
+	
+	cache = g_build_filename (fixture->database.directory, "cache", NULL);
+	g_assert (g_mkdir (cache, 0755) == 0);
+	filename = g_build_filename (cache, "foo-1.0-1-i686.pkg.tar.xz", NULL);
+	
+	g_assert_cmpint (pacman_transfer_download (url, cache, FALSE, NULL, NULL, NULL, &error), ==, 0);
+	g_assert_no_error (error);
+	test_assert_contents (filename, fixture->data, TEST_FILE_SIZE);
+	
+	/* the copy keeps the modification time, so it is up to date */
+	g_assert_cmpint (pacman_transfer_download (url, cache, FALSE, NULL, NULL, NULL, &error), ==, 1);
+	g_assert_no_error (error);
+	
+	g_free (filename);
+	g_free (cache);
+	g_free (url);
+	g_free (source);
+}
+
+int main (int argc, char **argv) {
+	g_test_init (&argc, &argv, NULL);
+	g_assert (alpm_initialize () == 0);
+	
+	g_test_add ("/transfer/http", TestFixture, NULL, test_fixture_setup, test_transfer_http, test_fixture_teardown);
+	g_test_add ("/transfer/resume", TestFixture, NULL, test_fixture_setup, test_transfer_resume, test_fixture_teardown);
+	g_test_add ("/transfer/missing", TestFixture, NULL, test_fixture_setup, test_transfer_missing, test_fixture_teardown);
+	g_test_add ("/transfer/proxy", TestFixture, NULL, test_fixture_setup, test_transfer_proxy, test_fixture_teardown);
+	g_test_add ("/transfer/file", TestFixture, NULL, test_fixture_setup, test_transfer_file, test_fixture_teardown);
+	
+	return g_test_run ();
+}